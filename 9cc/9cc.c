@@ -10,12 +10,18 @@
 #include "9cc.h"
 #include "codegen.h"
 #include "parser.h"
+#include "optimize.h"
+#include "ir.h"
+#include "passes.h"
+#include "profile.h"
+#include "parallel.h"
+#include "asm.h"
 
 char *user_input;
 Token *token;
-Node *data[100];
-Node *data_string_literal[100];
-Node *text[100];
+Node **data;
+Node **data_string_literal;
+Node **text;
 
 void error(char *fmt, ...)
 {
@@ -48,6 +54,14 @@ const char *getTokenKindName(TokenKind kind)
         return "TK_WHILE";
     case TK_FOR:
         return "TK_FOR";
+    case TK_SWITCH:
+        return "TK_SWITCH";
+    case TK_CASE:
+        return "TK_CASE";
+    case TK_DEFAULT:
+        return "TK_DEFAULT";
+    case TK_BREAK:
+        return "TK_BREAK";
     default:
         return "Unknown";
     }
@@ -107,6 +121,16 @@ const char *getNodeKindName(NodeKind kind)
         return "For";
     case ND_FUNCALL:
         return "Funcall";
+    case ND_SWITCH:
+        return "Switch";
+    case ND_CASE:
+        return "Case";
+    case ND_DEFAULT:
+        return "Default";
+    case ND_BREAK:
+        return "Break";
+    case ND_INIT:
+        return "Init";
     default:
         return "Unknown";
     }
@@ -254,6 +278,38 @@ Token *tokenize(char *p)
             continue;
         }
 
+        if (strncmp(p, "switch", 6) == 0 && !is_alnum(p[6]))
+        {
+            cur = new_token(TK_SWITCH, cur, p);
+            cur->len = 6;
+            p = p + 6;
+            continue;
+        }
+
+        if (strncmp(p, "case", 4) == 0 && !is_alnum(p[4]))
+        {
+            cur = new_token(TK_CASE, cur, p);
+            cur->len = 4;
+            p = p + 4;
+            continue;
+        }
+
+        if (strncmp(p, "default", 7) == 0 && !is_alnum(p[7]))
+        {
+            cur = new_token(TK_DEFAULT, cur, p);
+            cur->len = 7;
+            p = p + 7;
+            continue;
+        }
+
+        if (strncmp(p, "break", 5) == 0 && !is_alnum(p[5]))
+        {
+            cur = new_token(TK_BREAK, cur, p);
+            cur->len = 5;
+            p = p + 5;
+            continue;
+        }
+
         if (strncmp(p, "int", 3) == 0 && !is_alnum(p[3]))
         {
             cur = new_token(TK_TYPE, cur, p);
@@ -315,7 +371,7 @@ Token *tokenize(char *p)
             continue;
         }
 
-        if (*p == '+' || *p == '-' || *p == '*' || *p == '/' || *p == ')' || *p == '(' || *p == '>' || *p == '<' || *p == '=' || *p == ';' || *p == '{' || *p == '}' || *p == ',' || *p == '&' || *p == '[' || *p == ']')
+        if (*p == '+' || *p == '-' || *p == '*' || *p == '/' || *p == ')' || *p == '(' || *p == '>' || *p == '<' || *p == '=' || *p == ';' || *p == '{' || *p == '}' || *p == ',' || *p == '&' || *p == '[' || *p == ']' || *p == ':')
         {
             cur = new_token(TK_RESERVED, cur, p++);
             cur->len = 1;
@@ -366,44 +422,179 @@ char *read_file(char *path)
 
 int main(int argc, char **argv)
 {
-    if (argc == 2)
-    {
-        user_input = argv[1];
-    }
-    else if (argc == 3 && strcmp(argv[1], "--path") == 0)
+    // --ir: SSA形式を経由してコードを生成する
+    // --dump-ir: アセンブリの代わりにSSA形式を出力する
+    // -O0, -O1, -O2 (既定), --passes=a,b,...: 実行する最適化パス
+    // --time-passes: パスごとの時間とプログラムの大きさを標準エラーに出す
+    // --instrument-branches[=file]: 分岐と呼び出しの実行回数を終了時にfile (既定は9cc.prof) に書き出す
+    // --profile-use=file: その実行回数をもとに最適化する
+    // --profile-functions: 関数ごとの呼び出し回数とサイクル数を終了時に出す (prof.cとリンクする)
+    // -j<N>, --jobs=<N>: N個のスレッドで関数のコードを生成する (-jだけならプロセッサの数)
+    // -c: アセンブラを通さずにオブジェクトファイルを出力する
+    // -o file: 出力先 (既定は標準出力、-cではa.o)
+    bool use_ir = false;
+    bool dump_ir = false;
+    bool time_passes = false;
+    char *profile_path = NULL;
+    bool object = false;
+    char *output_path = NULL;
+    for (int i = 1; i < argc; i++)
     {
-        user_input = read_file(argv[2]);
+        if (strcmp(argv[i], "--path") == 0 && i + 1 < argc)
+        {
+            user_input = read_file(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ir") == 0)
+        {
+            use_ir = true;
+        }
+        else if (strcmp(argv[i], "--dump-ir") == 0)
+        {
+            use_ir = dump_ir = true;
+        }
+        else if (strncmp(argv[i], "-O", 2) == 0 && isdigit(argv[i][2]) && argv[i][3] == '\0')
+        {
+            select_opt_level(argv[i][2] - '0');
+        }
+        else if (strncmp(argv[i], "--passes=", 9) == 0)
+        {
+            select_passes(argv[i] + 9);
+        }
+        else if (strcmp(argv[i], "--time-passes") == 0)
+        {
+            time_passes = true;
+        }
+        else if (strcmp(argv[i], "--instrument-branches") == 0)
+        {
+            instrument_path = "9cc.prof";
+        }
+        else if (strncmp(argv[i], "--instrument-branches=", 22) == 0)
+        {
+            instrument_path = argv[i] + 22;
+        }
+        else if (strcmp(argv[i], "--profile-functions") == 0)
+        {
+            profile_functions = true;
+        }
+        else if (strncmp(argv[i], "--profile-use=", 14) == 0)
+        {
+            profile_path = argv[i] + 14;
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            object = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0)
+        {
+            jobs = 0;
+        }
+        else if (strncmp(argv[i], "-j", 2) == 0 && isdigit(argv[i][2]))
+        {
+            jobs = atoi(argv[i] + 2);
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0 && isdigit(argv[i][7]))
+        {
+            jobs = atoi(argv[i] + 7);
+        }
+        else if (argv[i][0] == '-' || user_input)
+        {
+            error("不明な引数です: %s", argv[i]);
+        }
+        else
+        {
+            user_input = argv[i];
+        }
     }
-    else
+    if (!user_input)
     {
         error("引数の個数が正しくありません");
         return 1;
     }
-
-    // no buffering
-    setvbuf(stdout, NULL, _IONBF, 0);
+    if (instrument_path && use_ir)
+    {
+        error("--instrument-branches は --ir と一緒に使えません");
+    }
 
     token = tokenize(user_input);
     // printToken(token);
     program();
     // printCode();
+    number_sites(user_input);
+    if (profile_path)
+    {
+        read_profile(profile_path);
+    }
+    run_ast_passes(use_ir);
 
-    printf(".intel_syntax noprefix\n");
+    emit(".intel_syntax noprefix");
 
-    printf(".section .data\n");
+    // 初期値のない大域変数はファイルに領域を持たない.bssに置く
+    emit(".section .bss");
     for (int i = 0; data[i]; i++)
     {
-        gen(data[i]);
+        if (!data[i]->body)
+        {
+            gen(data[i]);
+        }
     }
+    emit(".section .data");
+    for (int i = 0; data[i]; i++)
+    {
+        if (data[i]->body)
+        {
+            gen(data[i]);
+        }
+    }
+    // 文字列リテラルは読み取り専用で、リンカが同じ文字列をまとめられるようにする
+    emit(".section .rodata.str1.1,\"aMS\",@progbits,1");
     for (int i = 0; data_string_literal[i]; i++)
     {
         gen_string_literal(data_string_literal[i]);
     }
 
-    printf(".section .text\n");
-    for (int i = 0; text[i]; i++)
+    if (dump_ir)
+    {
+        for (int i = 0; text[i]; i++)
+        {
+            IrFunc *f = build_ir(text[i]);
+            verify_ir(f);
+            print_ir(f);
+        }
+        return 0;
+    }
+
+    emit(".section .text");
+    // 関数のコードにはそれぞれ生成したスレッドでアセンブリのパスをかける
+    gen_functions(use_ir);
+
+    // 残りのコードは別のリストに生成してパスをかけてからつなぐ
+    Inst rest = {};
+    Inst *saved = redirect_code(&rest);
+    emit_profile_dump();
+    emit_profile_records();
+    emit(".section .note.GNU-stack,\"\",@progbits");
+    redirect_code(saved);
+    run_asm_passes(&rest);
+    append_code(&rest);
+    if (object)
+    {
+        assemble(code(), output_path ? output_path : "a.o");
+    }
+    else
+    {
+        if (output_path && !freopen(output_path, "w", stdout))
+        {
+            error("cannot open %s: %s", output_path, strerror(errno));
+        }
+        print_code();
+    }
+    if (time_passes)
     {
-        gen(text[i]);
+        print_pass_stats();
     }
 
     return 0;
@@ -14,6 +14,10 @@ typedef enum
     TK_TYPE, //int, etc
     TK_SIZEOF,
     TK_STRING_LITERAL,
+    TK_SWITCH,
+    TK_CASE,
+    TK_DEFAULT,
+    TK_BREAK,
 } TokenKind;
 
 typedef struct Token Token;
@@ -62,6 +66,12 @@ typedef enum
     ND_GVAR,
     ND_GVAR_DECL,
     ND_STR_LITERAL,
+    ND_COMMA, // lhs, rhs: evaluates lhs for its side effects (made by inlining)
+    ND_SWITCH,  // cond, body: the statements of the switch, with ND_CASE and ND_DEFAULT among them
+    ND_CASE,    // val: a label in the body of a switch
+    ND_DEFAULT,
+    ND_BREAK,   // leaves the innermost loop or switch
+    ND_INIT,    // lhs: a local array, body: the values of its first elements (ND_NUM); the rest are zero
 } NodeKind;
 
 typedef struct Node Node;
@@ -83,6 +93,7 @@ struct Node
     Node *inc;
 
     //For block body, statements and func body
+    //ND_GVAR_DECL, ND_INIT: the initial values of the elements
     Node *body;
     Node *next;
 
@@ -92,6 +103,14 @@ struct Node
     char *argname;
     Node *args;
     int argname_len;
+    int stack_size;
+    // ND_FUNCALL: the call is in tail position and can be a jump
+    // ND_FUNC: the function has a self-recursive tail call
+    int tail_call;
+    // ND_FOR: the body runs for this many array elements at once (see vectorize.c)
+    int lanes;
+    // ND_IF, ND_WHILE, ND_FOR, ND_FUNCALL: the number of the site in the profile (see profile.c), 0 if none
+    int site;
 
     //global variable
     char *gvarname;
@@ -131,6 +150,19 @@ void leave_scope();
 void error(char *fmt, ...);
 
 extern Token *token;
-extern Node *data[100];
-extern Node *data_string_literal[100];
-extern Node *text[100];
+// NULL-terminated lists which program() fills
+extern Node **data;
+extern Node **data_string_literal;
+extern Node **text;
+
+Node *new_node(NodeKind kind, Node *lhs, Node *rhs);
+Node *new_node_num(int val);
+
+Type *new_type(int ty);
+Type *pointer_to(Type *base);
+Type *array_of(Type *base, int size);
+int is_pointer(Type *t);
+int size_of(Type *t);
+int align_of(Type *t);
+int align_to(int n, int align);
+void add_type(Node *node);
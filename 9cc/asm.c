@@ -0,0 +1,1731 @@
+#include <ctype.h>
+#include <elf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+/*
+ * Integrated assembler
+ *
+ * Encodes the instruction list, the same Intel syntax that print_code()
+ * writes, into the bytes of its sections and writes them as an ELF64
+ * relocatable object (see elf.c), so that -c does not need an external
+ * assembler. Only the instructions and directives that the code generators
+ * emit are supported.
+ *
+ * Jumps to labels in the same section get an 8-bit displacement when it
+ * fits. Since that moves the labels after them, the lines are encoded again
+ * as long as a label moves after a reference to it above its definition has
+ * used its old address. A jump which once needed a 32-bit displacement keeps
+ * it, so the labels only move down and this terminates.
+ *
+ * References to local symbols in the same section are resolved here; the
+ * others become relocations, which elf.c turns into references to the
+ * section symbol where it can.
+ */
+
+typedef enum
+{
+    OP_NONE,
+    OP_REG,
+    OP_XMM,
+    OP_IMM,
+    OP_MEM,
+    OP_SYM,
+} OpKind;
+
+#define RIP 16
+
+typedef struct
+{
+    OpKind kind;
+    int size;  // in bytes; 0 for a memory operand without PTR
+    int reg;   // OP_REG, OP_XMM
+    int base;  // OP_MEM: a register, RIP or -1
+    int index; // OP_MEM: a register or -1
+    int scale;
+    long disp; // OP_MEM: the displacement; OP_IMM: the value; OP_SYM: the addend
+    int sym;   // OP_MEM relative to rip and OP_SYM: index in obj.syms
+} Operand;
+
+typedef enum
+{
+    // 命令
+    I_MOV,
+    I_MOVSX,
+    I_MOVSXD,
+    I_MOVZX,
+    I_LEA,
+    I_ADD,
+    I_OR,
+    I_AND,
+    I_SUB,
+    I_XOR,
+    I_CMP,
+    I_TEST,
+    I_PUSH,
+    I_POP,
+    I_IMUL,
+    I_NOT,
+    I_NEG,
+    I_MUL,
+    I_DIV,
+    I_IDIV,
+    I_INC,
+    I_DEC,
+    I_SHL,
+    I_SHR,
+    I_SAR,
+    I_SETCC,
+    I_JCC,
+    I_JMP,
+    I_CALL,
+    I_RET,
+    I_CQO,
+    I_CDQ,
+    I_CDQE,
+    I_LEAVE,
+    I_NOP,
+    I_REP_MOVSB,
+    I_REP_MOVSQ,
+    I_REP_STOSB,
+    I_REP_STOSQ,
+    I_MOVDQU,
+    I_MOVDQA,
+    I_MOVD,
+    I_MOVQ,
+    I_PSHUFD,
+    I_PACKED,
+    // 疑似命令
+    D_SECTION,
+    D_GLOBL,
+    D_TYPE,
+    D_SIZE,
+    D_ALIGN,
+    D_BYTE,
+    D_LONG,
+    D_QUAD,
+    D_ZERO,
+    D_STRING,
+    D_IGNORE,
+    LABEL,
+} Kind;
+
+typedef struct
+{
+    char *name;
+    Kind kind;
+    int opcode; // I_PACKED: the opcode after 66
+} Mnemonic;
+
+static Mnemonic mnemonics[] = {
+    {"mov", I_MOV},
+    {"movsx", I_MOVSX},
+    {"movsxd", I_MOVSXD},
+    {"movzx", I_MOVZX},
+    {"movzb", I_MOVZX},
+    {"lea", I_LEA},
+    {"add", I_ADD},
+    {"or", I_OR},
+    {"and", I_AND},
+    {"sub", I_SUB},
+    {"xor", I_XOR},
+    {"cmp", I_CMP},
+    {"test", I_TEST},
+    {"push", I_PUSH},
+    {"pop", I_POP},
+    {"imul", I_IMUL},
+    {"not", I_NOT},
+    {"neg", I_NEG},
+    {"mul", I_MUL},
+    {"div", I_DIV},
+    {"idiv", I_IDIV},
+    {"inc", I_INC},
+    {"dec", I_DEC},
+    {"shl", I_SHL},
+    {"sal", I_SHL},
+    {"shr", I_SHR},
+    {"sar", I_SAR},
+    {"jmp", I_JMP},
+    {"call", I_CALL},
+    {"ret", I_RET},
+    {"cqo", I_CQO},
+    {"cdq", I_CDQ},
+    {"cdqe", I_CDQE},
+    {"leave", I_LEAVE},
+    {"nop", I_NOP},
+    {"rep movsb", I_REP_MOVSB},
+    {"rep movsq", I_REP_MOVSQ},
+    {"rep stosb", I_REP_STOSB},
+    {"rep stosq", I_REP_STOSQ},
+    {"movdqu", I_MOVDQU},
+    {"movdqa", I_MOVDQA},
+    {"movd", I_MOVD},
+    {"movq", I_MOVQ},
+    {"pshufd", I_PSHUFD},
+    {"punpcklbw", I_PACKED, 0x0f60},
+    {"punpcklwd", I_PACKED, 0x0f61},
+    {"punpckldq", I_PACKED, 0x0f62},
+    {"paddb", I_PACKED, 0x0ffc},
+    {"paddw", I_PACKED, 0x0ffd},
+    {"paddd", I_PACKED, 0x0ffe},
+    {"paddq", I_PACKED, 0x0fd4},
+    {"psubb", I_PACKED, 0x0ff8},
+    {"psubw", I_PACKED, 0x0ff9},
+    {"psubd", I_PACKED, 0x0ffa},
+    {"psubq", I_PACKED, 0x0ffb},
+    {"pxor", I_PACKED, 0x0fef},
+    {".section", D_SECTION},
+    {".globl", D_GLOBL},
+    {".type", D_TYPE},
+    {".size", D_SIZE},
+    {".align", D_ALIGN},
+    {".byte", D_BYTE},
+    {".long", D_LONG},
+    {".quad", D_QUAD},
+    {".zero", D_ZERO},
+    {".string", D_STRING},
+    {".intel_syntax", D_IGNORE},
+    {NULL},
+};
+
+// Suffixes of jcc and setcc and their condition codes
+static struct
+{
+    char *name;
+    int cc;
+} conds[] = {
+    {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2}, {"ae", 3}, {"nb", 3}, {"nc", 3}, {"e", 4}, {"z", 4}, {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6}, {"a", 7}, {"nbe", 7}, {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11}, {"po", 11}, {"l", 12}, {"nge", 12}, {"ge", 13}, {"nl", 13}, {"le", 14}, {"ng", 14}, {"g", 15}, {"nle", 15}, {NULL},
+};
+
+// Registers in the order of their encoding
+static const char *reg_names[][4] = {
+    {"rax", "eax", "ax", "al"},
+    {"rcx", "ecx", "cx", "cl"},
+    {"rdx", "edx", "dx", "dl"},
+    {"rbx", "ebx", "bx", "bl"},
+    {"rsp", "esp", "sp", "spl"},
+    {"rbp", "ebp", "bp", "bpl"},
+    {"rsi", "esi", "si", "sil"},
+    {"rdi", "edi", "di", "dil"},
+    {"r8", "r8d", "r8w", "r8b"},
+    {"r9", "r9d", "r9w", "r9b"},
+    {"r10", "r10d", "r10w", "r10b"},
+    {"r11", "r11d", "r11w", "r11b"},
+    {"r12", "r12d", "r12w", "r12b"},
+    {"r13", "r13d", "r13w", "r13b"},
+    {"r14", "r14d", "r14w", "r14b"},
+    {"r15", "r15d", "r15w", "r15b"},
+};
+
+static const int reg_sizes[] = {8, 4, 2, 1};
+
+typedef struct
+{
+    char *text;
+    Kind kind;
+    int cc;     // I_JCC, I_SETCC
+    int opcode; // I_PACKED
+    Operand op[3];
+    int nops;
+    char *args;  // the arguments of a directive
+    int section; // D_SECTION
+    int sym;     // LABEL, D_GLOBL, D_TYPE
+    bool far;    // the jump needs a 32-bit displacement
+} Line;
+
+static Object obj;
+static Section *sec; // the section being filled
+static int cur;      // its index
+static int pass;
+
+// A reference above its definition used an address which has changed.
+static bool again;
+
+static bool is_ident(char c)
+{
+    return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+static void bad(Line *l)
+{
+    error("asm: cannot encode: %s", l->text);
+}
+
+// シンボル表 (名前からobj.symsの添字を引くハッシュ表)
+static int *table;
+static int table_cap;
+
+static unsigned hash(char *s, int len)
+{
+    unsigned h = 2166136261u;
+    for (int i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void rehash(void)
+{
+    int cap = table_cap ? table_cap * 2 : 1024;
+    free(table);
+    table = malloc(cap * sizeof(int));
+    memset(table, -1, cap * sizeof(int));
+    table_cap = cap;
+    for (int i = 0; i < obj.nsyms; i++)
+    {
+        char *n = obj.syms[i].name;
+        unsigned h = hash(n, strlen(n)) & (cap - 1);
+        while (table[h] >= 0)
+        {
+            h = (h + 1) & (cap - 1);
+        }
+        table[h] = i;
+    }
+}
+
+static int intern(char *name, int len)
+{
+    if (obj.nsyms * 2 >= table_cap)
+    {
+        rehash();
+        obj.syms = realloc(obj.syms, table_cap / 2 * sizeof(Symbol));
+    }
+    unsigned h = hash(name, len) & (table_cap - 1);
+    while (table[h] >= 0)
+    {
+        char *n = obj.syms[table[h]].name;
+        if (strncmp(n, name, len) == 0 && n[len] == '\0')
+        {
+            return table[h];
+        }
+        h = (h + 1) & (table_cap - 1);
+    }
+    int i = obj.nsyms++;
+    Symbol *s = &obj.syms[i];
+    memset(s, 0, sizeof(Symbol));
+    s->name = get_name(name, len);
+    s->section = -1;
+    table[h] = i;
+    return i;
+}
+
+static int find_section(char *name, int len)
+{
+    for (int i = 0; i < obj.nsections; i++)
+    {
+        if (strncmp(obj.sections[i].name, name, len) == 0 && obj.sections[i].name[len] == '\0')
+        {
+            return i;
+        }
+    }
+    obj.sections = realloc(obj.sections, (obj.nsections + 1) * sizeof(Section));
+    Section *s = &obj.sections[obj.nsections];
+    memset(s, 0, sizeof(Section));
+    s->name = get_name(name, len);
+    s->type = SHT_PROGBITS;
+    s->align = 1;
+
+    // 属性が書かれていなければ名前から決める
+    if (!strncmp(s->name, ".text", 5))
+    {
+        s->flags = SHF_ALLOC | SHF_EXECINSTR;
+    }
+    else if (!strncmp(s->name, ".data", 5))
+    {
+        s->flags = SHF_ALLOC | SHF_WRITE;
+    }
+    else if (!strncmp(s->name, ".bss", 4))
+    {
+        s->flags = SHF_ALLOC | SHF_WRITE;
+        s->type = SHT_NOBITS;
+    }
+    else if (!strncmp(s->name, ".rodata", 7))
+    {
+        s->flags = SHF_ALLOC;
+    }
+    else if (!strcmp(s->name, ".init_array") || !strcmp(s->name, ".fini_array"))
+    {
+        s->flags = SHF_ALLOC | SHF_WRITE;
+        s->type = s->name[1] == 'i' ? SHT_INIT_ARRAY : SHT_FINI_ARRAY;
+    }
+    else if (!strncmp(s->name, ".note", 5))
+    {
+        s->type = SHT_NOTE;
+    }
+    return obj.nsections++;
+}
+
+static char *skip(char *p)
+{
+    while (isspace(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+// Parses "flags"[,@type[,entsize]] after the name in .section.
+static void parse_section_flags(Section *s, char *p)
+{
+    p = skip(p);
+    if (*p != '"')
+    {
+        error("asm: bad section flags: %s", p);
+    }
+    s->flags = 0;
+    for (p++; *p != '"'; p++)
+    {
+        switch (*p)
+        {
+        case 'a':
+            s->flags |= SHF_ALLOC;
+            break;
+        case 'w':
+            s->flags |= SHF_WRITE;
+            break;
+        case 'x':
+            s->flags |= SHF_EXECINSTR;
+            break;
+        case 'M':
+            s->flags |= SHF_MERGE;
+            break;
+        case 'S':
+            s->flags |= SHF_STRINGS;
+            break;
+        default:
+            error("asm: bad section flags: %s", p);
+        }
+    }
+    p = skip(p + 1);
+    if (*p != ',')
+    {
+        return;
+    }
+    p = skip(p + 1);
+    if (!strncmp(p, "@progbits", 9))
+    {
+        s->type = SHT_PROGBITS;
+    }
+    else if (!strncmp(p, "@nobits", 7))
+    {
+        s->type = SHT_NOBITS;
+    }
+    else if (!strncmp(p, "@note", 5))
+    {
+        s->type = SHT_NOTE;
+    }
+    else
+    {
+        error("asm: bad section type: %s", p);
+    }
+    while (*p == '@' || isalnum(*p))
+    {
+        p++;
+    }
+    p = skip(p);
+    if (*p == ',')
+    {
+        s->entsize = strtol(skip(p + 1), NULL, 0);
+    }
+}
+
+
+// Register number of name[0..len), or -1.
+static int find_reg(char *name, int len, int *size)
+{
+    for (int r = 0; r < 16; r++)
+    {
+        for (int w = 0; w < 4; w++)
+        {
+            if (strncmp(reg_names[r][w], name, len) == 0 && reg_names[r][w][len] == '\0')
+            {
+                *size = reg_sizes[w];
+                return r;
+            }
+        }
+    }
+    return -1;
+}
+
+static int find_xmm(char *name, int len)
+{
+    if (len < 4 || strncmp(name, "xmm", 3) != 0)
+    {
+        return -1;
+    }
+    int n = 0;
+    for (int i = 3; i < len; i++)
+    {
+        if (!isdigit(name[i]))
+        {
+            return -1;
+        }
+        n = n * 10 + name[i] - '0';
+    }
+    return n < 16 ? n : -1;
+}
+
+static bool is_number(char *p)
+{
+    return isdigit(*p) || (*p == '-' && isdigit(p[1]));
+}
+
+static void parse_memory(Line *l, char *p, Operand *op)
+{
+    op->kind = OP_MEM;
+    op->base = op->index = op->sym = -1;
+    op->scale = 1;
+    for (;;)
+    {
+        p = skip(p);
+        if (*p == ']')
+        {
+            return;
+        }
+        int sign = 1;
+        if (*p == '+' || *p == '-')
+        {
+            sign = *p++ == '-' ? -1 : 1;
+            p = skip(p);
+        }
+        if (isdigit(*p))
+        {
+            op->disp += sign * strtol(p, &p, 0);
+            continue;
+        }
+        char *q = p;
+        while (is_ident(*q))
+        {
+            q++;
+        }
+        if (q == p || sign < 0)
+        {
+            bad(l);
+        }
+        int size;
+        int r = find_reg(p, q - p, &size);
+        if (q - p == 3 && !strncmp(p, "rip", 3))
+        {
+            op->base = RIP;
+        }
+        else if (r >= 0 && *skip(q) == '*')
+        {
+            op->index = r;
+            op->scale = strtol(skip(skip(q) + 1), &q, 10);
+        }
+        else if (r >= 0 && op->base < 0)
+        {
+            op->base = r;
+        }
+        else if (r >= 0 && op->index < 0)
+        {
+            op->index = r;
+        }
+        else if (r < 0 && op->sym < 0)
+        {
+            op->sym = intern(p, q - p);
+        }
+        else
+        {
+            bad(l);
+        }
+        p = q;
+    }
+}
+
+static void parse_operand(Line *l, char *p, int len, Operand *op)
+{
+    static struct
+    {
+        char *name;
+        int size;
+    } ptrs[] = {{"BYTE PTR", 1}, {"WORD PTR", 2}, {"DWORD PTR", 4}, {"QWORD PTR", 8}, {"XMMWORD PTR", 16}, {NULL}};
+
+    memset(op, 0, sizeof(Operand));
+    op->sym = -1;
+    while (len > 0 && isspace(p[len - 1]))
+    {
+        len--;
+    }
+    for (int i = 0; ptrs[i].name; i++)
+    {
+        int n = strlen(ptrs[i].name);
+        if (len > n && strncmp(p, ptrs[i].name, n) == 0)
+        {
+            op->size = ptrs[i].size;
+            char *q = skip(p + n);
+            len -= q - p;
+            p = q;
+            break;
+        }
+    }
+    if (*p == '[')
+    {
+        int size = op->size;
+        parse_memory(l, p + 1, op);
+        op->size = size;
+        return;
+    }
+    if ((op->reg = find_reg(p, len, &op->size)) >= 0)
+    {
+        op->kind = OP_REG;
+        return;
+    }
+    if ((op->reg = find_xmm(p, len)) >= 0)
+    {
+        op->kind = OP_XMM;
+        op->size = 16;
+        return;
+    }
+    if (is_number(p))
+    {
+        op->kind = OP_IMM;
+        op->disp = strtol(p, NULL, 0);
+        return;
+    }
+    char *q = p;
+    while (is_ident(*q))
+    {
+        q++;
+    }
+    if (q == p)
+    {
+        bad(l);
+    }
+    op->kind = OP_SYM;
+    op->sym = intern(p, q - p);
+    q = skip(q);
+    if (*q == '+' || *q == '-')
+    {
+        op->disp = strtol(q, NULL, 0);
+    }
+}
+
+static bool find_cond(char *name, int *cc)
+{
+    for (int i = 0; conds[i].name; i++)
+    {
+        if (!strcmp(conds[i].name, name))
+        {
+            *cc = conds[i].cc;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Directives which define sections and symbols take effect here, so that
+// every pass knows them from the start.
+static void parse_line(Line *l, char *text)
+{
+    memset(l, 0, sizeof(Line));
+    l->text = text;
+    l->kind = D_IGNORE;
+    char *p = skip(text);
+    int len = strlen(p);
+    if (*p == '#' || len == 0)
+    {
+        return;
+    }
+    if (p[len - 1] == ':')
+    {
+        l->kind = LABEL;
+        l->sym = intern(p, len - 1);
+        Symbol *s = &obj.syms[l->sym];
+        if (s->section >= 0)
+        {
+            error("asm: %s is already defined", s->name);
+        }
+        s->section = cur;
+        return;
+    }
+
+    char name[32];
+    int n = 0;
+    while (p[n] && !isspace(p[n]) && n < (int)sizeof(name) - 12)
+    {
+        name[n] = p[n];
+        n++;
+    }
+    name[n] = '\0';
+    p = skip(p + n);
+    if (!strcmp(name, "rep"))
+    {
+        // rep movsqなどは一つの命令として扱う
+        int m = 0;
+        name[n++] = ' ';
+        while (is_ident(p[m]) && m < 8)
+        {
+            name[n++] = p[m++];
+        }
+        name[n] = '\0';
+        p = skip(p + m);
+    }
+
+    int i = 0;
+    while (mnemonics[i].name && strcmp(mnemonics[i].name, name))
+    {
+        i++;
+    }
+    if (mnemonics[i].name)
+    {
+        l->kind = mnemonics[i].kind;
+        l->opcode = mnemonics[i].opcode;
+    }
+    else if (name[0] == 'j' && find_cond(name + 1, &l->cc))
+    {
+        l->kind = I_JCC;
+    }
+    else if (!strncmp(name, "set", 3) && find_cond(name + 3, &l->cc))
+    {
+        l->kind = I_SETCC;
+    }
+    else if (name[0] == '.')
+    {
+        error("asm: unknown directive: %s", text);
+    }
+    else
+    {
+        bad(l);
+    }
+
+    if (l->kind >= D_SECTION)
+    {
+        l->args = p;
+        char *q = p;
+        while (is_ident(*q))
+        {
+            q++;
+        }
+        switch (l->kind)
+        {
+        case D_SECTION:
+            q = p;
+            while (*q && *q != ',' && !isspace(*q))
+            {
+                q++;
+            }
+            l->section = cur = find_section(p, q - p);
+            if (*skip(q) == ',')
+            {
+                parse_section_flags(&obj.sections[cur], skip(q) + 1);
+            }
+            return;
+        case D_GLOBL:
+            l->sym = intern(p, q - p);
+            obj.syms[l->sym].global = true;
+            return;
+        case D_TYPE:
+            l->sym = intern(p, q - p);
+            obj.syms[l->sym].func = strstr(q, "@function") != NULL;
+            return;
+        }
+        return;
+    }
+
+    while (*p && l->nops < 3)
+    {
+        char *comma = strchr(p, ',');
+        int len = comma ? comma - p : strlen(p);
+        parse_operand(l, p, len, &l->op[l->nops++]);
+        if (!comma)
+        {
+            break;
+        }
+        p = skip(comma + 1);
+    }
+}
+
+static void out(int b)
+{
+    if (sec->type == SHT_NOBITS)
+    {
+        error("asm: data in %s", sec->name);
+    }
+    if (sec->size == sec->cap)
+    {
+        sec->cap = sec->cap ? sec->cap * 2 : 4096;
+        sec->data = realloc(sec->data, sec->cap);
+    }
+    sec->data[sec->size++] = b;
+}
+
+// Emits the low size bytes of v, little endian.
+static void out_n(long v, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        out(v >> (i * 8) & 0xff);
+    }
+}
+
+static void fill(long n, int b)
+{
+    if (sec->type == SHT_NOBITS)
+    {
+        sec->size += n;
+        return;
+    }
+    for (long i = 0; i < n; i++)
+    {
+        out(b);
+    }
+}
+
+// Records a relocation for the bytes which are emitted next.
+static void reloc(int type, int sym, long addend)
+{
+    if (sec->nrelocs == sec->relcap)
+    {
+        sec->relcap = sec->relcap ? sec->relcap * 2 : 64;
+        sec->relocs = realloc(sec->relocs, sec->relcap * sizeof(Reloc));
+    }
+    Reloc r = {sec->size, type, sym, addend};
+    sec->relocs[sec->nrelocs++] = r;
+}
+
+// The address of a symbol in the current section. A label further down
+// still has its address from the previous pass.
+static long address(int sym)
+{
+    Symbol *s = &obj.syms[sym];
+    if (s->defined != pass)
+    {
+        s->read = pass;
+    }
+    return s->value;
+}
+
+// Whether references to sym from the current section are resolved here.
+static bool is_near(int sym)
+{
+    Symbol *s = &obj.syms[sym];
+    return s->section == cur && !s->global;
+}
+
+static bool fits8(long v)
+{
+    return v >= -128 && v <= 127;
+}
+
+static bool fits32(long v)
+{
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// spl, bpl, sil and dil need a REX prefix.
+static bool byte_rex(Operand *op)
+{
+    return op->kind == OP_REG && op->size == 1 && op->reg >= 4 && op->reg < 8;
+}
+
+static void opcode(int op)
+{
+    if (op > 0xffff)
+    {
+        out(op >> 16);
+    }
+    if (op > 0xff)
+    {
+        out(op >> 8 & 0xff);
+    }
+    out(op & 0xff);
+}
+
+// The displacement of an operand relative to rip, which is the address of
+// the next instruction: imm more bytes follow it.
+static void rip_disp(Operand *m, int imm)
+{
+    if (m->sym < 0)
+    {
+        out_n(m->disp, 4);
+        return;
+    }
+    if (is_near(m->sym))
+    {
+        long end = sec->size + 4 + imm;
+        out_n(address(m->sym) + m->disp - end, 4);
+        return;
+    }
+    reloc(R_X86_64_PC32, m->sym, m->disp - 4 - imm);
+    out_n(0, 4);
+}
+
+// Emits an instruction with a ModRM byte: the prefix (66 or f3), REX, the
+// opcode, ModRM and the rest of rm. reg is a register or an opcode
+// extension, and imm is the size of the immediate which follows.
+static void modrm(int prefix, int rex, int op, int reg, Operand *rm, int imm)
+{
+    if (reg & 8)
+    {
+        rex |= 4;
+    }
+    if (rm->kind == OP_MEM)
+    {
+        if (rm->index >= 0 && (rm->index & 8))
+        {
+            rex |= 2;
+        }
+        if (rm->base >= 0 && rm->base != RIP && (rm->base & 8))
+        {
+            rex |= 1;
+        }
+    }
+    else if (rm->reg & 8)
+    {
+        rex |= 1;
+    }
+    if (prefix)
+    {
+        out(prefix);
+    }
+    if (rex)
+    {
+        out(0x40 | rex);
+    }
+    opcode(op);
+
+    reg = (reg & 7) << 3;
+    if (rm->kind == OP_REG || rm->kind == OP_XMM)
+    {
+        out(0xc0 | reg | (rm->reg & 7));
+        return;
+    }
+    if (rm->kind != OP_MEM || rm->index == 4 || !fits32(rm->disp))
+    {
+        error("asm: bad operand");
+    }
+    if (rm->base == RIP)
+    {
+        out(0x05 | reg);
+        rip_disp(rm, imm);
+        return;
+    }
+    int ss = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+    int index = (rm->index >= 0 ? rm->index : 4) & 7;
+    if (rm->base < 0)
+    {
+        out(0x04 | reg);
+        out(ss << 6 | index << 3 | 5);
+        out_n(rm->disp, 4);
+        return;
+    }
+    // rbpとr13はdisp無しで表せず、rspとr12にはSIBが要る
+    int mod = rm->disp == 0 && (rm->base & 7) != 5 ? 0 : fits8(rm->disp) ? 1 : 2;
+    if (rm->index >= 0 || (rm->base & 7) == 4)
+    {
+        out(mod << 6 | reg | 4);
+        out(ss << 6 | index << 3 | (rm->base & 7));
+    }
+    else
+    {
+        out(mod << 6 | reg | (rm->base & 7));
+    }
+    if (mod == 1)
+    {
+        out_n(rm->disp, 1);
+    }
+    if (mod == 2)
+    {
+        out_n(rm->disp, 4);
+    }
+}
+
+// An instruction with the register in the low bits of the opcode.
+static void opreg(int prefix, int rex, int op, int reg)
+{
+    if (reg & 8)
+    {
+        rex |= 1;
+    }
+    if (prefix)
+    {
+        out(prefix);
+    }
+    if (rex)
+    {
+        out(0x40 | rex);
+    }
+    out(op + (reg & 7));
+}
+
+// The operand size of an instruction: that of its first register, or of the
+// first memory operand with PTR.
+static int operand_size(Line *l)
+{
+    for (int i = 0; i < l->nops; i++)
+    {
+        if (l->op[i].kind == OP_REG)
+        {
+            return l->op[i].size;
+        }
+    }
+    for (int i = 0; i < l->nops; i++)
+    {
+        if (l->op[i].kind == OP_MEM && l->op[i].size)
+        {
+            return l->op[i].size;
+        }
+    }
+    return 8;
+}
+
+static void mov(Line *l, int size, int pre, int rex)
+{
+    Operand *a = &l->op[0];
+    Operand *b = &l->op[1];
+    if (b->kind == OP_IMM && a->kind == OP_REG)
+    {
+        long v = b->disp;
+        if (size == 1)
+        {
+            opreg(0, rex, 0xb0, a->reg);
+            out_n(v, 1);
+        }
+        else if (size < 8 || (v >= 0 && v <= UINT32_MAX))
+        {
+            // 32ビットの書き込みは上位をゼロにするので短い形で済む
+            opreg(pre, 0, 0xb8, a->reg);
+            out_n(v, size < 8 ? size : 4);
+        }
+        else if (fits32(v))
+        {
+            modrm(0, rex, 0xc7, 0, a, 4);
+            out_n(v, 4);
+        }
+        else
+        {
+            opreg(0, rex, 0xb8, a->reg);
+            out_n(v, 8);
+        }
+        return;
+    }
+    if (b->kind == OP_IMM && a->kind == OP_MEM)
+    {
+        int n = size == 8 ? 4 : size;
+        if (!fits32(b->disp))
+        {
+            bad(l);
+        }
+        modrm(pre, rex, size == 1 ? 0xc6 : 0xc7, 0, a, n);
+        out_n(b->disp, n);
+        return;
+    }
+    if (b->kind == OP_REG && (a->kind == OP_REG || a->kind == OP_MEM))
+    {
+        modrm(pre, rex, size == 1 ? 0x88 : 0x89, b->reg, a, 0);
+        return;
+    }
+    if (a->kind == OP_REG && b->kind == OP_MEM)
+    {
+        modrm(pre, rex, size == 1 ? 0x8a : 0x8b, a->reg, b, 0);
+        return;
+    }
+    bad(l);
+}
+
+// movsx, movsxd, movzx and movzb
+static void extend(Line *l)
+{
+    Operand *a = &l->op[0];
+    Operand *b = &l->op[1];
+    if (a->kind != OP_REG || (b->kind != OP_REG && b->kind != OP_MEM))
+    {
+        bad(l);
+    }
+    int src = b->size ? b->size : l->kind == I_MOVSXD ? 4 : 1;
+    int rex = (a->size == 8 ? 8 : 0) | (byte_rex(b) ? 0x40 : 0);
+    int pre = a->size == 2 ? 0x66 : 0;
+    if (src == 4 && l->kind != I_MOVZX)
+    {
+        modrm(pre, rex, 0x63, a->reg, b, 0);
+        return;
+    }
+    if (src != 1 && src != 2)
+    {
+        bad(l);
+    }
+    int op = l->kind == I_MOVZX ? 0x0fb6 : 0x0fbe;
+    modrm(pre, rex, op + (src == 2), a->reg, b, 0);
+}
+
+// add, or, and, sub, xor and cmp, with the opcode extension ext
+static void alu(Line *l, int ext, int size, int pre, int rex)
+{
+    Operand *a = &l->op[0];
+    Operand *b = &l->op[1];
+    if (b->kind == OP_IMM)
+    {
+        long v = b->disp;
+        if (size == 1)
+        {
+            modrm(pre, rex, 0x80, ext, a, 1);
+            out_n(v, 1);
+        }
+        else if (fits8(v))
+        {
+            modrm(pre, rex, 0x83, ext, a, 1);
+            out_n(v, 1);
+        }
+        else
+        {
+            int n = size == 2 ? 2 : 4;
+            if (!fits32(v))
+            {
+                bad(l);
+            }
+            modrm(pre, rex, 0x81, ext, a, n);
+            out_n(v, n);
+        }
+        return;
+    }
+    int w = size != 1;
+    if (b->kind == OP_REG && (a->kind == OP_REG || a->kind == OP_MEM))
+    {
+        modrm(pre, rex, ext << 3 | w, b->reg, a, 0);
+    }
+    else if (a->kind == OP_REG && b->kind == OP_MEM)
+    {
+        modrm(pre, rex, ext << 3 | 2 | w, a->reg, b, 0);
+    }
+    else
+    {
+        bad(l);
+    }
+}
+
+// jmp and jcc. A jump to a label in the same section is resolved here, in
+// 2 bytes when the displacement fits.
+static void jump(Line *l)
+{
+    Operand *a = &l->op[0];
+    bool cond = l->kind == I_JCC;
+    if (!cond && (a->kind == OP_REG || a->kind == OP_MEM))
+    {
+        modrm(0, 0, 0xff, 4, a, 0);
+        return;
+    }
+    if (a->kind != OP_SYM)
+    {
+        bad(l);
+    }
+    if (!is_near(a->sym))
+    {
+        // 他の関数への末尾呼び出しなどはリンカが解決する
+        opcode(cond ? 0x0f80 + l->cc : 0xe9);
+        reloc(R_X86_64_PLT32, a->sym, a->disp - 4);
+        out_n(0, 4);
+        return;
+    }
+    Symbol *s = &obj.syms[a->sym];
+    if (!l->far)
+    {
+        long disp = 0;
+        if (s->defined)
+        {
+            disp = address(a->sym) + a->disp - (sec->size + 2);
+        }
+        else
+        {
+            // まだ一度も置かれていないラベルは近いものとしておく
+            s->read = pass;
+        }
+        if (fits8(disp))
+        {
+            out(cond ? 0x70 + l->cc : 0xeb);
+            out_n(disp, 1);
+            return;
+        }
+        l->far = true;
+    }
+    int len = cond ? 6 : 5;
+    long disp = address(a->sym) + a->disp - (sec->size + len);
+    opcode(cond ? 0x0f80 + l->cc : 0xe9);
+    out_n(disp, 4);
+}
+
+static void call(Line *l)
+{
+    Operand *a = &l->op[0];
+    if (a->kind == OP_REG || a->kind == OP_MEM)
+    {
+        modrm(0, 0, 0xff, 2, a, 0);
+        return;
+    }
+    if (a->kind != OP_SYM)
+    {
+        bad(l);
+    }
+    out(0xe8);
+    if (is_near(a->sym))
+    {
+        out_n(address(a->sym) + a->disp - (sec->size + 4), 4);
+        return;
+    }
+    reloc(R_X86_64_PLT32, a->sym, a->disp - 4);
+    out_n(0, 4);
+}
+
+static void encode(Line *l)
+{
+    Operand *a = &l->op[0];
+    Operand *b = &l->op[1];
+    Operand *c = &l->op[2];
+    int size = operand_size(l);
+    int pre = size == 2 ? 0x66 : 0;
+    int rex = size == 8 ? 8 : 0;
+    for (int i = 0; i < l->nops; i++)
+    {
+        if (byte_rex(&l->op[i]))
+        {
+            rex |= 0x40;
+        }
+    }
+    // 単項の命令の拡張オペコード
+    static const int unary[] = {[I_NOT] = 2, [I_NEG] = 3, [I_MUL] = 4, [I_DIV] = 6, [I_IDIV] = 7, [I_IMUL] = 5};
+    static const int shifts[] = {[I_SHL] = 4, [I_SHR] = 5, [I_SAR] = 7};
+    static const int alus[] = {[I_ADD] = 0, [I_OR] = 1, [I_AND] = 4, [I_SUB] = 5, [I_XOR] = 6, [I_CMP] = 7};
+
+    switch (l->kind)
+    {
+    case I_MOV:
+        mov(l, size, pre, rex);
+        return;
+    case I_MOVSX:
+    case I_MOVSXD:
+    case I_MOVZX:
+        extend(l);
+        return;
+    case I_LEA:
+        if (a->kind != OP_REG || b->kind != OP_MEM)
+        {
+            bad(l);
+        }
+        modrm(pre, rex, 0x8d, a->reg, b, 0);
+        return;
+    case I_ADD:
+    case I_OR:
+    case I_AND:
+    case I_SUB:
+    case I_XOR:
+    case I_CMP:
+        alu(l, alus[l->kind], size, pre, rex);
+        return;
+    case I_TEST:
+        if (b->kind == OP_IMM)
+        {
+            int n = size == 8 ? 4 : size;
+            modrm(pre, rex, size == 1 ? 0xf6 : 0xf7, 0, a, n);
+            out_n(b->disp, n);
+        }
+        else if (b->kind == OP_REG)
+        {
+            modrm(pre, rex, size == 1 ? 0x84 : 0x85, b->reg, a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_PUSH:
+        if (a->kind == OP_REG)
+        {
+            opreg(0, 0, 0x50, a->reg);
+        }
+        else if (a->kind == OP_IMM && fits8(a->disp))
+        {
+            out(0x6a);
+            out_n(a->disp, 1);
+        }
+        else if (a->kind == OP_IMM && fits32(a->disp))
+        {
+            out(0x68);
+            out_n(a->disp, 4);
+        }
+        else if (a->kind == OP_MEM)
+        {
+            modrm(0, 0, 0xff, 6, a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_POP:
+        if (a->kind == OP_REG)
+        {
+            opreg(0, 0, 0x58, a->reg);
+        }
+        else if (a->kind == OP_MEM)
+        {
+            modrm(0, 0, 0x8f, 0, a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_IMUL:
+        if (l->nops == 2 && a->kind == OP_REG && b->kind != OP_IMM)
+        {
+            modrm(pre, rex, 0x0faf, a->reg, b, 0);
+            return;
+        }
+        if (l->nops >= 2 && a->kind == OP_REG && l->op[l->nops - 1].kind == OP_IMM)
+        {
+            // imul a, imm は imul a, a, imm と同じ
+            Operand *src = l->nops == 3 ? b : a;
+            long imm = l->op[l->nops - 1].disp;
+            int n = fits8(imm) ? 1 : size == 2 ? 2 : 4;
+            if (!fits32(imm))
+            {
+                bad(l);
+            }
+            modrm(pre, rex, n == 1 ? 0x6b : 0x69, a->reg, src, n);
+            out_n(imm, n);
+            return;
+        }
+        // fallthrough
+    case I_NOT:
+    case I_NEG:
+    case I_MUL:
+    case I_DIV:
+    case I_IDIV:
+        if (l->nops != 1 || a->kind == OP_IMM || a->kind == OP_SYM)
+        {
+            bad(l);
+        }
+        modrm(pre, rex, size == 1 ? 0xf6 : 0xf7, unary[l->kind], a, 0);
+        return;
+    case I_INC:
+    case I_DEC:
+        modrm(pre, rex, size == 1 ? 0xfe : 0xff, l->kind == I_DEC, a, 0);
+        return;
+    case I_SHL:
+    case I_SHR:
+    case I_SAR:
+        if (b->kind == OP_IMM && b->disp == 1)
+        {
+            modrm(pre, rex, size == 1 ? 0xd0 : 0xd1, shifts[l->kind], a, 0);
+        }
+        else if (b->kind == OP_IMM)
+        {
+            modrm(pre, rex, size == 1 ? 0xc0 : 0xc1, shifts[l->kind], a, 1);
+            out_n(b->disp, 1);
+        }
+        else if (b->kind == OP_REG && b->reg == 1 && b->size == 1)
+        {
+            modrm(pre, rex, size == 1 ? 0xd2 : 0xd3, shifts[l->kind], a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_SETCC:
+        modrm(0, rex & 0x40, 0x0f90 + l->cc, 0, a, 0);
+        return;
+    case I_JCC:
+    case I_JMP:
+        jump(l);
+        return;
+    case I_CALL:
+        call(l);
+        return;
+    case I_RET:
+        out(0xc3);
+        return;
+    case I_CQO:
+        out(0x48);
+        out(0x99);
+        return;
+    case I_CDQ:
+        out(0x99);
+        return;
+    case I_CDQE:
+        out(0x48);
+        out(0x98);
+        return;
+    case I_LEAVE:
+        out(0xc9);
+        return;
+    case I_NOP:
+        out(0x90);
+        return;
+    case I_REP_MOVSB:
+        out(0xf3);
+        out(0xa4);
+        return;
+    case I_REP_MOVSQ:
+        out(0xf3);
+        out(0x48);
+        out(0xa5);
+        return;
+    case I_REP_STOSB:
+        out(0xf3);
+        out(0xaa);
+        return;
+    case I_REP_STOSQ:
+        out(0xf3);
+        out(0x48);
+        out(0xab);
+        return;
+    case I_MOVDQU:
+    case I_MOVDQA:
+        pre = l->kind == I_MOVDQU ? 0xf3 : 0x66;
+        if (a->kind == OP_XMM && (b->kind == OP_XMM || b->kind == OP_MEM))
+        {
+            modrm(pre, 0, 0x0f6f, a->reg, b, 0);
+        }
+        else if (a->kind == OP_MEM && b->kind == OP_XMM)
+        {
+            modrm(pre, 0, 0x0f7f, b->reg, a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_MOVD:
+    case I_MOVQ:
+        rex = l->kind == I_MOVQ ? 8 : 0;
+        if (a->kind == OP_XMM && (b->kind == OP_REG || (b->kind == OP_MEM && l->kind == I_MOVD)))
+        {
+            modrm(0x66, rex, 0x0f6e, a->reg, b, 0);
+        }
+        else if (b->kind == OP_XMM && (a->kind == OP_REG || (a->kind == OP_MEM && l->kind == I_MOVD)))
+        {
+            modrm(0x66, rex, 0x0f7e, b->reg, a, 0);
+        }
+        else if (l->kind == I_MOVQ && a->kind == OP_XMM && (b->kind == OP_XMM || b->kind == OP_MEM))
+        {
+            modrm(0xf3, 0, 0x0f7e, a->reg, b, 0);
+        }
+        else if (l->kind == I_MOVQ && a->kind == OP_MEM && b->kind == OP_XMM)
+        {
+            modrm(0x66, 0, 0x0fd6, b->reg, a, 0);
+        }
+        else
+        {
+            bad(l);
+        }
+        return;
+    case I_PSHUFD:
+        if (a->kind != OP_XMM || c->kind != OP_IMM)
+        {
+            bad(l);
+        }
+        modrm(0x66, 0, 0x0f70, a->reg, b, 1);
+        out_n(c->disp, 1);
+        return;
+    case I_PACKED:
+        if (a->kind != OP_XMM || (b->kind != OP_XMM && b->kind != OP_MEM))
+        {
+            bad(l);
+        }
+        modrm(0x66, 0, l->opcode, a->reg, b, 0);
+        return;
+    }
+    bad(l);
+}
+
+// An operand of a data directive: val + plus - minus, where plus and minus
+// are symbols, DOT for the current address, or -1.
+#define DOT -2
+
+typedef struct
+{
+    long val;
+    int plus;
+    int minus;
+} Expr;
+
+static char *parse_expr(Line *l, char *p, Expr *e)
+{
+    e->val = 0;
+    e->plus = e->minus = -1;
+    for (;;)
+    {
+        int sign = 1;
+        p = skip(p);
+        if (*p == '+' || *p == '-')
+        {
+            sign = *p++ == '-' ? -1 : 1;
+            p = skip(p);
+        }
+        if (isdigit(*p))
+        {
+            e->val += sign * strtol(p, &p, 0);
+        }
+        else
+        {
+            char *q = p;
+            while (is_ident(*q))
+            {
+                q++;
+            }
+            if (q == p)
+            {
+                bad(l);
+            }
+            int sym = q - p == 1 && *p == '.' ? DOT : intern(p, q - p);
+            int *slot = sign > 0 ? &e->plus : &e->minus;
+            if (*slot != -1)
+            {
+                bad(l);
+            }
+            *slot = sym;
+            p = q;
+        }
+        p = skip(p);
+        if (*p != '+' && *p != '-')
+        {
+            return p;
+        }
+    }
+}
+
+// Address of the operand of an expression in the current section.
+static long here(Line *l, int sym)
+{
+    if (sym == DOT)
+    {
+        return sec->size;
+    }
+    if (obj.syms[sym].section != cur)
+    {
+        bad(l);
+    }
+    return address(sym);
+}
+
+static void datum(Line *l, Expr e, int size)
+{
+    long val = e.val;
+    if (e.minus != -1)
+    {
+        if (e.plus == -1)
+        {
+            bad(l);
+        }
+        val -= here(l, e.minus);
+        if (e.plus == DOT || obj.syms[e.plus].section == cur)
+        {
+            // 同じセクションの中の差は定数になる
+            out_n(val + here(l, e.plus), size);
+            return;
+        }
+        // 他のセクションのシンボルとの差は位置からの相対的な再配置で表す
+        if (size != 4 && size != 8)
+        {
+            bad(l);
+        }
+        reloc(size == 4 ? R_X86_64_PC32 : R_X86_64_PC64, e.plus, val + sec->size);
+        out_n(0, size);
+        return;
+    }
+    if (e.plus == DOT)
+    {
+        bad(l);
+    }
+    if (e.plus >= 0)
+    {
+        if (size != 4 && size != 8)
+        {
+            bad(l);
+        }
+        reloc(size == 8 ? R_X86_64_64 : R_X86_64_32, e.plus, val);
+        out_n(0, size);
+        return;
+    }
+    out_n(val, size);
+}
+
+static void string(Line *l, char *p)
+{
+    if (*p++ != '"')
+    {
+        bad(l);
+    }
+    while (*p != '"')
+    {
+        if (!*p)
+        {
+            bad(l);
+        }
+        if (*p != '\\')
+        {
+            out(*p++);
+            continue;
+        }
+        p++;
+        switch (*p)
+        {
+        case 'n':
+            out('\n');
+            p++;
+            break;
+        case 't':
+            out('\t');
+            p++;
+            break;
+        case 'r':
+            out('\r');
+            p++;
+            break;
+        case 'b':
+            out('\b');
+            p++;
+            break;
+        case 'f':
+            out('\f');
+            p++;
+            break;
+        case 'x':
+        {
+            int v = 0;
+            for (p++; isxdigit(*p); p++)
+            {
+                v = v * 16 + (isdigit(*p) ? *p - '0' : tolower(*p) - 'a' + 10);
+            }
+            out(v);
+            break;
+        }
+        default:
+            if (*p >= '0' && *p <= '7')
+            {
+                int v = 0;
+                for (int i = 0; i < 3 && *p >= '0' && *p <= '7'; i++)
+                {
+                    v = v * 8 + *p++ - '0';
+                }
+                out(v);
+                break;
+            }
+            out(*p++);
+        }
+    }
+    out(0);
+}
+
+static void run_line(Line *l)
+{
+    switch (l->kind)
+    {
+    case LABEL:
+    {
+        Symbol *s = &obj.syms[l->sym];
+        if (s->read == pass && s->value != sec->size)
+        {
+            again = true;
+        }
+        s->value = sec->size;
+        s->defined = pass;
+        return;
+    }
+    case D_SECTION:
+        cur = l->section;
+        sec = &obj.sections[cur];
+        return;
+    case D_ALIGN:
+    {
+        long n = strtol(l->args, NULL, 0);
+        if (n <= 0 || (n & (n - 1)))
+        {
+            bad(l);
+        }
+        if (n > sec->align)
+        {
+            sec->align = n;
+        }
+        fill((n - sec->size % n) % n, sec->flags & SHF_EXECINSTR ? 0x90 : 0);
+        return;
+    }
+    case D_ZERO:
+        fill(strtol(l->args, NULL, 0), 0);
+        return;
+    case D_BYTE:
+    case D_LONG:
+    case D_QUAD:
+    {
+        int size = l->kind == D_BYTE ? 1 : l->kind == D_LONG ? 4 : 8;
+        char *p = l->args;
+        for (;;)
+        {
+            Expr e;
+            p = parse_expr(l, p, &e);
+            datum(l, e, size);
+            if (*p != ',')
+            {
+                return;
+            }
+            p++;
+        }
+    }
+    case D_STRING:
+        string(l, l->args);
+        return;
+    case D_SIZE:
+    {
+        // .size f, .-f
+        char *p = strchr(l->args, ',');
+        if (!p)
+        {
+            bad(l);
+        }
+        int sym = intern(l->args, p - l->args);
+        Expr e;
+        parse_expr(l, p + 1, &e);
+        if (e.plus != DOT || e.minus < 0)
+        {
+            bad(l);
+        }
+        obj.syms[sym].size = e.val + sec->size - here(l, e.minus);
+        return;
+    }
+    case D_GLOBL:
+    case D_TYPE:
+    case D_IGNORE:
+        return;
+    }
+    encode(l);
+}
+
+void assemble(Inst *head, char *path)
+{
+    int n = 0;
+    for (Inst *i = head->next; i; i = i->next)
+    {
+        n++;
+    }
+    Line *lines = calloc(n, sizeof(Line));
+    cur = find_section(".text", 5);
+    n = 0;
+    for (Inst *i = head->next; i; i = i->next)
+    {
+        parse_line(&lines[n++], i->text);
+    }
+
+    do
+    {
+        pass++;
+        again = false;
+        for (int i = 0; i < obj.nsections; i++)
+        {
+            obj.sections[i].size = 0;
+            obj.sections[i].nrelocs = 0;
+        }
+        cur = 0;
+        sec = &obj.sections[cur];
+        for (int i = 0; i < n; i++)
+        {
+            run_line(&lines[i]);
+        }
+    } while (again);
+
+    write_elf(&obj, path);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include "codegen.h"
+
+// Integrated assembler: encodes the instruction list into machine code and
+// writes it as an ELF64 relocatable object (-c).
+
+typedef struct
+{
+    long offset; // of the patched bytes in the section
+    int type;    // R_X86_64_*
+    int sym;     // index in Object.syms
+    long addend;
+} Reloc;
+
+typedef struct
+{
+    char *name;
+    unsigned type;       // SHT_*
+    unsigned long flags; // SHF_*
+    int entsize;
+    int align;
+    unsigned char *data; // NULL for SHT_NOBITS
+    long size;
+    long cap;
+    Reloc *relocs;
+    int nrelocs;
+    int relcap;
+} Section;
+
+typedef struct
+{
+    char *name;
+    int section; // index in Object.sections, or -1 if undefined
+    long value;
+    long size;
+    bool global;
+    bool func;
+    int defined; // the last pass which set value (asm.c)
+    int read;    // the last pass which used value above the definition (asm.c)
+} Symbol;
+
+typedef struct
+{
+    Section *sections;
+    int nsections;
+    Symbol *syms;
+    int nsyms;
+} Object;
+
+void assemble(Inst *head, char *path);
+void write_elf(Object *obj, char *path);
@@ -1,7 +1,81 @@
 #include <stdio.h>
 #include "codegen.h"
+#include "profile.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <limits.h>
+
+static Inst head;
+// The end of the list emit() appends to, per thread (see redirect_code())
+static _Thread_local Inst *tail;
+
+// Appends a line of assembly to the instruction list.
+void emit(char *fmt, ...)
+{
+    if (!tail)
+    {
+        tail = &head;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *text = malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(text, len + 1, fmt, ap);
+    va_end(ap);
+
+    Inst *i = calloc(1, sizeof(Inst));
+    i->text = text;
+    i->prev = tail;
+    tail->next = i;
+    tail = i;
+}
+
+// Returns the head of the instruction list. The head itself is not a line.
+Inst *code(void)
+{
+    return &head;
+}
+
+// Makes emit() on this thread append to the list after list, and returns
+// where it appended before.
+Inst *redirect_code(Inst *list)
+{
+    Inst *prev = tail ? tail : &head;
+    tail = list;
+    return prev;
+}
+
+// Moves the lines of list to the end of the instruction list.
+void append_code(Inst *list)
+{
+    if (!list->next)
+    {
+        return;
+    }
+    if (!tail)
+    {
+        tail = &head;
+    }
+    tail->next = list->next;
+    list->next->prev = tail;
+    while (tail->next)
+    {
+        tail = tail->next;
+    }
+    list->next = NULL;
+}
+
+void print_code(void)
+{
+    for (Inst *i = head.next; i; i = i->next)
+    {
+        printf("%s\n", i->text);
+    }
+}
 
 char *get_name(char *org, int len)
 {
@@ -22,81 +96,904 @@ char *str_literal_name(Node *n){
     return b;
 }
 
-// Generates the assembly code to push the address of a local variable onto the stack.
-void gen_lval_address(Node *node)
+// Labels are numbered per function, so that functions can be generated in
+// any order and on any thread: the n-th label of function i of nfuncs is
+// n * nfuncs + i. The stride is set once before the threads start.
+static _Thread_local int nlabels;
+static _Thread_local int label_func;
+static int label_stride = 1;
+
+void set_label_stride(int nfuncs)
+{
+    label_stride = nfuncs;
+}
+
+void start_labels(int func)
+{
+    nlabels = 0;
+    label_func = func;
+}
+
+int new_label(void)
+{
+    if (++nlabels > (INT_MAX - label_func) / label_stride)
+    {
+        error("too many labels");
+    }
+    return nlabels * label_stride + label_func;
+}
+
+// Address of an lvalue or the value of a pointer expression, expressed as a
+// single x86-64 memory operand: [base + index*scale + disp] or [rip + sym + disp].
+typedef struct
 {
-    if (node->kind != ND_LVAR)
-        error("代入の左辺値が変数ではありません");
+    bool frame;  // based on rbp
+    char *sym;   // rip-relative symbol
+    Node *base;  // pointer expression evaluated into rax
+    Node *index; // integer expression evaluated into rdi
+    bool index_first; // index is evaluated before base
+    int scale;
+    int disp;
+} Addr;
 
-    printf("# gen_lval\n");
-    printf("    mov rax, rbp\n");
-    printf("    sub rax, %d\n", node->offset);
-    printf("    push rax\n");
-    printf("# gen_lval end\n");
+static bool is_num(Node *node)
+{
+    return node->kind == ND_NUM;
+}
+
+static bool is_array(Node *node)
+{
+    return node->type && node->type->ty == ARRAY;
+}
+
+// Matches "idx * 1/2/4/8" so that the multiplication can be done by the
+// scaled index of the memory operand.
+static void match_index(Node *node, Node **index, int *scale)
+{
+    if (node->kind == ND_MUL)
+    {
+        Node *l = node->lhs;
+        Node *r = node->rhs;
+        if (is_num(l))
+        {
+            Node *t = l;
+            l = r;
+            r = t;
+        }
+        if (is_num(r) && (r->val == 1 || r->val == 2 || r->val == 4 || r->val == 8))
+        {
+            *index = l;
+            *scale = r->val;
+            return;
+        }
+    }
+    *index = node;
+    *scale = 1;
 }
 
-static int count(void)
+static void select_lvalue(Node *node, Addr *a);
+
+// Folds a pointer-valued expression into a.
+static void select_pointer(Node *node, Addr *a)
 {
-    static int i = 1;
-    return i++;
+    switch (node->kind)
+    {
+    case ND_ADD:
+        if (is_num(node->rhs))
+        {
+            select_pointer(node->lhs, a);
+            a->disp += node->rhs->val;
+            return;
+        }
+        if (is_num(node->lhs))
+        {
+            select_pointer(node->rhs, a);
+            a->disp += node->lhs->val;
+            return;
+        }
+        if (!a->index)
+        {
+            // 定数倍されている側をindexにする
+            Node *base = node->lhs;
+            Node *index = node->rhs;
+            if (node->lhs->kind == ND_MUL && node->rhs->kind != ND_MUL)
+            {
+                base = node->rhs;
+                index = node->lhs;
+                // 評価順は左辺から変えない
+                a->index_first = true;
+            }
+            match_index(index, &a->index, &a->scale);
+            select_pointer(base, a);
+            return;
+        }
+        break;
+    case ND_SUB:
+        if (is_num(node->rhs))
+        {
+            select_pointer(node->lhs, a);
+            a->disp -= node->rhs->val;
+            return;
+        }
+        break;
+    case ND_LVAR:
+    case ND_GVAR:
+        if (is_array(node))
+        {
+            select_lvalue(node, a);
+            return;
+        }
+        break;
+    case ND_ADDR:
+        select_lvalue(node->lhs, a);
+        return;
+    }
+    a->base = node;
 }
 
-static Type *op_result_type(Node *n1, Node *n2)
+// Folds the address of an lvalue into a.
+static void select_lvalue(Node *node, Addr *a)
 {
-    Type *t1 = n1->type;
-    Type *t2 = n2->type;
+    switch (node->kind)
+    {
+    case ND_LVAR:
+        a->frame = true;
+        a->disp -= node->offset;
+        return;
+    case ND_GVAR:
+        a->sym = get_name(node->gvarname, node->gvarname_len);
+        return;
+    case ND_DEREF:
+        select_pointer(node->lhs, a);
+        return;
+    }
+    error("Not supported on gen_address. node kind: %d", node->kind);
+}
 
-    if (!t1)
+// Pushes the values of base and index in the order they appear in the source.
+static void push_addr_regs(Addr *a)
+{
+    if (a->base && !a->index_first)
+    {
+        gen(a->base);
+    }
+    if (a->index)
     {
-        error("No type for n1");
+        gen(a->index);
     }
-    if (!t2)
+    if (a->base && a->index_first)
     {
-        error("No typ for n2");
+        gen(a->base);
     }
+}
 
-    if (t1->ty == INT)
+// Pops what push_addr_regs() pushed. The base goes to rax and the index to rdi.
+static void pop_addr_regs(Addr *a)
+{
+    if (a->base && a->index_first)
+    {
+        emit("    pop rax");
+    }
+    if (a->index)
     {
-        // INTの場合は他方の型を優先
-        return t2;
+        emit("    pop rdi");
     }
-    else if (t1->ty == PTR || t1->ty == ARRAY)
+    if (a->base && !a->index_first)
     {
-        // PTR/ARRAYの場合はINTのみ許可
-        if (t2->ty != INT)
+        emit("    pop rax");
+    }
+    else if (a->sym && a->index)
+    {
+        // rip相対ではindexを使えない
+        emit("    lea rax, [rip + %s]", a->sym);
+    }
+}
+
+static void gen_addr_regs(Addr *a)
+{
+    push_addr_regs(a);
+    pop_addr_regs(a);
+}
+
+static char *addr_operand(Addr *a)
+{
+    char *b = malloc(256);
+    int n;
+    if (a->sym && !a->index)
+    {
+        n = sprintf(b, "[rip + %s", a->sym);
+    }
+    else
+    {
+        n = sprintf(b, "[%s", a->frame ? "rbp" : "rax");
+        if (a->index)
         {
-            error("ptr and no int arithmetic");
+            n += sprintf(b + n, " + rdi*%d", a->scale);
         }
-        return t1;
     }
-    error("Unexptected type arithmetic");
+    if (a->disp > 0)
+    {
+        n += sprintf(b + n, " + %d", a->disp);
+    }
+    else if (a->disp < 0)
+    {
+        n += sprintf(b + n, " - %d", -a->disp);
+    }
+    sprintf(b + n, "]");
+    return b;
 }
 
-static Type *int_type()
+void gen_address(Node *node)
 {
-    Type *t = calloc(1, sizeof(Type));
-    t->ty = INT;
-    return t;
+    Addr a = {};
+    select_lvalue(node, &a);
+    gen_addr_regs(&a);
+    emit("    lea rax, %s", addr_operand(&a));
+    emit("    push rax");
 }
 
-void gen_address(Node *node)
+// Loads the value of an lvalue with a single mov sized by its type.
+// char and int are sign-extended to 64 bits.
+static void gen_load(Node *node)
+{
+    if (is_array(node))
+    {
+        // 配列は先頭アドレスを値とする
+        gen_address(node);
+        return;
+    }
+
+    Addr a = {};
+    select_lvalue(node, &a);
+    gen_addr_regs(&a);
+    int size = size_of(node->type);
+    if (size == 1)
+    {
+        emit("    movsx rax, BYTE PTR %s", addr_operand(&a));
+    }
+    else if (size == 4)
+    {
+        emit("    movsxd rax, DWORD PTR %s", addr_operand(&a));
+    }
+    else
+    {
+        emit("    mov rax, %s", addr_operand(&a));
+    }
+    emit("    push rax");
+}
+
+static const char *reg64[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+static const char *reg32[] = {"edi", "esi", "edx", "ecx", "r8d", "r9d"};
+static const char *reg8[] = {"dil", "sil", "dl", "cl", "r8b", "r9b"};
+
+// Stores the i-th register of reg64 with the size of type.
+static void gen_store(char *operand, Type *type, int i)
+{
+    int size = size_of(type);
+    if (size == 1)
+    {
+        emit("    mov BYTE PTR %s, %s", operand, reg8[i]);
+    }
+    else if (size == 4)
+    {
+        emit("    mov DWORD PTR %s, %s", operand, reg32[i]);
+    }
+    else
+    {
+        emit("    mov %s, %s", operand, reg64[i]);
+    }
+}
+
+bool profile_functions;
+
+static const char *hook_regs[] = {"rax", "rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+// Calls hook(&record of fn) in the runtime (prof.c) for --profile-functions.
+// The return value and the arguments in registers are kept. rsp must be a
+// multiple of 16, as it is right after "mov rbp, rsp" or "mov rsp, rbp".
+void gen_profile_hook(char *hook, char *fn)
+{
+    if (!profile_functions)
+    {
+        return;
+    }
+    for (int i = 0; i < 7; i++)
+    {
+        emit("    push %s", hook_regs[i]);
+    }
+    emit("    sub rsp, 8");
+    emit("    lea rdi, [rip + __9cc_fprof_%s]", fn);
+    emit("    call %s", hook);
+    emit("    add rsp, 8");
+    for (int i = 6; i >= 0; i--)
+    {
+        emit("    pop %s", hook_regs[i]);
+    }
+}
+
+// The records which the runtime fills in: the name of the function followed
+// by the fields of FuncProfile in prof.c.
+void emit_profile_records(void)
+{
+    if (!profile_functions)
+    {
+        return;
+    }
+    emit(".section .rodata");
+    for (int i = 0; text[i]; i++)
+    {
+        char *f = get_name(text[i]->funcname, text[i]->funcname_len);
+        emit(".Lfprof_name_%s:", f);
+        emit("    .string \"%s\"", f);
+    }
+    emit(".section .data");
+    for (int i = 0; text[i]; i++)
+    {
+        char *f = get_name(text[i]->funcname, text[i]->funcname_len);
+        emit("    .align 8");
+        emit("__9cc_fprof_%s:", f);
+        emit("    .quad .Lfprof_name_%s", f);
+        emit("    .zero 48");
+    }
+}
+
+static bool is_stmt(Node *node)
 {
     switch (node->kind)
     {
-    case ND_LVAR:
-        gen_lval_address(node);
+    case ND_RETURN:
+    case ND_IF:
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_BLOCK:
+    case ND_SWITCH:
+    case ND_CASE:
+    case ND_DEFAULT:
+    case ND_BREAK:
+    case ND_INIT:
+        return true;
+    }
+    return false;
+}
+
+// Generates a statement. The value of an expression statement is discarded so
+// that the stack is balanced after every statement.
+static void gen_stmt(Node *node)
+{
+    gen(node);
+    if (!is_stmt(node))
+    {
+        emit("    pop rax");
+    }
+}
+
+// The state of gen() is per thread (see parallel.c).
+static _Thread_local Node *current_fn;
+static _Thread_local int tail_label;
+static _Thread_local int break_label;
+
+// The value of each switch is kept in a slot below the locals, where the
+// dispatch compares it without keeping it in a register across jumps.
+static _Thread_local int switch_slot;
+
+// Evaluates the arguments of a call into the argument registers.
+static int gen_args(Node *node)
+{
+    Node *a = node->args;
+    // push args
+    int ac = 0;
+    while (a && ac < 6)
+    {
+        gen(a);
+        a = a->next;
+        ac++;
+    }
+
+    int i = 0;
+    // System V ABIでは6つのregister以上の引数を利用する場合はrspを16の倍数にする必要がある。
+    // 今はregisterのみ利用
+    while (i < ac)
+    {
+        emit("    pop %s", reg64[ac - i - 1]);
+        i++;
+    }
+    return ac;
+}
+
+// "return f(args);" as a jump. A self-recursive call stores the arguments in
+// the parameters and loops, and another function takes over our return
+// address after the frame is released.
+static void gen_tail_call(Node *node)
+{
+    gen_counter(node, 0);
+    int ac = gen_args(node);
+    char *name = get_name(node->funcname, node->funcname_len);
+    if (!strcmp(name, get_name(current_fn->funcname, current_fn->funcname_len)))
+    {
+        // レジスタの値を.Lラベルをまたいで持ち越さないように先に保存する
+        Node *fa = current_fn->args;
+        for (int i = 0; i < ac; i++, fa = fa->next)
+        {
+            char operand[32];
+            sprintf(operand, "[rbp - %d]", fa->offset);
+            gen_store(operand, fa->type, i);
+        }
+        emit("    jmp .Ltail%d", tail_label);
         return;
-    case ND_DEREF:
-        gen(node->lhs);
+    }
+    emit("    mov rsp, rbp");
+    gen_profile_hook("__9cc_prof_leave", get_name(current_fn->funcname, current_fn->funcname_len));
+    emit("    pop rbp");
+    emit("    jmp %s", name);
+}
+
+// k if v is 2^k, otherwise -1.
+static int log2_of(long v)
+{
+    if (v <= 0 || (v & (v - 1)))
+    {
+        return -1;
+    }
+    int k = 0;
+    while (v > 1)
+    {
+        v >>= 1;
+        k++;
+    }
+    return k;
+}
+
+// rax = rax * c using shifts and lea where possible.
+static void gen_mul_imm(long c)
+{
+    if (c < 0)
+    {
+        gen_mul_imm(-c);
+        emit("    neg rax");
         return;
-    case ND_GVAR:
-        printf("# gen gvar address\n");
-        printf("    lea rax, [rip + %s]\n", get_name(node->gvarname, node->gvarname_len));
-        printf("    push rax\n");
-        printf("# gen gvar address end\n");
+    }
+    if (c == 0)
+    {
+        emit("    mov rax, 0");
         return;
     }
-    error("Not supported on gen_address. node kind: %d", node->kind);
+    // c = 2^k * {1, 3, 5, 9}
+    int k = 0;
+    while (c % 2 == 0)
+    {
+        c /= 2;
+        k++;
+    }
+    if (c == 3 || c == 5 || c == 9)
+    {
+        emit("    lea rax, [rax + rax*%ld]", c - 1);
+    }
+    else if (c != 1)
+    {
+        emit("    imul rax, rax, %ld", c << k);
+        return;
+    }
+    if (k > 0)
+    {
+        emit("    shl rax, %d", k);
+    }
+}
+
+// Magic number M and shift s such that n / d == (M * n >> (64 + s)) rounded
+// toward zero, for d >= 2 (Hacker's Delight, 10-1).
+static void div_magic(long d, long *m, int *s)
+{
+    const unsigned long two63 = 1UL << 63;
+    unsigned long ad = d;
+    unsigned long anc = two63 - 1 - two63 % ad;
+    int p = 63;
+    unsigned long q1 = two63 / anc;
+    unsigned long r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad;
+    unsigned long r2 = two63 - q2 * ad;
+    unsigned long delta;
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *m = (long)(q2 + 1);
+    *s = p - 64;
+}
+
+// rax = rax / d, rounded toward zero, without idiv.
+static void gen_div_imm(long d)
+{
+    if (d < 0)
+    {
+        gen_div_imm(-d);
+        emit("    neg rax");
+        return;
+    }
+    if (d == 1)
+    {
+        return;
+    }
+    int k = log2_of(d);
+    if (k > 0)
+    {
+        // 負の数は切り捨て方向を合わせるためにd-1を足してからシフトする
+        emit("    mov rdi, rax");
+        emit("    sar rdi, 63");
+        emit("    shr rdi, %d", 64 - k);
+        emit("    add rax, rdi");
+        emit("    sar rax, %d", k);
+        return;
+    }
+
+    long m;
+    int s;
+    div_magic(d, &m, &s);
+    emit("    mov rdi, rax");
+    emit("    mov rax, %ld", m);
+    emit("    imul rdi");
+    if (m < 0)
+    {
+        emit("    add rdx, rdi");
+    }
+    if (s > 0)
+    {
+        emit("    sar rdx, %d", s);
+    }
+    // 負の数では1を足して0方向に丸める
+    emit("    sar rdi, 63");
+    emit("    sub rdx, rdi");
+    emit("    mov rax, rdx");
+}
+
+// SSE2 code for the loops made by vectorize_loops(). Subexpressions which
+// do not read array elements are the same in every iteration, so they are
+// broadcast to all lanes of xmm8 and up once before the loop.
+typedef struct
+{
+    Node *scalar[8];
+    int nscalars;
+    char suffix; // b or d: the lane size of padd/psub
+} Vector;
+
+static bool reads_element(Node *node)
+{
+    return node && (node->kind == ND_DEREF || reads_element(node->lhs) || reads_element(node->rhs));
+}
+
+static void broadcast(Vector *v, Node *node)
+{
+    if (reads_element(node) && (node->kind == ND_ADD || node->kind == ND_SUB))
+    {
+        broadcast(v, node->lhs);
+        broadcast(v, node->rhs);
+        return;
+    }
+    if (reads_element(node))
+    {
+        return;
+    }
+    if (v->nscalars == 8)
+    {
+        error("too many scalars in a vector loop");
+    }
+    int r = 8 + v->nscalars;
+    v->scalar[v->nscalars++] = node;
+    gen(node);
+    emit("    pop rax");
+    emit("    movd xmm%d, eax", r);
+    if (v->suffix == 'b')
+    {
+        emit("    punpcklbw xmm%d, xmm%d", r, r);
+        emit("    punpcklwd xmm%d, xmm%d", r, r);
+    }
+    emit("    pshufd xmm%d, xmm%d, 0", r, r);
+}
+
+// Evaluates node into xmm r and up, and returns the register holding it.
+static int gen_vector(Vector *v, Node *node, int r)
+{
+    for (int i = 0; i < v->nscalars; i++)
+    {
+        if (v->scalar[i] == node)
+        {
+            return 8 + i;
+        }
+    }
+    if (node->kind == ND_DEREF)
+    {
+        Addr a = {};
+        select_lvalue(node, &a);
+        gen_addr_regs(&a);
+        emit("    movdqu xmm%d, %s", r, addr_operand(&a));
+        return r;
+    }
+    int l = gen_vector(v, node->lhs, r);
+    if (l != r)
+    {
+        emit("    movdqa xmm%d, xmm%d", r, l);
+    }
+    int rr = gen_vector(v, node->rhs, r + 1);
+    emit("    p%s%c xmm%d, xmm%d", node->kind == ND_ADD ? "add" : "sub", v->suffix, r, rr);
+    return r;
+}
+
+static void gen_vector_loop(Node *node)
+{
+    Vector v = {};
+    v.suffix = node->lanes == 16 ? 'b' : 'd';
+    Node *stmt = node->then;
+    if (node->init)
+    {
+        gen_stmt(node->init);
+    }
+    broadcast(&v, stmt->rhs);
+
+    int c = new_label();
+    emit(".Lbegin%d:", c);
+    gen(node->cond);
+    emit("    pop rax");
+    emit("    cmp rax, 0");
+    emit("    je .Lend%d", c);
+    gen_counter(node, 0);
+    int r = gen_vector(&v, stmt->rhs, 0);
+    Addr a = {};
+    select_lvalue(stmt->lhs, &a);
+    gen_addr_regs(&a);
+    emit("    movdqu %s, xmm%d", addr_operand(&a), r);
+    gen_stmt(node->inc);
+    emit("    jmp .Lbegin%d", c);
+    emit(".Lend%d:", c);
+    gen_counter(node, 1);
+}
+
+// The bytes of a variable of type t whose first elements are vals and the
+// rest zero.
+static void gen_data(Type *t, Node *vals)
+{
+    Type *elem = t->ty == ARRAY ? t->ptr_to : t;
+    int size = size_of(elem);
+    int n = 0;
+    for (Node *v = vals; v; v = v->next, n++)
+    {
+        if (v->kind == ND_STR_LITERAL)
+        {
+            emit("    .quad %s", str_literal_name(v));
+        }
+        else if (size == 1)
+        {
+            emit("    .byte %d", (signed char)v->val);
+        }
+        else
+        {
+            emit("    .%s %d", size == 4 ? "long" : "quad", v->val);
+        }
+    }
+    if (size_of(t) > n * size)
+    {
+        emit("    .zero %d", size_of(t) - n * size);
+    }
+}
+
+// Copies the initial values of a local array from a template in .rodata.
+// Small arrays are copied with a few moves, larger ones with rep movs.
+static void gen_init(Node *node)
+{
+    int c = new_label();
+    emit(".section .rodata");
+    emit("    .align 16");
+    emit(".Linit%d:", c);
+    gen_data(node->lhs->type, node->body);
+    emit(".section .text");
+
+    int size = size_of(node->lhs->type);
+    int off = node->lhs->offset;
+    if (size > 64)
+    {
+        emit("    lea rdi, [rbp - %d]", off);
+        emit("    lea rsi, [rip + .Linit%d]", c);
+        emit("    mov ecx, %d", size % 8 ? size : size / 8);
+        emit("    rep %s", size % 8 ? "movsb" : "movsq");
+        return;
+    }
+    int i = 0;
+    for (; size - i >= 16; i += 16)
+    {
+        emit("    movdqu xmm0, XMMWORD PTR [rip + .Linit%d + %d]", c, i);
+        emit("    movdqu XMMWORD PTR [rbp - %d], xmm0", off - i);
+    }
+    static const char *ptr[] = {[1] = "BYTE", [2] = "WORD", [4] = "DWORD", [8] = "QWORD"};
+    static const char *reg[] = {[1] = "al", [2] = "ax", [4] = "eax", [8] = "rax"};
+    for (int w = 8; w > 0; w /= 2)
+    {
+        for (; size - i >= w; i += w)
+        {
+            emit("    mov %s, %s PTR [rip + .Linit%d + %d]", reg[w], ptr[w], c, i);
+            emit("    mov %s PTR [rbp - %d], %s", ptr[w], off - i, reg[w]);
+        }
+    }
+}
+
+// The deepest nesting of switch statements in a statement.
+static int switch_depth(Node *node)
+{
+    if (!node)
+    {
+        return 0;
+    }
+    int d = 0;
+    if (node->then)
+    {
+        d = switch_depth(node->then);
+    }
+    if (node->els)
+    {
+        int e = switch_depth(node->els);
+        d = e > d ? e : d;
+    }
+    for (Node *n = node->body; n; n = n->next)
+    {
+        int e = switch_depth(n);
+        d = e > d ? e : d;
+    }
+    return node->kind == ND_SWITCH ? d + 1 : d;
+}
+
+// Short lists of cases are compared one by one.
+#define MAX_CHAIN_CASES 4
+
+typedef struct
+{
+    int val;
+    int label;
+} Case;
+
+static int compare_cases(const void *a, const void *b)
+{
+    int x = ((Case *)a)->val;
+    int y = ((Case *)b)->val;
+    return x < y ? -1 : x > y;
+}
+
+static void gen_case_chain(Case *cases, int n, char *deflt)
+{
+    for (int i = 0; i < n; i++)
+    {
+        emit("    cmp QWORD PTR [rbp - %d], %d", switch_slot, cases[i].val);
+        emit("    je .Lcase%d", cases[i].label);
+    }
+    emit("    jmp %s", deflt);
+}
+
+// Binary search over the sorted cases.
+static void gen_case_tree(Case *cases, int n, char *deflt)
+{
+    if (n <= MAX_CHAIN_CASES)
+    {
+        gen_case_chain(cases, n, deflt);
+        return;
+    }
+    int mid = n / 2;
+    int c = new_label();
+    emit("    cmp QWORD PTR [rbp - %d], %d", switch_slot, cases[mid].val);
+    emit("    je .Lcase%d", cases[mid].label);
+    emit("    jg .Lright%d", c);
+    gen_case_tree(cases, mid, deflt);
+    emit(".Lright%d:", c);
+    gen_case_tree(cases + mid + 1, n - mid - 1, deflt);
+}
+
+// Jump table indexed by value - min. The entries are offsets from the table
+// so that the code stays position independent.
+static void gen_case_table(Case *cases, int n, char *deflt)
+{
+    long min = cases[0].val;
+    long range = (long)cases[n - 1].val - min + 1;
+    int c = new_label();
+    emit("    mov rax, [rbp - %d]", switch_slot);
+    emit("    sub rax, %ld", min);
+    emit("    cmp rax, %ld", range - 1);
+    emit("    ja %s", deflt);
+    // レジスタの値は分岐をまたいで持ち越さない
+    emit("    mov rax, [rbp - %d]", switch_slot);
+    emit("    sub rax, %ld", min);
+    emit("    lea rdi, [rip + .Ltable%d]", c);
+    emit("    movsxd rax, DWORD PTR [rdi + rax*4]");
+    emit("    add rax, rdi");
+    emit("    jmp rax");
+    emit(".section .rodata");
+    emit("    .align 4");
+    emit(".Ltable%d:", c);
+    for (int i = 0; i < n; i++)
+    {
+        // 値のない所はdefaultへ飛ぶ
+        for (long v = i ? cases[i - 1].val + 1L : min; v < cases[i].val; v++)
+        {
+            emit("    .long %s - .Ltable%d", deflt, c);
+        }
+        emit("    .long .Lcase%d - .Ltable%d", cases[i].label, c);
+    }
+    emit(".section .text");
+}
+
+static void gen_switch(Node *node)
+{
+    int c = new_label();
+    gen(node->cond);
+    emit("    pop rax");
+    switch_slot += 8;
+    emit("    mov [rbp - %d], rax", switch_slot);
+
+    int n = 0;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        n += m->kind == ND_CASE;
+    }
+    Case *cases = calloc(n + 1, sizeof(Case));
+    // defaultがなければswitchの後に飛ぶ
+    char deflt[32];
+    sprintf(deflt, ".Lend%d", c);
+    int i = 0;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        if (m->kind == ND_CASE || m->kind == ND_DEFAULT)
+        {
+            // ラベルの番号をノードに覚えておく
+            m->offset = new_label();
+        }
+        if (m->kind == ND_CASE)
+        {
+            cases[i].val = m->val;
+            cases[i++].label = m->offset;
+        }
+        if (m->kind == ND_DEFAULT)
+        {
+            sprintf(deflt, ".Lcase%d", m->offset);
+        }
+    }
+    qsort(cases, n, sizeof(Case), compare_cases);
+
+    if (n <= MAX_CHAIN_CASES)
+    {
+        gen_case_chain(cases, n, deflt);
+    }
+    else if ((long)cases[n - 1].val - cases[0].val < 3L * n && (long)cases[n - 1].val - cases[0].val < 65536)
+    {
+        gen_case_table(cases, n, deflt);
+    }
+    else
+    {
+        gen_case_tree(cases, n, deflt);
+    }
+
+    int outer = break_label;
+    break_label = c;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        if (m->kind == ND_CASE || m->kind == ND_DEFAULT)
+        {
+            emit(".Lcase%d:", m->offset);
+            continue;
+        }
+        gen_stmt(m);
+    }
+    break_label = outer;
+    switch_slot -= 8;
+    emit(".Lend%d:", c);
 }
 
 void gen(Node *node)
@@ -105,154 +1002,179 @@ void gen(Node *node)
     switch (node->kind)
     {
     case ND_NUM:
-        printf("    push %d\n", node->val);
+        emit("    push %d", node->val);
         return;
     case ND_LVAR:
-        gen_lval_address(node);
-        if (node->type && node->type->ty == ARRAY)
-        {
-            printf("# skip lvar value for ARRAY\n");
-            return;
-        }
-
-        printf("# lvar value\n");
-        printf("    pop rax\n");
-        printf("    mov rax, [rax]\n");
-        printf("    push rax\n");
-        printf("# lvar value end\n");
+        gen_load(node);
         return;
     case ND_GVAR_DECL:
-        printf("# gvar declare\n");
-        printf("%s:\n", get_name(node->gvarname, node->gvarname_len));
-        // lvarではintを8にしているので合わせる
-        printf("    .zero %d\n", node->type->ty == ARRAY ? 8 * (int)node->type->array_size : 8);
-        printf("# gvar declare end\n");
+        emit("# gvar declare");
+        emit("    .align %d", align_of(node->type));
+        emit("%s:", get_name(node->gvarname, node->gvarname_len));
+        gen_data(node->type, node->body);
+        emit("# gvar declare end");
+        return;
+    case ND_INIT:
+        gen_init(node);
         return;
     case ND_GVAR:
-        gen_address(node);
-        if (node->type && node->type->ty == ARRAY)
-        {
-            printf("# skip gvar value for ARRAY\n");
-            return;
-        }
-        printf("# gvar\n");
-        printf("    pop rax\n");
-        printf("    mov rax, [rax]\n");
-        printf("    push rax\n");
-        printf("# gvar end\n");
+        gen_load(node);
         return;
     case ND_STR_LITERAL:
-        printf("# str literal\n");
-        // printf("    mov rax, OFFSET FLAT:%s\n", str_literal_name(node));
-        printf("    lea rax, [rip + %s]\n", str_literal_name(node));
-        printf("    push rax\n");
-        printf("# str literal end\n");
+        emit("# str literal");
+        // emit("    mov rax, OFFSET FLAT:%s", str_literal_name(node));
+        emit("    lea rax, [rip + %s]", str_literal_name(node));
+        emit("    push rax");
+        emit("# str literal end");
         return;
     case ND_ASSIGN:
-        gen_address(node->lhs);
+    {
+        Addr a = {};
+        select_lvalue(node->lhs, &a);
+        push_addr_regs(&a);
         gen(node->rhs);
 
-        printf("# assign\n");
-        printf("    pop rdi\n");
-        printf("    pop rax\n");
-        printf("    mov [rax], rdi\n");
-        printf("    push rdi\n");
-        printf("# assign end\n");
+        emit("# assign");
+        emit("    pop rsi");
+        pop_addr_regs(&a);
+        gen_store(addr_operand(&a), node->type, 1);
+        // 代入式の値は代入後の左辺の値
+        if (size_of(node->type) == 1)
+        {
+            emit("    movsx rsi, sil");
+        }
+        else if (size_of(node->type) == 4)
+        {
+            emit("    movsxd rsi, esi");
+        }
+        emit("    push rsi");
+        emit("# assign end");
         return;
+    }
     case ND_RETURN:
+        if (node->lhs->kind == ND_FUNCALL && node->lhs->tail_call)
+        {
+            gen_tail_call(node->lhs);
+            return;
+        }
         gen(node->lhs);
-        printf("    pop rax\n");
-        printf("    mov rsp, rbp\n");
-        printf("    pop rbp\n");
-        printf("    ret\n");
+        emit("    pop rax");
+        emit("    mov rsp, rbp");
+        gen_profile_hook("__9cc_prof_leave", get_name(current_fn->funcname, current_fn->funcname_len));
+        emit("    pop rbp");
+        emit("    ret");
         return;
     case ND_IF:
-        int c = count();
+        int c = new_label();
         gen(node->cond);
-        printf("    pop rax\n");
-        printf("    cmp rax, 0\n");
-        printf("    je  .Lelse%d\n", c);
-        gen(node->then);
-        printf("    jmp  .Lend%d\n", c);
-        printf(".Lelse%d:\n", c);
+        emit("    pop rax");
+        emit("    cmp rax, 0");
+        if (!node->els && !instrument_path)
+        {
+            emit("    je  .Lend%d", c);
+            gen_stmt(node->then);
+            emit(".Lend%d:", c);
+            return;
+        }
+        // 実行回数の多い方を分岐しない側に置く
+        if (node->els && profile_count(node, 1) > profile_count(node, 0))
+        {
+            emit("    jne .Lthen%d", c);
+            gen_counter(node, 1);
+            gen_stmt(node->els);
+            emit("    jmp  .Lend%d", c);
+            emit(".Lthen%d:", c);
+            gen_counter(node, 0);
+            gen_stmt(node->then);
+            emit(".Lend%d:", c);
+            return;
+        }
+        emit("    je  .Lelse%d", c);
+        gen_counter(node, 0);
+        gen_stmt(node->then);
+        emit("    jmp  .Lend%d", c);
+        emit(".Lelse%d:", c);
+        gen_counter(node, 1);
         if (node->els)
         {
-            gen(node->els);
+            gen_stmt(node->els);
         }
-        printf(".Lend%d:\n", c);
+        emit(".Lend%d:", c);
         return;
     case ND_WHILE:
-        int cw = count();
-        printf(".Lbegin%d:\n", cw);
+        int cw = new_label();
+        emit(".Lbegin%d:", cw);
         gen(node->cond);
-        printf("    pop rax\n");
-        printf("    cmp rax, 0\n");
-        printf("    je .Lend%d\n", cw);
-        gen(node->then);
-        printf("    jmp .Lbegin%d\n", cw);
-        printf(".Lend%d:\n", cw);
+        emit("    pop rax");
+        emit("    cmp rax, 0");
+        emit("    je .Lend%d", cw);
+        gen_counter(node, 0);
+        int ow = break_label;
+        break_label = cw;
+        gen_stmt(node->then);
+        break_label = ow;
+        emit("    jmp .Lbegin%d", cw);
+        emit(".Lend%d:", cw);
+        gen_counter(node, 1);
         return;
     case ND_FOR:
-        int cf = count();
+        if (node->lanes)
+        {
+            gen_vector_loop(node);
+            return;
+        }
+        int cf = new_label();
         if (node->init)
         {
-            gen(node->init);
+            gen_stmt(node->init);
         }
-        printf(".Lbegin%d:\n", cf);
+        emit(".Lbegin%d:", cf);
         if (node->cond)
         {
             gen(node->cond);
         }
         else
         {
-            printf("    push 1\n");
+            emit("    push 1");
         }
-        printf("    pop rax\n");
-        printf("    cmp rax, 0\n");
-        printf("    je .Lend%d\n", cf);
-        gen(node->then);
+        emit("    pop rax");
+        emit("    cmp rax, 0");
+        emit("    je .Lend%d", cf);
+        gen_counter(node, 0);
+        int of = break_label;
+        break_label = cf;
+        gen_stmt(node->then);
+        break_label = of;
         if (node->inc)
         {
-            gen(node->inc);
+            gen_stmt(node->inc);
         }
-        printf("    jmp .Lbegin%d\n", cf);
-        printf(".Lend%d:\n", cf);
+        emit("    jmp .Lbegin%d", cf);
+        emit(".Lend%d:", cf);
+        gen_counter(node, 1);
+        return;
+    case ND_SWITCH:
+        gen_switch(node);
+        return;
+    case ND_BREAK:
+        emit("    jmp .Lend%d", break_label);
         return;
     case ND_BLOCK:
         Node *n = node->body;
         while (n)
         {
-            gen(n);
-            printf("    pop rax\n");
+            gen_stmt(n);
             n = n->next;
         }
         return;
     case ND_FUNCALL:
-        Node *a = node->args;
-        // push args
-        int ac = 0;
-        while (a && ac < 6)
-        {
-            gen(a);
-            a = a->next;
-            ac++;
-        }
-
-        int i = 0;
-        // System V ABIでは6つのregister以上の引数を利用する場合はrspを16の倍数にする必要がある。
-        // 今はregisterのみ利用
-        const char *r[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-        while (i < ac)
-        {
-            printf("    pop %s\n", r[ac - i - 1]);
-            i++;
-        }
-
+        gen_counter(node, 0);
+        gen_args(node);
         char *name = malloc((node->funcname_len + 1) * sizeof(char));
         strncpy(name, node->funcname, node->funcname_len);
         name[node->funcname_len] = '\0';
-        printf("    call %s\n", name);
-        printf("    push rax\n");
+        emit("    call %s", name);
+        emit("    push rax");
         return;
     case ND_FUNC:
         char *f = malloc((node->funcname_len + 1) * sizeof(char));
@@ -261,103 +1183,125 @@ void gen(Node *node)
         
         if(strcmp(f, "main") == 0)
         {
-            printf(".globl main\n");
+            emit(".globl main");
         }
-        printf("%s:\n", f);
-        printf("# prologue\n");
-        printf("    push rbp\n");
-        printf("    mov rbp, rsp\n");
-        printf("    sub rsp, 208\n");
-        printf("# prologue end\n");
+        emit("    .type %s, @function", f);
+        emit("%s:", f);
+        emit("# prologue");
+        emit("    push rbp");
+        emit("    mov rbp, rsp");
+        gen_profile_hook("__9cc_prof_enter", f);
+        emit("    sub rsp, %d", node->stack_size + align_to(8 * switch_depth(node->body), 16));
+        emit("# prologue end");
+        switch_slot = node->stack_size;
 
         Node *fa = node->args;
-        const char *fr[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
         int fi = 0;
         while (fa && fi < 6)
         {
-            gen_lval_address(fa);
-            printf("    pop rax\n");
-            printf("    mov [rax], %s\n", fr[fi]);
+            char operand[32];
+            sprintf(operand, "[rbp - %d]", fa->offset);
+            gen_store(operand, fa->type, fi);
             fa = fa->next;
             fi++;
         }
+        current_fn = node;
+        if (node->tail_call)
+        {
+            emit(".Ltail%d:", tail_label = new_label());
+        }
 
-        gen(node->body);
+        gen_stmt(node->body);
 
-        printf("# epilogue\n");
-        printf("    mov rsp, rbp\n");
-        printf("    pop rbp\n");
-        printf("    ret\n");
-        printf("# epilogue end\n");
+        emit("# epilogue");
+        emit("    mov rsp, rbp");
+        gen_profile_hook("__9cc_prof_leave", f);
+        emit("    pop rbp");
+        emit("    ret");
+        emit("# epilogue end");
+        emit("    .size %s, .-%s", f, f);
 
         return;
     case ND_ADDR:
-        gen_lval_address(node->lhs);
+        gen_address(node->lhs);
+        return;
+    case ND_COMMA:
+        gen_stmt(node->lhs);
+        gen(node->rhs);
         return;
     case ND_DEREF:
-        gen(node->lhs);
-        node->type = node->lhs->type;
-
-        printf("# deref\n");
-        printf("    pop rax\n");
-        printf("    mov rax, [rax]\n");
-        printf("    push rax\n");
-        printf("# deref\n");
+        emit("# deref");
+        gen_load(node);
+        emit("# deref end");
         return;
+    case ND_MUL:
+        if (is_num(node->rhs) || is_num(node->lhs))
+        {
+            Node *c = is_num(node->rhs) ? node->rhs : node->lhs;
+            gen(c == node->rhs ? node->lhs : node->rhs);
+            emit("    pop rax");
+            gen_mul_imm(c->val);
+            emit("    push rax");
+            return;
+        }
+        break;
+    case ND_DIV:
+        // 0と-1は実行時の例外に任せる
+        if (is_num(node->rhs) && node->rhs->val != 0 && node->rhs->val != -1)
+        {
+            gen(node->lhs);
+            emit("    pop rax");
+            gen_div_imm(node->rhs->val);
+            emit("    push rax");
+            return;
+        }
+        break;
     }
 
     gen(node->lhs);
     gen(node->rhs);
 
-    printf("    pop rdi\n");
-    printf("    pop rax\n");
+    emit("    pop rdi");
+    emit("    pop rax");
 
     switch (node->kind)
     {
     case ND_ADD:
-        printf("    add rax, rdi\n");
-        node->type = op_result_type(node->lhs, node->rhs);
+        emit("    add rax, rdi");
         break;
     case ND_SUB:
-        printf("    sub rax, rdi\n");
-        node->type = op_result_type(node->lhs, node->rhs);
+        emit("    sub rax, rdi");
         break;
     case ND_MUL:
-        printf("    imul rax, rdi\n");
-        node->type = int_type();
+        emit("    imul rax, rdi");
         break;
     case ND_DIV:
-        printf("    cqo\n");
-        printf("    idiv rdi\n");
-        node->type = int_type();
+        emit("    cqo");
+        emit("    idiv rdi");
         break;
     case ND_LESS_THAN:
-        printf("    cmp rax, rdi\n");
-        printf("    setl al\n");
-        printf("    movzb rax, al\n");
-        node->type = int_type();
+        emit("    cmp rax, rdi");
+        emit("    setl al");
+        emit("    movzb rax, al");
         break;
     case ND_EQUAL_LESS_THAN:
-        printf("    cmp rax, rdi\n");
-        printf("    setle al\n");
-        printf("    movzb rax, al\n");
-        node->type = int_type();
+        emit("    cmp rax, rdi");
+        emit("    setle al");
+        emit("    movzb rax, al");
         break;
     case ND_EQ:
-        printf("    cmp rax, rdi\n");
-        printf("    sete al\n");
-        printf("    movzb rax, al\n");
-        node->type = int_type();
+        emit("    cmp rax, rdi");
+        emit("    sete al");
+        emit("    movzb rax, al");
         break;
     case ND_NE:
-        printf("    cmp rax, rdi\n");
-        printf("    setne al\n");
-        printf("    movzb rax, al\n");
-        node->type = int_type();
+        emit("    cmp rax, rdi");
+        emit("    setne al");
+        emit("    movzb rax, al");
         break;
     }
 
-    printf("    push rax\n");
+    emit("    push rax");
 }
 
 void gen_string_literal(Node *node)
@@ -366,6 +1310,6 @@ void gen_string_literal(Node *node)
         error("Not string literal node");
     }
 
-    printf("%s:\n", str_literal_name(node));
-    printf("    .string \"%.*s\"\n", node->strliteral_len, node->strliteral);
+    emit("%s:", str_literal_name(node));
+    emit("    .string \"%.*s\"", node->strliteral_len, node->strliteral);
 }
@@ -1,4 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
 #include "9cc.h"
 
+// One line of the generated assembly: an instruction, a label, a directive
+// or a comment. The lines are kept in a list so that they can be rewritten
+// by peephole() before they are printed.
+typedef struct Inst Inst;
+struct Inst
+{
+    Inst *next;
+    Inst *prev;
+    char *text;
+};
+
+// --profile-functions: count calls and cycles of each function (see prof.c)
+extern bool profile_functions;
+
 void gen(Node *node);
-void gen_string_literal(Node *node);
\ No newline at end of file
+void gen_profile_hook(char *hook, char *fn);
+void emit_profile_records(void);
+char *get_name(char *org, int len);
+char *str_literal_name(Node *n);
+void gen_string_literal(Node *node);
+void emit(char *fmt, ...);
+Inst *code(void);
+Inst *redirect_code(Inst *list);
+void append_code(Inst *list);
+void set_label_stride(int nfuncs);
+void start_labels(int func);
+int new_label(void);
+void print_code(void);
+void peephole(Inst *head);
@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimize.h"
+
+/*
+ * Constant and copy propagation
+ *
+ * A forward dataflow analysis over the statements of a function. For every
+ * local variable it tracks whether the variable holds a known constant, a
+ * copy of another variable or an unknown value. Branches whose condition is
+ * a known constant are not followed, as in sparse conditional constant
+ * propagation, and loops are iterated until the state at the loop head is
+ * stable. Uses of variables with a known value are then rewritten and the
+ * function is folded again.
+ *
+ * A break carries the state to the end of its loop or switch, where it is
+ * merged with the other exits. Every case label of a switch is entered with
+ * the state after the controlling expression.
+ *
+ * Only scalar locals whose address is never taken are tracked (see
+ * collect_locals()), so stores through pointers and function calls cannot
+ * change them.
+ */
+
+typedef enum
+{
+    V_UNKNOWN,
+    V_CONST,
+    V_COPY,
+} ValueKind;
+
+typedef struct
+{
+    ValueKind kind;
+    int val; // V_CONST
+    int var; // V_COPY: index of the copied variable
+} Value;
+
+typedef struct
+{
+    bool reachable;
+    Value *v;
+} Env;
+
+static Locals *vars;
+
+// Index of a tracked variable referenced by node, or -1.
+static int tracked(Node *node)
+{
+    return local_index(vars, node);
+}
+
+static Env new_env(void)
+{
+    Env e = {true, calloc(vars->nvars, sizeof(Value))};
+    return e;
+}
+
+static Env unreachable(void)
+{
+    Env e = new_env();
+    e.reachable = false;
+    return e;
+}
+
+static Env copy_env(Env e)
+{
+    Env c = new_env();
+    c.reachable = e.reachable;
+    memcpy(c.v, e.v, vars->nvars * sizeof(Value));
+    return c;
+}
+
+static bool same_value(Value a, Value b)
+{
+    if (a.kind != b.kind)
+    {
+        return false;
+    }
+    return (a.kind == V_CONST && a.val == b.val) || (a.kind == V_COPY && a.var == b.var) || a.kind == V_UNKNOWN;
+}
+
+static bool same_env(Env a, Env b)
+{
+    if (a.reachable != b.reachable)
+    {
+        return false;
+    }
+    for (int i = 0; a.reachable && i < vars->nvars; i++)
+    {
+        if (!same_value(a.v[i], b.v[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Env merge(Env a, Env b)
+{
+    if (!a.reachable)
+    {
+        return copy_env(b);
+    }
+    if (!b.reachable)
+    {
+        return copy_env(a);
+    }
+    Env m = copy_env(a);
+    for (int i = 0; i < vars->nvars; i++)
+    {
+        if (!same_value(a.v[i], b.v[i]))
+        {
+            m.v[i].kind = V_UNKNOWN;
+        }
+    }
+    return m;
+}
+
+// 変数の型に合わせて値を切り詰める
+static int truncate(int val, Type *type)
+{
+    if (type->ty == CHAR)
+    {
+        return (signed char)val;
+    }
+    return val;
+}
+
+static Value unknown(void)
+{
+    Value v = {V_UNKNOWN};
+    return v;
+}
+
+static void assign_var(Env *env, int var, Value val)
+{
+    // varのコピーを持っている変数は値がわからなくなる
+    for (int i = 0; i < vars->nvars; i++)
+    {
+        if (env->v[i].kind == V_COPY && env->v[i].var == var)
+        {
+            env->v[i] = unknown();
+        }
+    }
+    if (val.kind == V_CONST && vars->type[var]->ty == PTR)
+    {
+        val = unknown();
+    }
+    if (val.kind == V_CONST)
+    {
+        val.val = truncate(val.val, vars->type[var]);
+    }
+    if (val.kind == V_COPY)
+    {
+        // 切り詰めが起きないコピーだけを追跡する
+        Type *to = vars->type[var];
+        Type *from = vars->type[val.var];
+        bool ok = val.var != var &&
+                  ((to->ty == PTR && from->ty == PTR) ||
+                   (to->ty != PTR && from->ty != PTR && size_of(from) <= size_of(to)));
+        if (!ok)
+        {
+            val = unknown();
+        }
+    }
+    env->v[var] = val;
+}
+
+static Value eval(Node *node, Env *env, bool rewrite);
+
+static void eval_lvalue(Node *node, Env *env, bool rewrite)
+{
+    if (node->kind == ND_DEREF)
+    {
+        eval(node->lhs, env, rewrite);
+    }
+}
+
+static Value eval(Node *node, Env *env, bool rewrite)
+{
+    Value v = unknown();
+    int var;
+    switch (node->kind)
+    {
+    case ND_NUM:
+        v.kind = V_CONST;
+        v.val = node->val;
+        return v;
+    case ND_LVAR:
+        var = tracked(node);
+        if (var < 0)
+        {
+            return v;
+        }
+        v = env->v[var];
+        if (v.kind == V_UNKNOWN)
+        {
+            v.kind = V_COPY;
+            v.var = var;
+        }
+        if (rewrite && env->v[var].kind == V_CONST)
+        {
+            set_num(node, env->v[var].val);
+        }
+        else if (rewrite && env->v[var].kind == V_COPY)
+        {
+            node->offset = vars->offset[v.var];
+            node->type = vars->type[v.var];
+        }
+        return v;
+    case ND_ASSIGN:
+        var = tracked(node->lhs);
+        if (var < 0)
+        {
+            eval_lvalue(node->lhs, env, rewrite);
+            eval(node->rhs, env, rewrite);
+            return v;
+        }
+        v = eval(node->rhs, env, rewrite);
+        assign_var(env, var, v);
+        // 代入式の値は左辺の値
+        if (env->v[var].kind == V_CONST)
+        {
+            return env->v[var];
+        }
+        return unknown();
+    case ND_ADDR:
+        eval_lvalue(node->lhs, env, rewrite);
+        return v;
+    case ND_DEREF:
+        eval(node->lhs, env, rewrite);
+        return v;
+    case ND_FUNCALL:
+        for (Node *a = node->args; a; a = a->next)
+        {
+            eval(a, env, rewrite);
+        }
+        return v;
+    case ND_COMMA:
+        eval(node->lhs, env, rewrite);
+        return eval(node->rhs, env, rewrite);
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_LESS_THAN:
+    case ND_EQUAL_LESS_THAN:
+    case ND_EQ:
+    case ND_NE:
+    {
+        Value l = eval(node->lhs, env, rewrite);
+        Value r = eval(node->rhs, env, rewrite);
+        bool ptr = is_pointer(node->lhs->type) || is_pointer(node->rhs->type);
+        if (l.kind == V_CONST && r.kind == V_CONST && !ptr && eval_binary(node->kind, l.val, r.val, &v.val))
+        {
+            v.kind = V_CONST;
+        }
+        return v;
+    }
+    }
+    return v;
+}
+
+static bool is_true(Value v)
+{
+    return v.kind == V_CONST && v.val != 0;
+}
+
+static bool is_false(Value v)
+{
+    return v.kind == V_CONST && v.val == 0;
+}
+
+static Env run(Node *node, Env env, bool rewrite);
+
+// The merged states at the breaks out of the innermost loop or switch
+static Env *breaks;
+
+// Evaluates a loop starting from env. cond may be NULL (for(;;)).
+static Env run_loop(Node *node, Env env, bool rewrite)
+{
+    Env *outer = breaks;
+    Env scratch = unreachable();
+    breaks = &scratch;
+
+    // ループの先頭の状態が変わらなくなるまで繰り返す
+    Env head = env;
+    for (;;)
+    {
+        Env h = copy_env(head);
+        if (node->cond && is_false(eval(node->cond, &h, false)))
+        {
+            break;
+        }
+        Env back = run(node->then, h, false);
+        if (node->inc)
+        {
+            back = run(node->inc, back, false);
+        }
+        Env next = merge(head, back);
+        if (same_env(next, head))
+        {
+            break;
+        }
+        head = next;
+    }
+
+    // 先頭の状態が決まってからのbreakだけが出口に合流する
+    Env exits = unreachable();
+    breaks = &exits;
+    Env h = copy_env(head);
+    Env exit = h;
+    if (node->cond)
+    {
+        Value c = eval(node->cond, &h, rewrite);
+        exit = copy_env(h);
+        if (is_true(c))
+        {
+            exit.reachable = false;
+        }
+        if (is_false(c))
+        {
+            breaks = outer;
+            return exit;
+        }
+    }
+    else
+    {
+        exit.reachable = false;
+    }
+    Env back = run(node->then, h, rewrite);
+    if (node->inc)
+    {
+        run(node->inc, back, rewrite);
+    }
+    breaks = outer;
+    return merge(exit, exits);
+}
+
+static Env run_switch(Node *node, Env env, bool rewrite)
+{
+    eval(node->cond, &env, rewrite);
+    Env *outer = breaks;
+    Env exits = unreachable();
+    breaks = &exits;
+
+    bool has_default = false;
+    Env cur = unreachable();
+    for (Node *n = node->body; n; n = n->next)
+    {
+        if (n->kind == ND_CASE || n->kind == ND_DEFAULT)
+        {
+            has_default |= n->kind == ND_DEFAULT;
+            cur = merge(cur, env);
+            continue;
+        }
+        cur = run(n, cur, rewrite);
+    }
+    breaks = outer;
+    Env exit = merge(cur, exits);
+    return has_default ? exit : merge(exit, env);
+}
+
+// Runs a statement and returns the state after it.
+static Env run(Node *node, Env env, bool rewrite)
+{
+    if (!env.reachable)
+    {
+        return env;
+    }
+    env = copy_env(env);
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            env = run(n, env, rewrite);
+        }
+        return env;
+    case ND_RETURN:
+        eval(node->lhs, &env, rewrite);
+        env.reachable = false;
+        return env;
+    case ND_IF:
+    {
+        Value c = eval(node->cond, &env, rewrite);
+        Env then = env;
+        Env els = copy_env(env);
+        if (is_false(c))
+        {
+            then.reachable = false;
+        }
+        if (is_true(c))
+        {
+            els.reachable = false;
+        }
+        then = run(node->then, then, rewrite);
+        if (node->els)
+        {
+            els = run(node->els, els, rewrite);
+        }
+        return merge(then, els);
+    }
+    case ND_BREAK:
+        *breaks = merge(*breaks, env);
+        env.reachable = false;
+        return env;
+    case ND_SWITCH:
+        return run_switch(node, env, rewrite);
+    case ND_WHILE:
+        return run_loop(node, env, rewrite);
+    case ND_FOR:
+        if (node->init)
+        {
+            env = run(node->init, env, rewrite);
+        }
+        return run_loop(node, env, rewrite);
+    }
+
+    eval(node, &env, rewrite);
+    return env;
+}
+
+static void propagate_func(Node *fn)
+{
+    vars = collect_locals(fn);
+
+    // 関数の入口ではどの変数の値もわからない
+    Env env = new_env();
+    run(fn->body, env, true);
+    fold(fn->body);
+}
+
+void propagate_constants(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        propagate_func(text[i]);
+    }
+}
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimize.h"
+
+/*
+ * Local value numbering
+ *
+ * Within a straight-line run of expression statements (extended by the
+ * condition of a following if and the value of a following return), an
+ * expression which is computed again while its operands are unchanged is
+ * computed once into a temporary local and reused. Expressions are compared
+ * structurally, so two expressions get the same value number when they have
+ * the same operator and operands.
+ *
+ * An assignment to a tracked local (see collect_locals()) kills the
+ * expressions reading it. Any other store and every function call may change
+ * memory, so they kill the expressions which load from memory.
+ *
+ * Only expressions which cost more than the load of the temporary are
+ * numbered. Address arithmetic that codegen folds into a memory operand is
+ * free.
+ */
+
+#define MAX_EXPRS 256
+
+typedef struct
+{
+    Node *first;
+    Node **uses;
+    int nuses;
+    bool killed;
+} Expr;
+
+static Locals *vars;
+static Expr exprs[MAX_EXPRS];
+static int nexprs;
+
+static bool is_candidate(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_LESS_THAN:
+    case ND_EQUAL_LESS_THAN:
+    case ND_EQ:
+    case ND_NE:
+    case ND_DEREF:
+        break;
+    default:
+        return false;
+    }
+    if (!node->type || node->type->ty == ARRAY || has_side_effects(node))
+    {
+        return false;
+    }
+    return expr_cost(node) >= 3;
+}
+
+static Expr *lookup(Node *node)
+{
+    for (int i = 0; i < nexprs; i++)
+    {
+        if (!exprs[i].killed && same_expr(exprs[i].first, node))
+        {
+            return &exprs[i];
+        }
+    }
+    return NULL;
+}
+
+static void add_use(Expr *e, Node *node)
+{
+    e->uses = realloc(e->uses, (e->nuses + 1) * sizeof(Node *));
+    e->uses[e->nuses++] = node;
+}
+
+// Kills the expressions reading the local at offset, or every expression
+// reading memory if offset is 0.
+static void kill(int offset)
+{
+    for (int i = 0; i < nexprs; i++)
+    {
+        Node *n = exprs[i].first;
+        if (offset ? reads_var(n, offset) : reads_memory(vars, n))
+        {
+            exprs[i].killed = true;
+        }
+    }
+}
+
+static void number(Node *node);
+
+static void number_args(Node *arg)
+{
+    for (; arg; arg = arg->next)
+    {
+        number(arg);
+    }
+}
+
+// Numbers a pointer which is used as a memory operand. The arithmetic that
+// codegen folds into the operand is not worth a temporary.
+static void number_pointer(Node *node)
+{
+    if ((node->kind == ND_ADD || node->kind == ND_SUB) && is_pointer(node->type))
+    {
+        number_pointer(node->lhs);
+        number_pointer(node->rhs);
+        return;
+    }
+    if (node->kind == ND_MUL && (is_scale(node->lhs) || is_scale(node->rhs)))
+    {
+        number(node->lhs);
+        number(node->rhs);
+        return;
+    }
+    number(node);
+}
+
+static void number_addr(Node *node)
+{
+    if (node->kind == ND_DEREF)
+    {
+        number_pointer(node->lhs);
+    }
+}
+
+// Visits node in evaluation order.
+static void number(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    Expr *e = is_candidate(node) ? lookup(node) : NULL;
+    if (e)
+    {
+        add_use(e, node);
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_ASSIGN:
+        number_addr(node->lhs);
+        number(node->rhs);
+        kill(local_index(vars, node->lhs) >= 0 ? node->lhs->offset : 0);
+        return;
+    case ND_ADDR:
+        number_addr(node->lhs);
+        return;
+    case ND_DEREF:
+        number_pointer(node->lhs);
+        break;
+    case ND_FUNCALL:
+        number_args(node->args);
+        kill(0);
+        return;
+    case ND_INIT:
+        kill(0);
+        return;
+    default:
+        number(node->lhs);
+        number(node->rhs);
+    }
+
+    if (is_candidate(node) && nexprs < MAX_EXPRS)
+    {
+        Expr *n = &exprs[nexprs++];
+        memset(n, 0, sizeof(Expr));
+        n->first = node;
+    }
+}
+
+static Node *fn;
+static int ntemps;
+
+// Introduces temporaries for the expressions computed more than once.
+static void flush(void)
+{
+    for (int i = 0; i < nexprs; i++)
+    {
+        Expr *e = &exprs[i];
+        if (e->nuses == 0 || vars->nvars + ntemps >= 256)
+        {
+            continue;
+        }
+        Node *tmp = new_temp(fn, e->first->type);
+        ntemps++;
+
+        Node *orig = calloc(1, sizeof(Node));
+        *orig = *e->first;
+        orig->next = NULL;
+        Node *assign = new_node(ND_ASSIGN, tmp, orig);
+        assign->type = tmp->type;
+        replace_node(e->first, assign);
+
+        for (int j = 0; j < e->nuses; j++)
+        {
+            replace_node(e->uses[j], tmp);
+        }
+    }
+    nexprs = 0;
+}
+
+// Numbers a statement as a continuation of the current run. The run ends
+// where control flow joins or branches.
+static void cse_stmt(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            cse_stmt(n);
+        }
+        return;
+    case ND_RETURN:
+        number(node->lhs);
+        flush();
+        return;
+    case ND_IF:
+        number(node->cond);
+        flush();
+        cse_stmt(node->then);
+        flush();
+        cse_stmt(node->els);
+        flush();
+        return;
+    case ND_FOR:
+        number(node->init);
+        // fallthrough
+    case ND_WHILE:
+        // ループの先頭は合流点
+        flush();
+        number(node->cond);
+        flush();
+        // ベクトル化したループの本体はgen()が形を見るのでそのまま残す
+        if (!node->lanes)
+        {
+            cse_stmt(node->then);
+        }
+        cse_stmt(node->inc);
+        flush();
+        return;
+    case ND_SWITCH:
+        number(node->cond);
+        flush();
+        for (Node *n = node->body; n; n = n->next)
+        {
+            cse_stmt(n);
+        }
+        flush();
+        return;
+    case ND_CASE:
+    case ND_DEFAULT:
+    case ND_BREAK:
+        flush();
+        return;
+    }
+    number(node);
+}
+
+void eliminate_common_subexpressions(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fn = text[i];
+        vars = collect_locals(fn);
+        ntemps = 0;
+        cse_stmt(fn->body);
+        flush();
+    }
+}
@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <string.h>
+#include "optimize.h"
+
+/*
+ * Dead store and unused local elimination
+ *
+ * A backward liveness analysis over the statements of a function finds
+ * assignments to tracked locals whose value is never read afterwards. Such
+ * an assignment is replaced by its right-hand side when that has side
+ * effects, and removed otherwise. Expression statements without side
+ * effects (including bare declarations) are removed as well.
+ *
+ * The variables live after a loop or switch are live at each break out of
+ * it. The labels of a switch join the variables live at them into the state
+ * at its dispatch.
+ *
+ * Afterwards the locals which are no longer referenced are dropped and the
+ * frame is laid out again.
+ */
+
+static Locals *vars;
+
+typedef struct
+{
+    bool *live;
+} Live;
+
+static Live new_live(void)
+{
+    Live l = {calloc(vars->nvars, sizeof(bool))};
+    return l;
+}
+
+static Live copy_live(Live l)
+{
+    Live c = new_live();
+    memcpy(c.live, l.live, vars->nvars * sizeof(bool));
+    return c;
+}
+
+static void join(Live *into, Live l)
+{
+    for (int i = 0; i < vars->nvars; i++)
+    {
+        into->live[i] |= l.live[i];
+    }
+}
+
+static bool same_live(Live a, Live b)
+{
+    return memcmp(a.live, b.live, vars->nvars * sizeof(bool)) == 0;
+}
+
+static Node *empty_stmt(void)
+{
+    Node *n = calloc(1, sizeof(Node));
+    n->kind = ND_BLOCK;
+    return n;
+}
+
+static void expr(Node *node, Live *live, bool mark);
+
+// Processes an expression statement. Its value is discarded, so a dead
+// assignment at the top can be dropped.
+static void stmt_expr(Node *node, Live *live, bool mark)
+{
+    int var = node->kind == ND_ASSIGN ? local_index(vars, node->lhs) : -1;
+    if (var >= 0 && !live->live[var])
+    {
+        expr(node->rhs, live, mark);
+        if (mark)
+        {
+            replace_node(node, has_side_effects(node->rhs) ? node->rhs : empty_stmt());
+        }
+        return;
+    }
+    if (!has_side_effects(node) && node->kind != ND_BLOCK)
+    {
+        expr(node, live, false);
+        if (mark)
+        {
+            replace_node(node, empty_stmt());
+        }
+        return;
+    }
+    expr(node, live, mark);
+}
+
+// 引数は前から順に評価されるので後ろから処理する
+static void args(Node *arg, Live *live, bool mark)
+{
+    if (!arg)
+    {
+        return;
+    }
+    args(arg->next, live, mark);
+    expr(arg, live, mark);
+}
+
+static void expr(Node *node, Live *live, bool mark)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    int var;
+    switch (node->kind)
+    {
+    case ND_LVAR:
+        var = local_index(vars, node);
+        if (var >= 0)
+        {
+            live->live[var] = true;
+        }
+        return;
+    case ND_ASSIGN:
+        var = local_index(vars, node->lhs);
+        if (var >= 0)
+        {
+            live->live[var] = false;
+            expr(node->rhs, live, mark);
+            return;
+        }
+        expr(node->rhs, live, mark);
+        if (node->lhs->kind == ND_DEREF)
+        {
+            expr(node->lhs->lhs, live, mark);
+        }
+        return;
+    case ND_ADDR:
+        if (node->lhs->kind == ND_DEREF)
+        {
+            expr(node->lhs->lhs, live, mark);
+        }
+        return;
+    case ND_FUNCALL:
+        args(node->args, live, mark);
+        return;
+    case ND_COMMA:
+        // 左辺の値は捨てられるので文と同じように扱う
+        expr(node->rhs, live, mark);
+        stmt_expr(node->lhs, live, mark);
+        if (mark && node->lhs->kind == ND_BLOCK && !node->lhs->body)
+        {
+            replace_node(node, node->rhs);
+        }
+        return;
+    }
+    expr(node->rhs, live, mark);
+    expr(node->lhs, live, mark);
+}
+
+static Live stmt(Node *node, Live out, bool mark);
+
+// The variables live after the innermost loop or switch
+static Live *breaks;
+
+// Live variables at the head of a loop. cond may be NULL (for(;;)).
+static Live loop(Node *node, Live out, bool mark)
+{
+    Live *outer = breaks;
+    breaks = &out;
+    Live head = copy_live(out);
+    for (;;)
+    {
+        Live l = head;
+        if (node->inc)
+        {
+            l = stmt(node->inc, l, false);
+        }
+        l = stmt(node->then, l, false);
+        join(&l, out);
+        if (node->cond)
+        {
+            expr(node->cond, &l, false);
+        }
+        join(&l, head);
+        if (same_live(l, head))
+        {
+            break;
+        }
+        head = l;
+    }
+
+    Live l = head;
+    if (node->inc)
+    {
+        l = stmt(node->inc, l, mark);
+    }
+    stmt(node->then, l, mark);
+    breaks = outer;
+    return head;
+}
+
+// The statements of a switch from node on. The variables live at each label
+// are joined into entry.
+static Live cases(Node *node, Live out, Live *entry, bool mark)
+{
+    if (!node)
+    {
+        return out;
+    }
+    Live live = cases(node->next, out, entry, mark);
+    if (node->kind == ND_CASE || node->kind == ND_DEFAULT)
+    {
+        join(entry, live);
+        return live;
+    }
+    return stmt(node, live, mark);
+}
+
+static Live switch_stmt(Node *node, Live out, bool mark)
+{
+    Live *outer = breaks;
+    breaks = &out;
+    Live entry = new_live();
+    bool has_default = false;
+    for (Node *n = node->body; n; n = n->next)
+    {
+        has_default |= n->kind == ND_DEFAULT;
+    }
+    if (!has_default)
+    {
+        join(&entry, out);
+    }
+    cases(node->body, out, &entry, mark);
+    breaks = outer;
+    expr(node->cond, &entry, mark);
+    return entry;
+}
+
+static Live block(Node *node, Live out, bool mark)
+{
+    if (!node)
+    {
+        return out;
+    }
+    return stmt(node, block(node->next, out, mark), mark);
+}
+
+// Returns the variables live before node given those live after it.
+static Live stmt(Node *node, Live out, bool mark)
+{
+    Live live = copy_live(out);
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+        return block(node->body, out, mark);
+    case ND_RETURN:
+        memset(live.live, 0, vars->nvars * sizeof(bool));
+        expr(node->lhs, &live, mark);
+        return live;
+    case ND_IF:
+    {
+        Live then = stmt(node->then, out, mark);
+        if (node->els)
+        {
+            live = stmt(node->els, out, mark);
+        }
+        join(&live, then);
+        expr(node->cond, &live, mark);
+        return live;
+    }
+    case ND_BREAK:
+        return copy_live(*breaks);
+    case ND_SWITCH:
+        return switch_stmt(node, out, mark);
+    case ND_WHILE:
+        return loop(node, out, mark);
+    case ND_FOR:
+        live = loop(node, out, mark);
+        if (node->init)
+        {
+            live = stmt(node->init, live, mark);
+        }
+        return live;
+    }
+
+    stmt_expr(node, &live, mark);
+    return live;
+}
+
+typedef struct
+{
+    int n;
+    int cap;
+    int *offset;
+    Type **type;
+} Used;
+
+static void collect_used(Node *node, void *ctx)
+{
+    Used *u = ctx;
+    if (node->kind != ND_LVAR)
+    {
+        return;
+    }
+    for (int i = 0; i < u->n; i++)
+    {
+        if (u->offset[i] == node->offset)
+        {
+            return;
+        }
+    }
+    if (u->n == u->cap)
+    {
+        u->cap = u->cap ? u->cap * 2 : 64;
+        u->offset = realloc(u->offset, u->cap * sizeof(int));
+        u->type = realloc(u->type, u->cap * sizeof(Type *));
+    }
+    u->offset[u->n] = node->offset;
+    u->type[u->n] = node->type;
+    u->n++;
+}
+
+static void move_local(Node *node, void *ctx)
+{
+    int *map = ctx;
+    if (node->kind == ND_LVAR)
+    {
+        for (int i = 0; map[i]; i += 2)
+        {
+            if (map[i] == node->offset)
+            {
+                node->offset = map[i + 1];
+                return;
+            }
+        }
+    }
+}
+
+// Lays out the locals which are still referenced, in declaration order.
+static void relayout(Node *fn)
+{
+    Used *u = calloc(1, sizeof(Used));
+    for (Node *a = fn->args; a; a = a->next)
+    {
+        collect_used(a, u);
+    }
+    visit(fn->body, collect_used, u);
+
+    // 宣言順(オフセットの昇順)に並べる
+    for (int i = 1; i < u->n; i++)
+    {
+        for (int j = i; j > 0 && u->offset[j - 1] > u->offset[j]; j--)
+        {
+            int o = u->offset[j];
+            u->offset[j] = u->offset[j - 1];
+            u->offset[j - 1] = o;
+            Type *t = u->type[j];
+            u->type[j] = u->type[j - 1];
+            u->type[j - 1] = t;
+        }
+    }
+
+    int *map = calloc(u->n * 2 + 1, sizeof(int));
+    int offset = 0;
+    for (int i = 0; i < u->n; i++)
+    {
+        offset = align_to(offset + size_of(u->type[i]), align_of(u->type[i]));
+        map[i * 2] = u->offset[i];
+        map[i * 2 + 1] = offset;
+    }
+    for (Node *a = fn->args; a; a = a->next)
+    {
+        move_local(a, map);
+    }
+    visit(fn->body, move_local, map);
+    fn->stack_size = align_to(offset, 16);
+}
+
+void eliminate_dead_stores(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        vars = collect_locals(text[i]);
+        stmt(text[i]->body, new_live(), true);
+        relayout(text[i]);
+    }
+}
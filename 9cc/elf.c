@@ -0,0 +1,272 @@
+#include <elf.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm.h"
+
+/*
+ * ELF64 relocatable object writer
+ *
+ * The file is laid out as the ELF header, the contents of the sections, the
+ * relocation sections, the symbol and string tables and last the section
+ * header table.
+ *
+ * The symbol table has a section symbol for every section, then the local
+ * symbols and then the global ones, as ELF requires. Labels starting with
+ * ".L" are left out, and relocations against them and the other local
+ * symbols refer to the section symbol with the address in the addend. In a
+ * section with SHF_MERGE the linker may move the pieces independently, so
+ * relocations against its symbols keep the symbol.
+ */
+
+typedef struct
+{
+    char *data;
+    long size;
+    long cap;
+} Buffer;
+
+static void append(Buffer *b, void *data, long size)
+{
+    while (b->size + size > b->cap)
+    {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+// Appends a NUL-terminated string and returns its offset.
+static int add_string(Buffer *b, char *s)
+{
+    int off = b->size;
+    append(b, s, strlen(s) + 1);
+    return off;
+}
+
+static bool is_temp(Symbol *s)
+{
+    return !strncmp(s->name, ".L", 2);
+}
+
+// Whether relocations against s refer to the section symbol instead.
+static bool by_section(Object *obj, Symbol *s)
+{
+    return s->section >= 0 && !s->global && !(obj->sections[s->section].flags & SHF_MERGE);
+}
+
+static void pad(FILE *out, long *pos, int align)
+{
+    while (*pos % align)
+    {
+        fputc(0, out);
+        (*pos)++;
+    }
+}
+
+void write_elf(Object *obj, char *path)
+{
+    int nsec = obj->nsections;
+
+    // 再配置から参照されるシンボルに印をつける
+    bool *used = calloc(obj->nsyms, sizeof(bool));
+    for (int i = 0; i < nsec; i++)
+    {
+        Section *s = &obj->sections[i];
+        for (int j = 0; j < s->nrelocs; j++)
+        {
+            used[s->relocs[j].sym] = true;
+        }
+    }
+
+    // シンボル表: 空, セクション, 局所, 大域の順
+    Buffer symtab = {};
+    Buffer strtab = {};
+    add_string(&strtab, "");
+    Elf64_Sym null = {};
+    append(&symtab, &null, sizeof(null));
+    for (int i = 0; i < nsec; i++)
+    {
+        Elf64_Sym sym = {};
+        sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        sym.st_shndx = i + 1;
+        append(&symtab, &sym, sizeof(sym));
+    }
+    int *index = calloc(obj->nsyms, sizeof(int));
+    int nout = nsec + 1;
+    int first_global = 0;
+    for (int bind = STB_LOCAL; bind <= STB_GLOBAL; bind++)
+    {
+        if (bind == STB_GLOBAL)
+        {
+            first_global = nout;
+        }
+        for (int i = 0; i < obj->nsyms; i++)
+        {
+            Symbol *s = &obj->syms[i];
+            if (s->section < 0 && used[i] && is_temp(s))
+            {
+                error("asm: undefined label: %s", s->name);
+            }
+            bool global = s->global || s->section < 0;
+            if (global != (bind == STB_GLOBAL) || (s->section < 0 && !used[i] && !s->global))
+            {
+                continue;
+            }
+            if (!global && is_temp(s) && !(used[i] && !by_section(obj, s)))
+            {
+                continue;
+            }
+            Elf64_Sym sym = {};
+            sym.st_name = add_string(&strtab, s->name);
+            sym.st_info = ELF64_ST_INFO(bind, s->func ? STT_FUNC : STT_NOTYPE);
+            sym.st_shndx = s->section < 0 ? SHN_UNDEF : s->section + 1;
+            sym.st_value = s->section < 0 ? 0 : s->value;
+            sym.st_size = s->size;
+            append(&symtab, &sym, sizeof(sym));
+            index[i] = nout++;
+        }
+    }
+
+    Buffer *rela = calloc(nsec, sizeof(Buffer));
+    for (int i = 0; i < nsec; i++)
+    {
+        Section *s = &obj->sections[i];
+        for (int j = 0; j < s->nrelocs; j++)
+        {
+            Reloc *r = &s->relocs[j];
+            Symbol *sym = &obj->syms[r->sym];
+            Elf64_Rela e = {};
+            e.r_offset = r->offset;
+            e.r_addend = r->addend;
+            int idx = index[r->sym];
+            if (by_section(obj, sym))
+            {
+                idx = sym->section + 1;
+                e.r_addend += sym->value;
+            }
+            e.r_info = ELF64_R_INFO(idx, r->type);
+            append(&rela[i], &e, sizeof(e));
+        }
+    }
+
+    // セクション見出し: 空, 各セクション, .rela.*, .symtab, .strtab, .shstrtab
+    Buffer shstrtab = {};
+    add_string(&shstrtab, "");
+    int nshdr = 1 + nsec;
+    for (int i = 0; i < nsec; i++)
+    {
+        nshdr += rela[i].size > 0;
+    }
+    int symtab_idx = nshdr;
+    nshdr += 3;
+    Elf64_Shdr *shdr = calloc(nshdr, sizeof(Elf64_Shdr));
+
+    FILE *out = fopen(path, "wb");
+    if (!out)
+    {
+        error("cannot open %s: %s", path, strerror(errno));
+    }
+    Elf64_Ehdr eh = {};
+    fwrite(&eh, sizeof(eh), 1, out);
+    long pos = sizeof(eh);
+
+    for (int i = 0; i < nsec; i++)
+    {
+        Section *s = &obj->sections[i];
+        Elf64_Shdr *h = &shdr[i + 1];
+        h->sh_name = add_string(&shstrtab, s->name);
+        h->sh_type = s->type;
+        h->sh_flags = s->flags;
+        h->sh_addralign = s->align;
+        h->sh_entsize = s->entsize;
+        h->sh_size = s->size;
+        pad(out, &pos, s->align);
+        h->sh_offset = pos;
+        if (s->type != SHT_NOBITS)
+        {
+            fwrite(s->data, 1, s->size, out);
+            pos += s->size;
+        }
+    }
+
+    int n = nsec + 1;
+    for (int i = 0; i < nsec; i++)
+    {
+        if (rela[i].size == 0)
+        {
+            continue;
+        }
+        char name[256];
+        snprintf(name, sizeof(name), ".rela%s", obj->sections[i].name);
+        Elf64_Shdr *h = &shdr[n++];
+        h->sh_name = add_string(&shstrtab, name);
+        h->sh_type = SHT_RELA;
+        h->sh_flags = SHF_INFO_LINK;
+        h->sh_link = symtab_idx;
+        h->sh_info = i + 1;
+        h->sh_addralign = 8;
+        h->sh_entsize = sizeof(Elf64_Rela);
+        h->sh_size = rela[i].size;
+        pad(out, &pos, 8);
+        h->sh_offset = pos;
+        fwrite(rela[i].data, 1, rela[i].size, out);
+        pos += rela[i].size;
+    }
+
+    Elf64_Shdr *h = &shdr[symtab_idx];
+    h->sh_name = add_string(&shstrtab, ".symtab");
+    h->sh_type = SHT_SYMTAB;
+    h->sh_link = symtab_idx + 1;
+    h->sh_info = first_global;
+    h->sh_addralign = 8;
+    h->sh_entsize = sizeof(Elf64_Sym);
+    h->sh_size = symtab.size;
+    pad(out, &pos, 8);
+    h->sh_offset = pos;
+    fwrite(symtab.data, 1, symtab.size, out);
+    pos += symtab.size;
+
+    h = &shdr[symtab_idx + 1];
+    h->sh_name = add_string(&shstrtab, ".strtab");
+    h->sh_type = SHT_STRTAB;
+    h->sh_addralign = 1;
+    h->sh_size = strtab.size;
+    h->sh_offset = pos;
+    fwrite(strtab.data, 1, strtab.size, out);
+    pos += strtab.size;
+
+    h = &shdr[symtab_idx + 2];
+    h->sh_name = add_string(&shstrtab, ".shstrtab");
+    h->sh_type = SHT_STRTAB;
+    h->sh_addralign = 1;
+    h->sh_size = shstrtab.size;
+    h->sh_offset = pos;
+    fwrite(shstrtab.data, 1, shstrtab.size, out);
+    pos += shstrtab.size;
+
+    pad(out, &pos, 8);
+    fwrite(shdr, sizeof(Elf64_Shdr), nshdr, out);
+
+    memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS64;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    eh.e_type = ET_REL;
+    eh.e_machine = EM_X86_64;
+    eh.e_version = EV_CURRENT;
+    eh.e_shoff = pos;
+    eh.e_ehsize = sizeof(Elf64_Ehdr);
+    eh.e_shentsize = sizeof(Elf64_Shdr);
+    eh.e_shnum = nshdr;
+    eh.e_shstrndx = symtab_idx + 2;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&eh, sizeof(eh), 1, out);
+    if (fclose(out) != 0)
+    {
+        error("%s: %s", path, strerror(errno));
+    }
+}
@@ -0,0 +1,162 @@
+#include <limits.h>
+#include "optimize.h"
+
+/*
+ * Constant folding
+ *
+ * Arithmetic and comparisons whose operands are constants are evaluated at
+ * compile time. gen() computes intermediate results in 64 bits, so a result
+ * which does not fit in int is left to run time, as are division by zero and
+ * INT_MIN / -1. This also folds the scale factors add() inserts for pointer
+ * arithmetic.
+ */
+
+// Overwrites dst with src but keeps dst in the list it belongs to.
+void replace_node(Node *dst, Node *src)
+{
+    Node *next = dst->next;
+    *dst = *src;
+    dst->next = next;
+}
+
+void set_num(Node *node, int val)
+{
+    replace_node(node, new_node_num(val));
+}
+
+// 64ビットで計算した結果が int に収まるときだけ畳み込む
+static bool fits(long v, int *val)
+{
+    if (v < INT_MIN || INT_MAX < v)
+    {
+        return false;
+    }
+    *val = v;
+    return true;
+}
+
+bool eval_binary(NodeKind kind, int a, int b, int *val)
+{
+    switch (kind)
+    {
+    case ND_ADD:
+        return fits((long)a + b, val);
+    case ND_SUB:
+        return fits((long)a - b, val);
+    case ND_MUL:
+        return fits((long)a * b, val);
+    case ND_DIV:
+        if (b == 0 || (a == INT_MIN && b == -1))
+        {
+            return false;
+        }
+        *val = a / b;
+        return true;
+    case ND_LESS_THAN:
+        *val = a < b;
+        return true;
+    case ND_EQUAL_LESS_THAN:
+        *val = a <= b;
+        return true;
+    case ND_EQ:
+        *val = a == b;
+        return true;
+    case ND_NE:
+        *val = a != b;
+        return true;
+    }
+    return false;
+}
+
+static bool is_const(Node *node, int val)
+{
+    return node->kind == ND_NUM && node->val == val;
+}
+
+void fold(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    fold(node->init);
+    fold(node->cond);
+    fold(node->lhs);
+    fold(node->rhs);
+    fold(node->then);
+    fold(node->els);
+    fold(node->inc);
+    for (Node *n = node->args; n; n = n->next)
+    {
+        fold(n);
+    }
+    for (Node *n = node->body; n; n = n->next)
+    {
+        fold(n);
+    }
+
+    Node *l = node->lhs;
+    Node *r = node->rhs;
+    switch (node->kind)
+    {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_LESS_THAN:
+    case ND_EQUAL_LESS_THAN:
+    case ND_EQ:
+    case ND_NE:
+        break;
+    default:
+        return;
+    }
+
+    // (a, x) op y => (a, x op y), c op (a, y) => (a, c op y): 評価順は変わらない
+    if (l->kind == ND_COMMA || (l->kind == ND_NUM && r->kind == ND_COMMA))
+    {
+        Node *comma = l->kind == ND_COMMA ? l : r;
+        Node *op = l->kind == ND_COMMA ? new_node(node->kind, l->rhs, r) : new_node(node->kind, l, r->rhs);
+        op->type = node->type;
+        fold(op);
+        Node *n = new_node(ND_COMMA, comma->lhs, op);
+        n->type = op->type;
+        replace_node(node, n);
+        return;
+    }
+
+    int val;
+    if (l->kind == ND_NUM && r->kind == ND_NUM && eval_binary(node->kind, l->val, r->val, &val))
+    {
+        set_num(node, val);
+        return;
+    }
+
+    // 恒等式: x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1
+    // 配列は先頭アドレスに読み替えられるので、型はxのものをそのまま使う
+    if ((node->kind == ND_ADD || node->kind == ND_SUB) && is_const(r, 0))
+    {
+        replace_node(node, l);
+    }
+    else if (node->kind == ND_ADD && is_const(l, 0))
+    {
+        replace_node(node, r);
+    }
+    else if ((node->kind == ND_MUL || node->kind == ND_DIV) && is_const(r, 1))
+    {
+        replace_node(node, l);
+    }
+    else if (node->kind == ND_MUL && is_const(l, 1))
+    {
+        replace_node(node, r);
+    }
+}
+
+void fold_constants(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fold(text[i]->body);
+    }
+}
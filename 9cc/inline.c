@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include "optimize.h"
+#include "profile.h"
+
+/*
+ * Inlining
+ *
+ * A call of a small function whose body is a single "return expr;" is
+ * replaced by a copy of expr. Each parameter is bound to its argument: a
+ * constant, or a local of the caller which nothing else can change, is
+ * substituted directly, and any other argument is evaluated into a new local
+ * of the caller first, in the original order. The result is an ND_COMMA
+ * chain, so the arguments and the body are visible to the passes which run
+ * afterwards.
+ *
+ * Calls in an inlined body are inlined again in the next round. The number
+ * of rounds bounds the expansion of recursive functions.
+ *
+ * With a profile, calls which never ran are left alone and hot calls may
+ * inline larger bodies.
+ */
+
+#define MAX_INLINE_NODES 16
+#define MAX_HOT_INLINE_NODES 64
+#define INLINE_ROUNDS 3
+
+static Node *caller;
+static Locals *vars;
+static bool changed;
+
+static void count_node(Node *node, void *ctx)
+{
+    (*(int *)ctx)++;
+}
+
+// The returned expression of an inlinable function, or NULL.
+static Node *inline_body(Node *fn, int max_nodes)
+{
+    Node *body = fn->body;
+    if (body->kind == ND_BLOCK)
+    {
+        body = body->body;
+        if (!body || body->next)
+        {
+            return NULL;
+        }
+    }
+    if (body->kind != ND_RETURN || !body->lhs->type || body->lhs->type->ty == ARRAY)
+    {
+        return NULL;
+    }
+    int n = 0;
+    visit(body->lhs, count_node, &n);
+    return n <= max_nodes ? body->lhs : NULL;
+}
+
+typedef struct
+{
+    int offset;
+    bool written;
+} ParamUse;
+
+static void find_param_write(Node *node, void *ctx)
+{
+    ParamUse *u = ctx;
+    if ((node->kind == ND_ASSIGN || node->kind == ND_ADDR) && node->lhs->kind == ND_LVAR && node->lhs->offset == u->offset)
+    {
+        u->written = true;
+    }
+}
+
+static bool same_scalar(Type *a, Type *b)
+{
+    return a->ty == b->ty && (a->ty != PTR || size_of(a->ptr_to) == size_of(b->ptr_to));
+}
+
+typedef struct
+{
+    int nparams;
+    int offset[6];
+    Node *value[6];
+} Binding;
+
+static void substitute(Node *node, void *ctx)
+{
+    Binding *b = ctx;
+    if (node->kind != ND_LVAR)
+    {
+        return;
+    }
+    for (int i = 0; i < b->nparams; i++)
+    {
+        if (node->offset == b->offset[i])
+        {
+            replace_node(node, copy_tree(b->value[i]));
+            return;
+        }
+    }
+}
+
+static Node *assign(Node *lhs, Node *rhs)
+{
+    Node *n = new_node(ND_ASSIGN, lhs, rhs);
+    n->type = lhs->type;
+    return n;
+}
+
+static void inline_call(Node *call)
+{
+    Node *callee = find_func(call->funcname, call->funcname_len);
+    if (!callee || callee == caller || is_cold(call))
+    {
+        return;
+    }
+    Node *expr = inline_body(callee, is_hot(call) ? MAX_HOT_INLINE_NODES : MAX_INLINE_NODES);
+    if (!expr)
+    {
+        return;
+    }
+
+    Node *args[6];
+    int nargs = 0;
+    bool args_have_effects = false;
+    for (Node *a = call->args; a; a = a->next)
+    {
+        if (nargs == 6)
+        {
+            return;
+        }
+        args_have_effects |= has_side_effects(a);
+        args[nargs++] = a;
+    }
+    Binding b = {};
+    for (Node *p = callee->args; p; p = p->next)
+    {
+        if (b.nparams == nargs)
+        {
+            return;
+        }
+        b.offset[b.nparams++] = p->offset;
+    }
+    if (b.nparams != nargs)
+    {
+        return;
+    }
+    for (int i = 0; i < nargs; i++)
+    {
+        args[i]->next = NULL;
+    }
+
+    Node *binds[6];
+    int nbinds = 0;
+    Node *p = callee->args;
+    for (int i = 0; i < nargs; i++, p = p->next)
+    {
+        Node *a = args[i];
+        ParamUse u = {p->offset, false};
+        visit(expr, find_param_write, &u);
+        if (!u.written && a->kind == ND_NUM && p->type->ty != PTR)
+        {
+            b.value[i] = new_node_num(p->type->ty == CHAR ? (signed char)a->val : a->val);
+            continue;
+        }
+        // 呼び出し先から書き換えられない変数はそのまま使える
+        if (!u.written && !args_have_effects && local_index(vars, a) >= 0 && same_scalar(a->type, p->type))
+        {
+            b.value[i] = a;
+            continue;
+        }
+        Node *tmp = new_temp(caller, p->type);
+        binds[nbinds++] = assign(tmp, a);
+        b.value[i] = tmp;
+    }
+
+    Node *result = copy_tree(expr);
+    visit(result, substitute, &b);
+
+    while (nbinds > 0)
+    {
+        Node *n = new_node(ND_COMMA, binds[--nbinds], result);
+        n->type = result->type;
+        result = n;
+    }
+    replace_node(call, result);
+    changed = true;
+}
+
+// Inlines calls in node after those in its operands, so a body which has
+// just been inlined is not looked at again in this round.
+static void inline_calls(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+    inline_calls(node->init);
+    inline_calls(node->cond);
+    inline_calls(node->lhs);
+    inline_calls(node->rhs);
+    inline_calls(node->then);
+    inline_calls(node->els);
+    inline_calls(node->inc);
+    for (Node *n = node->args; n; n = n->next)
+    {
+        inline_calls(n);
+    }
+    for (Node *n = node->body; n; n = n->next)
+    {
+        inline_calls(n);
+    }
+    if (node->kind == ND_FUNCALL)
+    {
+        inline_call(node);
+    }
+}
+
+void inline_functions(void)
+{
+    for (int round = 0; round < INLINE_ROUNDS; round++)
+    {
+        changed = false;
+        for (int i = 0; text[i]; i++)
+        {
+            caller = text[i];
+            vars = collect_locals(caller);
+            inline_calls(caller->body);
+        }
+        if (!changed)
+        {
+            return;
+        }
+    }
+}
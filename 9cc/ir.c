@@ -0,0 +1,1112 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ir.h"
+#include "codegen.h"
+#include "optimize.h"
+
+/*
+ * Construction of the SSA form
+ *
+ * Follows Braun et al., "Simple and Efficient Construction of Static Single
+ * Assignment Form" (2013). The current value of each tracked local is
+ * recorded per block as the AST is lowered. A read in a block which does not
+ * define the local looks it up in the predecessors, adding a phi where they
+ * meet. The predecessors of a loop header are not all known until the body
+ * is lowered, so the phis added there before the header is sealed get their
+ * operands when it is.
+ *
+ * Every branch target gets a block of its own, so there are no critical
+ * edges and the copies for phis can be placed at the end of predecessors.
+ * A switch is lowered to a chain of comparisons, each of which jumps through
+ * a block of its own to the block of its label.
+ */
+
+// Functions may be built on several threads at once (see parallel.c).
+static _Thread_local IrFunc *f;
+static _Thread_local BasicBlock *cur;
+static _Thread_local BasicBlock *last_block;
+static _Thread_local Locals *vars;
+static _Thread_local int nblocks;
+static _Thread_local BasicBlock *break_target;
+
+static BasicBlock *new_block(bool sealed)
+{
+    BasicBlock *b = calloc(1, sizeof(BasicBlock));
+    b->id = nblocks++;
+    b->sealed = sealed;
+    b->defs = calloc(vars->nvars + 1, sizeof(int));
+    b->incomplete = calloc(vars->nvars + 1, sizeof(IrInst *));
+    if (last_block)
+    {
+        last_block->next = b;
+    }
+    else
+    {
+        f->blocks = b;
+    }
+    last_block = b;
+    return b;
+}
+
+static void add_pred(BasicBlock *b, BasicBlock *pred)
+{
+    b->preds = realloc(b->preds, sizeof(BasicBlock *) * (b->npreds + 1));
+    b->preds[b->npreds++] = pred;
+}
+
+bool ir_is_terminator(IrOp op)
+{
+    return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+static IrInst *new_inst(IrOp op)
+{
+    IrInst *i = calloc(1, sizeof(IrInst));
+    i->op = op;
+    return i;
+}
+
+static void append(BasicBlock *b, IrInst *i)
+{
+    if (b->last)
+    {
+        b->last->next = i;
+    }
+    else
+    {
+        b->insts = i;
+    }
+    b->last = i;
+}
+
+// Appends an instruction to the current block. Code after a terminator is
+// unreachable and goes to a block without predecessors.
+static IrInst *add(IrOp op)
+{
+    if (cur->last && ir_is_terminator(cur->last->op))
+    {
+        cur = new_block(true);
+    }
+    IrInst *i = new_inst(op);
+    append(cur, i);
+    return i;
+}
+
+static int add_value(IrOp op, int a, int b)
+{
+    IrInst *i = add(op);
+    i->dst = ++f->nvregs;
+    i->a = a;
+    i->b = b;
+    return i->dst;
+}
+
+static int imm(long val)
+{
+    IrInst *i = add(IR_IMM);
+    i->dst = ++f->nvregs;
+    i->imm = val;
+    return i->dst;
+}
+
+static void jump(BasicBlock *target)
+{
+    IrInst *i = add(IR_JMP);
+    i->then = target;
+    add_pred(target, cur);
+}
+
+static void branch(int cond, BasicBlock *then, BasicBlock *els)
+{
+    IrInst *i = add(IR_BR);
+    i->a = cond;
+    i->then = then;
+    i->els = els;
+    add_pred(then, cur);
+    add_pred(els, cur);
+}
+
+// Reading and writing tracked locals
+
+static int read_var(int var, BasicBlock *b);
+
+static IrInst *new_phi(BasicBlock *b)
+{
+    IrInst *phi = new_inst(IR_PHI);
+    phi->dst = ++f->nvregs;
+    // phiはブロックの先頭に置く
+    phi->next = b->insts;
+    b->insts = phi;
+    if (!b->last)
+    {
+        b->last = phi;
+    }
+    return phi;
+}
+
+static void add_phi_operands(int var, IrInst *phi, BasicBlock *b)
+{
+    phi->nargs = b->npreds;
+    phi->args = calloc(b->npreds, sizeof(int));
+    for (int i = 0; i < b->npreds; i++)
+    {
+        phi->args[i] = read_var(var, b->preds[i]);
+    }
+}
+
+static int read_var(int var, BasicBlock *b)
+{
+    if (b->defs[var])
+    {
+        return b->defs[var];
+    }
+
+    int val;
+    if (!b->sealed)
+    {
+        IrInst *phi = new_phi(b);
+        b->incomplete[var] = phi;
+        val = phi->dst;
+    }
+    else if (b->npreds == 0)
+    {
+        // 初期化されていない変数は0とする
+        IrInst *i = new_inst(IR_IMM);
+        i->dst = ++f->nvregs;
+        i->next = b->insts;
+        b->insts = i;
+        if (!b->last)
+        {
+            b->last = i;
+        }
+        val = i->dst;
+    }
+    else if (b->npreds == 1)
+    {
+        val = read_var(var, b->preds[0]);
+    }
+    else
+    {
+        // 循環する参照を止めるため先にphiを定義しておく
+        IrInst *phi = new_phi(b);
+        b->defs[var] = phi->dst;
+        add_phi_operands(var, phi, b);
+        val = phi->dst;
+    }
+    b->defs[var] = val;
+    return val;
+}
+
+static void seal(BasicBlock *b)
+{
+    for (int var = 0; var < vars->nvars; var++)
+    {
+        if (b->incomplete[var])
+        {
+            add_phi_operands(var, b->incomplete[var], b);
+        }
+    }
+    b->sealed = true;
+}
+
+// Lowering of the AST
+
+static int trunc_to(int val, Type *type)
+{
+    int size = size_of(type);
+    if (size != 1 && size != 4)
+    {
+        return val;
+    }
+    int v = add_value(IR_TRUNC, val, 0);
+    cur->last->size = size;
+    return v;
+}
+
+static int load(int addr, Type *type)
+{
+    int v = add_value(IR_LOAD, addr, 0);
+    cur->last->size = size_of(type);
+    return v;
+}
+
+static void store(int addr, int val, Type *type)
+{
+    IrInst *i = add(IR_STORE);
+    i->a = addr;
+    i->b = val;
+    i->size = size_of(type);
+}
+
+static int local_addr(int offset)
+{
+    IrInst *i = add(IR_LOCAL);
+    i->dst = ++f->nvregs;
+    i->imm = offset;
+    return i->dst;
+}
+
+static int global_addr(char *name)
+{
+    IrInst *i = add(IR_GLOBAL);
+    i->dst = ++f->nvregs;
+    i->name = name;
+    return i->dst;
+}
+
+static int expr(Node *node);
+static void stmt(Node *node);
+
+// The address of an lvalue.
+static int address(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_LVAR:
+        return local_addr(node->offset);
+    case ND_GVAR:
+        return global_addr(get_name(node->gvarname, node->gvarname_len));
+    case ND_DEREF:
+        return expr(node->lhs);
+    }
+    error("IR: not an lvalue: %d", node->kind);
+    return 0;
+}
+
+static int assign(Node *node)
+{
+    int var = local_index(vars, node->lhs);
+    if (var >= 0)
+    {
+        int val = trunc_to(expr(node->rhs), node->type);
+        cur->defs[var] = val;
+        return val;
+    }
+    // 左辺のアドレスを先に評価する
+    int addr = address(node->lhs);
+    int val = expr(node->rhs);
+    store(addr, val, node->type);
+    return trunc_to(val, node->type);
+}
+
+static int call(Node *node)
+{
+    int args[6];
+    int nargs = 0;
+    for (Node *a = node->args; a && nargs < 6; a = a->next)
+    {
+        args[nargs++] = expr(a);
+    }
+    IrInst *i = add(IR_CALL);
+    i->dst = ++f->nvregs;
+    i->name = get_name(node->funcname, node->funcname_len);
+    i->nargs = nargs;
+    i->args = calloc(nargs, sizeof(int));
+    for (int k = 0; k < nargs; k++)
+    {
+        i->args[k] = args[k];
+    }
+    return i->dst;
+}
+
+static IrOp binary_op(NodeKind kind)
+{
+    switch (kind)
+    {
+    case ND_ADD:
+        return IR_ADD;
+    case ND_SUB:
+        return IR_SUB;
+    case ND_MUL:
+        return IR_MUL;
+    case ND_DIV:
+        return IR_DIV;
+    case ND_LESS_THAN:
+        return IR_LT;
+    case ND_EQUAL_LESS_THAN:
+        return IR_LE;
+    case ND_EQ:
+        return IR_EQ;
+    case ND_NE:
+        return IR_NE;
+    }
+    error("IR: unsupported node: %d", kind);
+    return IR_ADD;
+}
+
+static int expr(Node *node)
+{
+    bool array = node->type && node->type->ty == ARRAY;
+    switch (node->kind)
+    {
+    case ND_NUM:
+        return imm(node->val);
+    case ND_LVAR:
+    {
+        int var = local_index(vars, node);
+        if (var >= 0)
+        {
+            return read_var(var, cur);
+        }
+        int addr = local_addr(node->offset);
+        return array ? addr : load(addr, node->type);
+    }
+    case ND_GVAR:
+    {
+        int addr = global_addr(get_name(node->gvarname, node->gvarname_len));
+        return array ? addr : load(addr, node->type);
+    }
+    case ND_STR_LITERAL:
+        return global_addr(str_literal_name(node));
+    case ND_ADDR:
+        return address(node->lhs);
+    case ND_DEREF:
+    {
+        int addr = expr(node->lhs);
+        return array ? addr : load(addr, node->type);
+    }
+    case ND_ASSIGN:
+        return assign(node);
+    case ND_FUNCALL:
+        return call(node);
+    case ND_COMMA:
+        stmt(node->lhs);
+        return expr(node->rhs);
+    }
+    int a = expr(node->lhs);
+    int b = expr(node->rhs);
+    return add_value(binary_op(node->kind), a, b);
+}
+
+static void loop(Node *node)
+{
+    if (node->lanes)
+    {
+        error("IR: vectorized loops are not supported");
+    }
+    // ヘッダの前任者は本体を下ろし終えるまで揃わない
+    BasicBlock *header = new_block(false);
+    BasicBlock *body = new_block(false);
+    BasicBlock *exit = new_block(false);
+    jump(header);
+    cur = header;
+    if (node->cond && has_break(node->then))
+    {
+        // breakと合流するので条件分岐の辺を分ける
+        BasicBlock *leave = new_block(true);
+        branch(expr(node->cond), body, leave);
+        cur = leave;
+        jump(exit);
+    }
+    else if (node->cond)
+    {
+        branch(expr(node->cond), body, exit);
+    }
+    else
+    {
+        jump(body);
+    }
+    seal(body);
+
+    // breakも出口の前任者になる
+    BasicBlock *outer = break_target;
+    break_target = exit;
+    cur = body;
+    stmt(node->then);
+    stmt(node->inc);
+    jump(header);
+    seal(header);
+    seal(exit);
+    break_target = outer;
+    cur = exit;
+}
+
+static void switch_stmt(Node *node)
+{
+    int val = expr(node->cond);
+    int n = 0;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        n += m->kind == ND_CASE || m->kind == ND_DEFAULT;
+    }
+    BasicBlock **labels = calloc(n + 1, sizeof(BasicBlock *));
+    BasicBlock *exit = new_block(false);
+    BasicBlock *deflt = exit;
+    int i = 0;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        if (m->kind != ND_CASE && m->kind != ND_DEFAULT)
+        {
+            continue;
+        }
+        labels[i] = new_block(false);
+        if (m->kind == ND_DEFAULT)
+        {
+            deflt = labels[i];
+        }
+        else
+        {
+            BasicBlock *hit = new_block(true);
+            BasicBlock *next = new_block(false);
+            branch(add_value(IR_EQ, val, imm(m->val)), hit, next);
+            seal(next);
+            cur = hit;
+            jump(labels[i]);
+            cur = next;
+        }
+        i++;
+    }
+    jump(deflt);
+
+    BasicBlock *outer = break_target;
+    break_target = exit;
+    i = 0;
+    for (Node *m = node->body; m; m = m->next)
+    {
+        if (m->kind != ND_CASE && m->kind != ND_DEFAULT)
+        {
+            stmt(m);
+            continue;
+        }
+        // 前のラベルからの流れ込み
+        jump(labels[i]);
+        seal(labels[i]);
+        cur = labels[i++];
+    }
+    jump(exit);
+    seal(exit);
+    break_target = outer;
+    cur = exit;
+}
+
+static void stmt(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            stmt(n);
+        }
+        return;
+    case ND_RETURN:
+    {
+        int val = expr(node->lhs);
+        add(IR_RET)->a = val;
+        return;
+    }
+    case ND_IF:
+    {
+        int cond = expr(node->cond);
+        BasicBlock *then = new_block(false);
+        BasicBlock *els = new_block(false);
+        BasicBlock *join = new_block(false);
+        branch(cond, then, els);
+        seal(then);
+        seal(els);
+        cur = then;
+        stmt(node->then);
+        jump(join);
+        cur = els;
+        stmt(node->els);
+        jump(join);
+        seal(join);
+        cur = join;
+        return;
+    }
+    case ND_SWITCH:
+        switch_stmt(node);
+        return;
+    case ND_BREAK:
+        jump(break_target);
+        return;
+    case ND_INIT:
+    {
+        // 要素ごとの代入に下ろす
+        Type *elem = node->lhs->type->ptr_to;
+        Node *v = node->body;
+        for (int i = 0; i < node->lhs->type->array_size; i++)
+        {
+            int addr = local_addr(node->lhs->offset - i * size_of(elem));
+            store(addr, imm(v ? v->val : 0), elem);
+            v = v ? v->next : NULL;
+        }
+        return;
+    }
+    case ND_WHILE:
+        loop(node);
+        return;
+    case ND_FOR:
+        stmt(node->init);
+        loop(node);
+        return;
+    }
+    expr(node);
+}
+
+// Clean-up after construction
+
+static BasicBlock **successors(BasicBlock *b, int *n)
+{
+    static _Thread_local BasicBlock *succ[2];
+    *n = 0;
+    if (b->last && (b->last->op == IR_JMP || b->last->op == IR_BR))
+    {
+        succ[(*n)++] = b->last->then;
+    }
+    if (b->last && b->last->op == IR_BR)
+    {
+        succ[(*n)++] = b->last->els;
+    }
+    return succ;
+}
+
+static void mark_reachable(BasicBlock *b)
+{
+    if (b->order)
+    {
+        return;
+    }
+    b->order = 1;
+    int n;
+    BasicBlock **succ = successors(b, &n);
+    BasicBlock *s[2] = {n > 0 ? succ[0] : NULL, n > 1 ? succ[1] : NULL};
+    for (int i = 0; i < n; i++)
+    {
+        mark_reachable(s[i]);
+    }
+}
+
+// Drops unreachable blocks and the phi operands which come from them.
+static void remove_unreachable_blocks(void)
+{
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        b->order = 0;
+    }
+    mark_reachable(f->blocks);
+
+    BasicBlock head = {};
+    BasicBlock *tail = &head;
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        if (!b->order)
+        {
+            continue;
+        }
+        tail = tail->next = b;
+        int n = 0;
+        for (int i = 0; i < b->npreds; i++)
+        {
+            if (!b->preds[i]->order)
+            {
+                continue;
+            }
+            for (IrInst *phi = b->insts; phi && phi->op == IR_PHI; phi = phi->next)
+            {
+                phi->args[n] = phi->args[i];
+            }
+            b->preds[n++] = b->preds[i];
+        }
+        b->npreds = n;
+        for (IrInst *phi = b->insts; phi && phi->op == IR_PHI; phi = phi->next)
+        {
+            phi->nargs = n;
+        }
+    }
+    tail->next = NULL;
+    f->blocks = head.next;
+}
+
+static int resolve(int *alias, int v)
+{
+    while (alias[v])
+    {
+        v = alias[v];
+    }
+    return v;
+}
+
+// Removes phis whose operands are all the same value or the phi itself.
+static void remove_trivial_phis(void)
+{
+    int *alias = calloc(f->nvregs + 1, sizeof(int));
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (BasicBlock *b = f->blocks; b; b = b->next)
+        {
+            IrInst head = {};
+            head.next = b->insts;
+            for (IrInst *prev = &head; prev->next;)
+            {
+                IrInst *phi = prev->next;
+                if (phi->op != IR_PHI)
+                {
+                    break;
+                }
+                int same = 0;
+                bool trivial = true;
+                for (int i = 0; i < phi->nargs; i++)
+                {
+                    int v = resolve(alias, phi->args[i]);
+                    if (v == phi->dst || v == same)
+                    {
+                        continue;
+                    }
+                    if (same)
+                    {
+                        trivial = false;
+                        break;
+                    }
+                    same = v;
+                }
+                if (!trivial || !same)
+                {
+                    prev = phi;
+                    continue;
+                }
+                alias[phi->dst] = same;
+                prev->next = phi->next;
+                changed = true;
+            }
+            b->insts = head.next;
+            if (!b->insts)
+            {
+                b->last = NULL;
+            }
+        }
+    }
+
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        for (IrInst *i = b->insts; i; i = i->next)
+        {
+            i->a = resolve(alias, i->a);
+            i->b = resolve(alias, i->b);
+            for (int k = 0; k < i->nargs; k++)
+            {
+                i->args[k] = resolve(alias, i->args[k]);
+            }
+        }
+    }
+}
+
+IrFunc *build_ir(Node *fn)
+{
+    f = calloc(1, sizeof(IrFunc));
+    f->name = get_name(fn->funcname, fn->funcname_len);
+    f->node = fn;
+    vars = collect_locals(fn);
+    last_block = NULL;
+    nblocks = 0;
+    cur = new_block(true);
+
+    for (Node *p = fn->args; p && f->nparams < 6; p = p->next)
+    {
+        IrInst *i = add(IR_PARAM);
+        i->dst = ++f->nvregs;
+        i->imm = f->nparams++;
+        int var = local_index(vars, p);
+        if (var >= 0)
+        {
+            cur->defs[var] = trunc_to(i->dst, p->type);
+        }
+        else
+        {
+            store(local_addr(p->offset), i->dst, p->type);
+        }
+    }
+
+    stmt(fn->body);
+    if (!cur->last || !ir_is_terminator(cur->last->op))
+    {
+        int zero = imm(0);
+        add(IR_RET)->a = zero;
+    }
+
+    remove_unreachable_blocks();
+    remove_trivial_phis();
+    return f;
+}
+
+// Printing
+
+static char *op_name[] = {
+    [IR_IMM] = "imm",
+    [IR_PARAM] = "param",
+    [IR_LOCAL] = "local",
+    [IR_GLOBAL] = "global",
+    [IR_LOAD] = "load",
+    [IR_STORE] = "store",
+    [IR_TRUNC] = "trunc",
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "mul",
+    [IR_DIV] = "div",
+    [IR_LT] = "lt",
+    [IR_LE] = "le",
+    [IR_EQ] = "eq",
+    [IR_NE] = "ne",
+    [IR_CALL] = "call",
+    [IR_PHI] = "phi",
+    [IR_JMP] = "jmp",
+    [IR_BR] = "br",
+    [IR_RET] = "ret",
+};
+
+static void print_inst(BasicBlock *b, IrInst *i)
+{
+    printf("  ");
+    if (i->dst)
+    {
+        printf("%%%d = ", i->dst);
+    }
+    printf("%s", op_name[i->op]);
+    switch (i->op)
+    {
+    case IR_IMM:
+    case IR_PARAM:
+    case IR_LOCAL:
+        printf(" %ld", i->imm);
+        break;
+    case IR_GLOBAL:
+        printf(" %s", i->name);
+        break;
+    case IR_LOAD:
+    case IR_TRUNC:
+        printf(".%d %%%d", i->size, i->a);
+        break;
+    case IR_STORE:
+        printf(".%d %%%d, %%%d", i->size, i->a, i->b);
+        break;
+    case IR_CALL:
+        printf(" %s(", i->name);
+        for (int k = 0; k < i->nargs; k++)
+        {
+            printf("%s%%%d", k ? ", " : "", i->args[k]);
+        }
+        printf(")");
+        break;
+    case IR_PHI:
+        for (int k = 0; k < i->nargs; k++)
+        {
+            printf("%s [%%%d, bb%d]", k ? "," : "", i->args[k], b->preds[k]->id);
+        }
+        break;
+    case IR_JMP:
+        printf(" bb%d", i->then->id);
+        break;
+    case IR_BR:
+        printf(" %%%d, bb%d, bb%d", i->a, i->then->id, i->els->id);
+        break;
+    case IR_RET:
+        printf(" %%%d", i->a);
+        break;
+    default:
+        printf(" %%%d, %%%d", i->a, i->b);
+        break;
+    }
+    printf("\n");
+}
+
+void print_ir(IrFunc *f)
+{
+    printf("func %s {\n", f->name);
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        printf("bb%d:", b->id);
+        for (int i = 0; i < b->npreds; i++)
+        {
+            printf("%s bb%d", i ? "," : "  ; preds", b->preds[i]->id);
+        }
+        printf("\n");
+        for (IrInst *i = b->insts; i; i = i->next)
+        {
+            print_inst(b, i);
+        }
+    }
+    printf("}\n");
+}
+
+// Verification
+
+static _Thread_local IrFunc *vf;
+
+static void fail(char *msg, BasicBlock *b)
+{
+    print_ir(vf);
+    error("IR verification failed in %s, bb%d: %s", vf->name, b->id, msg);
+}
+
+// Block numbers in reverse postorder, and immediate dominators indexed by them.
+static _Thread_local BasicBlock **rpo;
+static _Thread_local int *idom;
+static _Thread_local int nrpo;
+
+static void number_postorder(BasicBlock *b)
+{
+    if (b->order)
+    {
+        return;
+    }
+    b->order = -1;
+    int n;
+    BasicBlock **succ = successors(b, &n);
+    BasicBlock *s[2] = {n > 0 ? succ[0] : NULL, n > 1 ? succ[1] : NULL};
+    for (int i = 0; i < n; i++)
+    {
+        number_postorder(s[i]);
+    }
+    rpo[nrpo++] = b;
+}
+
+static int intersect(int a, int b)
+{
+    while (a != b)
+    {
+        while (a > b)
+        {
+            a = idom[a];
+        }
+        while (b > a)
+        {
+            b = idom[b];
+        }
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+static void compute_dominators(void)
+{
+    int n = 0;
+    for (BasicBlock *b = vf->blocks; b; b = b->next)
+    {
+        b->order = 0;
+        n++;
+    }
+    rpo = calloc(n, sizeof(BasicBlock *));
+    nrpo = 0;
+    number_postorder(vf->blocks);
+    if (nrpo != n)
+    {
+        fail("unreachable block", vf->blocks);
+    }
+    // 後順を逆にして入口を0にする
+    for (int i = 0; i < n / 2; i++)
+    {
+        BasicBlock *t = rpo[i];
+        rpo[i] = rpo[n - 1 - i];
+        rpo[n - 1 - i] = t;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        rpo[i]->order = i;
+    }
+
+    idom = calloc(n, sizeof(int));
+    for (int i = 1; i < n; i++)
+    {
+        idom[i] = -1;
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 1; i < n; i++)
+        {
+            int d = -1;
+            for (int k = 0; k < rpo[i]->npreds; k++)
+            {
+                int p = rpo[i]->preds[k]->order;
+                if (idom[p] >= 0 || p == 0)
+                {
+                    d = d < 0 ? p : intersect(p, d);
+                }
+            }
+            if (idom[i] != d)
+            {
+                idom[i] = d;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool dominates(BasicBlock *a, BasicBlock *b)
+{
+    int i = b->order;
+    while (i != a->order && i != 0)
+    {
+        i = idom[i];
+    }
+    return i == a->order;
+}
+
+typedef struct
+{
+    BasicBlock *block;
+    int pos;
+} Def;
+
+static bool has_pred(BasicBlock *b, BasicBlock *pred)
+{
+    for (int i = 0; i < b->npreds; i++)
+    {
+        if (b->preds[i] == pred)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_use(Def *defs, int v, BasicBlock *b, int pos)
+{
+    if (v <= 0 || v > vf->nvregs || !defs[v].block)
+    {
+        fail("use of an undefined value", b);
+    }
+    if (defs[v].block == b ? defs[v].pos >= pos : !dominates(defs[v].block, b))
+    {
+        fail("definition does not dominate a use", b);
+    }
+}
+
+static int count_operands(IrInst *i)
+{
+    switch (i->op)
+    {
+    case IR_IMM:
+    case IR_PARAM:
+    case IR_LOCAL:
+    case IR_GLOBAL:
+    case IR_JMP:
+    case IR_CALL:
+    case IR_PHI:
+        return 0;
+    case IR_LOAD:
+    case IR_TRUNC:
+    case IR_BR:
+    case IR_RET:
+        return 1;
+    }
+    return 2;
+}
+
+static void check_edge(BasicBlock *from, BasicBlock *to, bool conditional)
+{
+    if (!has_pred(to, from))
+    {
+        fail("successor does not list the block as a predecessor", from);
+    }
+    // 分岐先に前任者が一つだけなら、phiのコピーは前任者の末尾に置ける
+    if (conditional && to->npreds != 1)
+    {
+        fail("critical edge", from);
+    }
+}
+
+void verify_ir(IrFunc *f)
+{
+    vf = f;
+    compute_dominators();
+
+    Def *defs = calloc(f->nvregs + 1, sizeof(Def));
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        int pos = 0;
+        bool phis = true;
+        for (IrInst *i = b->insts; i; i = i->next, pos++)
+        {
+            if (i->op != IR_PHI)
+            {
+                phis = false;
+            }
+            else if (!phis)
+            {
+                fail("phi after another instruction", b);
+            }
+            if (ir_is_terminator(i->op) != (i->next == NULL))
+            {
+                fail("the block does not end with exactly one terminator", b);
+            }
+            if (i->dst)
+            {
+                if (i->dst > f->nvregs || defs[i->dst].block)
+                {
+                    fail("value defined twice", b);
+                }
+                defs[i->dst] = (Def){b, pos};
+            }
+        }
+        if (!b->last || b->last->next)
+        {
+            fail("the block does not end with exactly one terminator", b);
+        }
+        for (int k = 0; k < b->npreds; k++)
+        {
+            IrInst *t = b->preds[k]->last;
+            if (!t || (t->then != b && t->els != b))
+            {
+                fail("predecessor does not branch to the block", b);
+            }
+        }
+    }
+
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        int pos = 0;
+        for (IrInst *i = b->insts; i; i = i->next, pos++)
+        {
+            int n = count_operands(i);
+            if (n > 0)
+            {
+                check_use(defs, i->a, b, pos);
+            }
+            if (n > 1)
+            {
+                check_use(defs, i->b, b, pos);
+            }
+            if (i->op == IR_CALL)
+            {
+                for (int k = 0; k < i->nargs; k++)
+                {
+                    check_use(defs, i->args[k], b, pos);
+                }
+            }
+            if (i->op == IR_PHI)
+            {
+                if (i->nargs != b->npreds)
+                {
+                    fail("phi operands do not match the predecessors", b);
+                }
+                // phiの値は前任者の末尾で使われる
+                for (int k = 0; k < i->nargs; k++)
+                {
+                    int v = i->args[k];
+                    BasicBlock *p = b->preds[k];
+                    bool in_pred = v > 0 && v <= f->nvregs && defs[v].block == p;
+                    check_use(defs, v, p, in_pred ? INT_MAX : 0);
+                }
+            }
+            if (i->op == IR_JMP)
+            {
+                check_edge(b, i->then, false);
+            }
+            if (i->op == IR_BR)
+            {
+                check_edge(b, i->then, true);
+                check_edge(b, i->els, true);
+            }
+        }
+    }
+}
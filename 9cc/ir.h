@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include "9cc.h"
+
+/*
+ * SSA intermediate representation
+ *
+ * A function is a list of basic blocks. Each block is a list of
+ * instructions ending with exactly one terminator (jmp, br or ret). Values
+ * are virtual registers numbered from 1; each is defined by exactly one
+ * instruction and every use is dominated by its definition. Phi nodes come
+ * first in their block and have one operand per predecessor, in the order
+ * of preds[].
+ *
+ * Scalar locals whose address is never taken live in virtual registers.
+ * Arrays, address-taken locals and globals are accessed with load and
+ * store through an address computed by local/global.
+ */
+
+typedef enum
+{
+    IR_IMM,    // dst = imm
+    IR_PARAM,  // dst = the imm-th argument
+    IR_LOCAL,  // dst = rbp - imm (the address of a frame slot)
+    IR_GLOBAL, // dst = address of name
+    IR_LOAD,   // dst = *a, sign-extended from size bytes
+    IR_STORE,  // *a = b, truncated to size bytes
+    IR_TRUNC,  // dst = a truncated to size bytes and sign-extended
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_LT,
+    IR_LE,
+    IR_EQ,
+    IR_NE,
+    IR_CALL, // dst = name(args...)
+    IR_PHI,  // dst = args[i] when control comes from preds[i]
+    IR_JMP,  // goto then
+    IR_BR,   // if (a) goto then; else goto els
+    IR_RET,  // return a
+} IrOp;
+
+typedef struct BasicBlock BasicBlock;
+typedef struct IrInst IrInst;
+
+struct IrInst
+{
+    IrInst *next;
+    IrOp op;
+    int dst; // 0 if the instruction has no result
+    int a;
+    int b;
+    long imm;
+    int size;
+    char *name;
+    int *args;
+    int nargs;
+    BasicBlock *then;
+    BasicBlock *els;
+};
+
+struct BasicBlock
+{
+    BasicBlock *next;
+    int id;
+    IrInst *insts;
+    IrInst *last;
+    BasicBlock **preds;
+    int npreds;
+    bool sealed; // all predecessors are known
+    int order;   // scratch number used by analyses
+    int label;   // the number of its assembly label (irgen.c)
+
+    // SSA construction: the value of each tracked local at the end of the block
+    int *defs;
+    IrInst **incomplete; // phis added before the block was sealed
+};
+
+typedef struct
+{
+    char *name;
+    Node *node;
+    BasicBlock *blocks; // blocks[0] is the entry
+    int nvregs;
+    int nparams;
+} IrFunc;
+
+IrFunc *build_ir(Node *fn);
+void print_ir(IrFunc *f);
+void verify_ir(IrFunc *f);
+bool ir_is_terminator(IrOp op);
+void gen_ir(IrFunc *f);
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "codegen.h"
+
+/*
+ * Code generation from the SSA form
+ *
+ * Every virtual register gets its own 8-byte slot below the locals of the
+ * function, and each instruction loads its operands into rax and rdi,
+ * computes, and stores its result. Phis are resolved by copies at the end of
+ * each predecessor; the copies into the phis of one block happen at the same
+ * time, so all the sources are pushed before any phi is written.
+ *
+ * Nothing is kept in a register across a block boundary, which is what
+ * peephole() expects of the labels used here.
+ */
+
+static _Thread_local IrFunc *f;
+static _Thread_local int slot_base;
+
+static const char *arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+
+static char *slot(int v)
+{
+    char *b = malloc(32);
+    sprintf(b, "QWORD PTR [rbp - %d]", slot_base + v * 8);
+    return b;
+}
+
+static void load_reg(const char *reg, int v)
+{
+    emit("    mov %s, %s", reg, slot(v));
+}
+
+static void store_rax(int v)
+{
+    emit("    mov %s, rax", slot(v));
+}
+
+// Copies the operands of the phis of target for the edge from b.
+static void copy_phis(BasicBlock *b, BasicBlock *target)
+{
+    int k = 0;
+    while (target->preds[k] != b)
+    {
+        k++;
+    }
+    IrInst *phi;
+    for (phi = target->insts; phi && phi->op == IR_PHI; phi = phi->next)
+    {
+        emit("    push %s", slot(phi->args[k]));
+    }
+    // 逆順に取り出して書き込む
+    int n = 0;
+    IrInst *phis[256];
+    for (phi = target->insts; phi && phi->op == IR_PHI; phi = phi->next)
+    {
+        if (n == 256)
+        {
+            error("too many phis in bb%d", target->id);
+        }
+        phis[n++] = phi;
+    }
+    while (n > 0)
+    {
+        emit("    pop %s", slot(phis[--n]->dst));
+    }
+}
+
+static void gen_sized_load(int size)
+{
+    if (size == 1)
+    {
+        emit("    movsx rax, BYTE PTR [rax]");
+    }
+    else if (size == 4)
+    {
+        emit("    movsxd rax, DWORD PTR [rax]");
+    }
+    else
+    {
+        emit("    mov rax, [rax]");
+    }
+}
+
+static void gen_sized_store(int size)
+{
+    if (size == 1)
+    {
+        emit("    mov BYTE PTR [rax], dil");
+    }
+    else if (size == 4)
+    {
+        emit("    mov DWORD PTR [rax], edi");
+    }
+    else
+    {
+        emit("    mov [rax], rdi");
+    }
+}
+
+static void gen_compare(char *set)
+{
+    emit("    cmp rax, rdi");
+    emit("    %s al", set);
+    emit("    movzb rax, al");
+}
+
+static void gen_inst(BasicBlock *b, IrInst *i)
+{
+    switch (i->op)
+    {
+    case IR_PHI:
+        return;
+    case IR_IMM:
+        emit("    mov rax, %ld", i->imm);
+        break;
+    case IR_PARAM:
+        emit("    mov rax, %s", arg_regs[i->imm]);
+        break;
+    case IR_LOCAL:
+        emit("    lea rax, [rbp - %ld]", i->imm);
+        break;
+    case IR_GLOBAL:
+        emit("    lea rax, [rip + %s]", i->name);
+        break;
+    case IR_LOAD:
+        load_reg("rax", i->a);
+        gen_sized_load(i->size);
+        break;
+    case IR_STORE:
+        load_reg("rax", i->a);
+        load_reg("rdi", i->b);
+        gen_sized_store(i->size);
+        return;
+    case IR_TRUNC:
+        load_reg("rax", i->a);
+        emit(i->size == 1 ? "    movsx rax, al" : "    movsxd rax, eax");
+        break;
+    case IR_CALL:
+        for (int k = 0; k < i->nargs; k++)
+        {
+            load_reg(arg_regs[k], i->args[k]);
+        }
+        emit("    call %s", i->name);
+        break;
+    case IR_JMP:
+        copy_phis(b, i->then);
+        emit("    jmp .Lbb%d", i->then->label);
+        return;
+    case IR_BR:
+        load_reg("rax", i->a);
+        emit("    cmp rax, 0");
+        emit("    jne .Lbb%d", i->then->label);
+        emit("    jmp .Lbb%d", i->els->label);
+        return;
+    case IR_RET:
+        load_reg("rax", i->a);
+        emit("    mov rsp, rbp");
+        gen_profile_hook("__9cc_prof_leave", f->name);
+        emit("    pop rbp");
+        emit("    ret");
+        return;
+    default:
+        load_reg("rax", i->a);
+        load_reg("rdi", i->b);
+        switch (i->op)
+        {
+        case IR_ADD:
+            emit("    add rax, rdi");
+            break;
+        case IR_SUB:
+            emit("    sub rax, rdi");
+            break;
+        case IR_MUL:
+            emit("    imul rax, rdi");
+            break;
+        case IR_DIV:
+            emit("    cqo");
+            emit("    idiv rdi");
+            break;
+        case IR_LT:
+            gen_compare("setl");
+            break;
+        case IR_LE:
+            gen_compare("setle");
+            break;
+        case IR_EQ:
+            gen_compare("sete");
+            break;
+        case IR_NE:
+            gen_compare("setne");
+            break;
+        }
+        break;
+    }
+    store_rax(i->dst);
+}
+
+void gen_ir(IrFunc *func)
+{
+    f = func;
+    slot_base = align_to(f->node->stack_size, 8);
+
+    if (strcmp(f->name, "main") == 0)
+    {
+        emit(".globl main");
+    }
+    emit("    .type %s, @function", f->name);
+    emit("%s:", f->name);
+    emit("    push rbp");
+    emit("    mov rbp, rsp");
+    gen_profile_hook("__9cc_prof_enter", f->name);
+    emit("    sub rsp, %d", align_to(slot_base + (f->nvregs + 1) * 8, 16));
+
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        b->label = new_label();
+    }
+    for (BasicBlock *b = f->blocks; b; b = b->next)
+    {
+        emit(".Lbb%d:", b->label);
+        for (IrInst *i = b->insts; i; i = i->next)
+        {
+            gen_inst(b, i);
+        }
+    }
+    emit("    .size %s, .-%s", f->name, f->name);
+}
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Loop-invariant code motion
+ *
+ * An expression in a while or for loop whose operands are not changed by
+ * the loop is computed once into a temporary local before the loop (in a
+ * preheader, after the init of a for) and the loop reads the temporary.
+ * Operands are unchanged when they are tracked locals which the loop does
+ * not assign (see collect_locals()), or memory when the loop contains no
+ * store to memory and no function call.
+ *
+ * The preheader runs even when the loop body does not, so an expression
+ * which may fault (a dereference or a division) is only hoisted out of the
+ * condition, which runs before anything else in the loop. Inner loops are
+ * handled first, so their preheaders can be hoisted further.
+ */
+
+typedef struct
+{
+    Node *expr;
+    Node *tmp;
+} Hoisted;
+
+static Node *fn;
+static Locals *vars;
+
+typedef struct
+{
+    bool assigned[256];
+    bool writes_memory;
+    Hoisted hoisted[64];
+    int nhoisted;
+} Loop;
+
+static void find_writes(Node *node, void *ctx)
+{
+    Loop *l = ctx;
+    if (node->kind == ND_ASSIGN)
+    {
+        int var = local_index(vars, node->lhs);
+        if (var >= 0)
+        {
+            l->assigned[var] = true;
+        }
+        else
+        {
+            l->writes_memory = true;
+        }
+    }
+    if (node->kind == ND_FUNCALL || node->kind == ND_INIT)
+    {
+        l->writes_memory = true;
+    }
+}
+
+typedef struct
+{
+    Loop *loop;
+    bool variant;
+    bool may_fault;
+} Operands;
+
+static void check_operand(Node *node, void *ctx)
+{
+    Operands *o = ctx;
+    bool array = node->type && node->type->ty == ARRAY;
+    switch (node->kind)
+    {
+    case ND_LVAR:
+    {
+        int var = local_index(vars, node);
+        if (var >= 0 ? o->loop->assigned[var] : !array && o->loop->writes_memory)
+        {
+            o->variant = true;
+        }
+        return;
+    }
+    case ND_GVAR:
+        if (!array && o->loop->writes_memory)
+        {
+            o->variant = true;
+        }
+        return;
+    case ND_DEREF:
+        o->may_fault = true;
+        if (!array && o->loop->writes_memory)
+        {
+            o->variant = true;
+        }
+        return;
+    case ND_DIV:
+        o->may_fault = true;
+        return;
+    case ND_ASSIGN:
+    case ND_FUNCALL:
+        o->variant = true;
+        return;
+    }
+}
+
+static bool is_candidate(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+    case ND_LESS_THAN:
+    case ND_EQUAL_LESS_THAN:
+    case ND_EQ:
+    case ND_NE:
+    case ND_DEREF:
+        break;
+    default:
+        return false;
+    }
+    // 一時変数を読むより安いものは動かさない
+    return node->type && node->type->ty != ARRAY && expr_cost(node) >= 2;
+}
+
+static Node *temp_for(Loop *l, Node *node)
+{
+    for (int i = 0; i < l->nhoisted; i++)
+    {
+        if (same_expr(l->hoisted[i].expr, node))
+        {
+            return l->hoisted[i].tmp;
+        }
+    }
+    if (l->nhoisted == 64 || vars->nvars + l->nhoisted >= 256)
+    {
+        return NULL;
+    }
+    Node *expr = calloc(1, sizeof(Node));
+    *expr = *node;
+    expr->next = NULL;
+    Hoisted *h = &l->hoisted[l->nhoisted++];
+    h->expr = expr;
+    h->tmp = new_temp(fn, node->type);
+    return h->tmp;
+}
+
+// Replaces the largest invariant expressions in node with temporaries.
+static void hoist(Loop *l, Node *node, bool in_cond)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    if (is_candidate(node))
+    {
+        Operands o = {l};
+        visit(node, check_operand, &o);
+        if (!o.variant && (!o.may_fault || in_cond))
+        {
+            Node *tmp = temp_for(l, node);
+            if (tmp)
+            {
+                replace_node(node, tmp);
+                return;
+            }
+        }
+    }
+
+    switch (node->kind)
+    {
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_IF:
+        hoist(l, node->init, false);
+        hoist(l, node->cond, false);
+        hoist(l, node->then, false);
+        hoist(l, node->els, false);
+        hoist(l, node->inc, false);
+        return;
+    case ND_SWITCH:
+        hoist(l, node->cond, false);
+        // fallthrough
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            hoist(l, n, false);
+        }
+        return;
+    case ND_FUNCALL:
+        for (Node *n = node->args; n; n = n->next)
+        {
+            hoist(l, n, in_cond);
+        }
+        return;
+    case ND_ASSIGN:
+        // 左辺そのものは置き換えられない
+        if (node->lhs->kind == ND_DEREF)
+        {
+            hoist(l, node->lhs->lhs, in_cond);
+        }
+        hoist(l, node->rhs, in_cond);
+        return;
+    case ND_ADDR:
+        if (node->lhs->kind == ND_DEREF)
+        {
+            hoist(l, node->lhs->lhs, in_cond);
+        }
+        return;
+    }
+    hoist(l, node->lhs, in_cond);
+    hoist(l, node->rhs, in_cond);
+}
+
+static void licm(Node *node);
+
+static void licm_loop(Node *node)
+{
+    licm(node->then);
+
+    // 内側のループのプリヘッダで増えた一時変数も追跡する
+    vars = collect_locals(fn);
+    Loop *l = calloc(1, sizeof(Loop));
+    visit(node->cond, find_writes, l);
+    visit(node->then, find_writes, l);
+    visit(node->inc, find_writes, l);
+
+    // 条件式は必ず最初に評価されるが、副作用より先に例外を起こしてはいけない
+    hoist(l, node->cond, !has_side_effects(node->cond));
+    hoist(l, node->then, false);
+    hoist(l, node->inc, false);
+    if (l->nhoisted == 0)
+    {
+        return;
+    }
+
+    // プリヘッダ: for (init; cond; inc) => { init; tmp = expr...; for (; cond; inc) }
+    Node head = {};
+    Node *cur = &head;
+    if (node->init)
+    {
+        cur = cur->next = node->init;
+    }
+    for (int i = 0; i < l->nhoisted; i++)
+    {
+        Hoisted *h = &l->hoisted[i];
+        Node *assign = new_node(ND_ASSIGN, h->tmp, h->expr);
+        assign->type = h->tmp->type;
+        cur = cur->next = assign;
+    }
+    Node *loop = calloc(1, sizeof(Node));
+    *loop = *node;
+    loop->init = NULL;
+    loop->next = NULL;
+    cur->next = loop;
+
+    Node *block = calloc(1, sizeof(Node));
+    block->kind = ND_BLOCK;
+    block->body = head.next;
+    replace_node(node, block);
+}
+
+static void licm(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+    case ND_SWITCH:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            licm(n);
+        }
+        return;
+    case ND_IF:
+        licm(node->then);
+        licm(node->els);
+        return;
+    case ND_WHILE:
+    case ND_FOR:
+        licm_loop(node);
+        return;
+    }
+}
+
+void hoist_loop_invariants(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fn = text[i];
+        licm(fn->body);
+    }
+}
@@ -0,0 +1,404 @@
+#include <string.h>
+#include <stdlib.h>
+#include "optimize.h"
+
+void visit(Node *node, void (*fn)(Node *node, void *ctx), void *ctx)
+{
+    if (!node)
+    {
+        return;
+    }
+    fn(node, ctx);
+    visit(node->init, fn, ctx);
+    visit(node->cond, fn, ctx);
+    visit(node->lhs, fn, ctx);
+    visit(node->rhs, fn, ctx);
+    visit(node->then, fn, ctx);
+    visit(node->els, fn, ctx);
+    visit(node->inc, fn, ctx);
+    for (Node *n = node->args; n; n = n->next)
+    {
+        visit(n, fn, ctx);
+    }
+    for (Node *n = node->body; n; n = n->next)
+    {
+        visit(n, fn, ctx);
+    }
+}
+
+bool same_name(char *a, int alen, char *b, int blen)
+{
+    return alen == blen && memcmp(a, b, alen) == 0;
+}
+
+Node *find_func(char *name, int len)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        if (same_name(text[i]->funcname, text[i]->funcname_len, name, len))
+        {
+            return text[i];
+        }
+    }
+    return NULL;
+}
+
+static int find_local(Locals *l, int offset)
+{
+    for (int i = 0; i < l->nvars; i++)
+    {
+        if (l->offset[i] == offset)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void collect_local(Node *node, void *ctx)
+{
+    Locals *l = ctx;
+    if (node->kind == ND_LVAR && find_local(l, node->offset) < 0)
+    {
+        if (l->nvars == 256)
+        {
+            // 入りきらない変数は追跡しない
+            l->full = true;
+            return;
+        }
+        int i = l->nvars++;
+        l->offset[i] = node->offset;
+        l->type[i] = node->type;
+        l->escaped[i] = !node->type || (node->type->ty != INT && node->type->ty != CHAR && node->type->ty != PTR);
+    }
+    if (node->kind == ND_ADDR && node->lhs->kind == ND_LVAR)
+    {
+        // アドレスを取られた変数はポインタ経由で書き換えられうる
+        collect_local(node->lhs, ctx);
+        int i = find_local(l, node->lhs->offset);
+        if (i >= 0)
+        {
+            l->escaped[i] = true;
+        }
+    }
+}
+
+Locals *collect_locals(Node *fn)
+{
+    Locals *l = calloc(1, sizeof(Locals));
+    for (Node *a = fn->args; a; a = a->next)
+    {
+        visit(a, collect_local, l);
+    }
+    visit(fn->body, collect_local, l);
+    return l;
+}
+
+// Index of the local referenced by node if it is tracked, or -1.
+int local_index(Locals *l, Node *node)
+{
+    if (node->kind != ND_LVAR)
+    {
+        return -1;
+    }
+    int i = find_local(l, node->offset);
+    if (i < 0 || l->escaped[i])
+    {
+        return -1;
+    }
+    return i;
+}
+
+// break and the labels of a switch are kept like side effects, since removing
+// them would change the flow of control.
+static void find_side_effect(Node *node, void *ctx)
+{
+    if (node->kind == ND_ASSIGN || node->kind == ND_FUNCALL || node->kind == ND_INIT || node->kind == ND_BREAK ||
+        node->kind == ND_CASE || node->kind == ND_DEFAULT)
+    {
+        *(bool *)ctx = true;
+    }
+}
+
+bool has_side_effects(Node *node)
+{
+    bool found = false;
+    visit(node, find_side_effect, &found);
+    return found;
+}
+
+static bool same_type(Type *a, Type *b)
+{
+    if (!a || !b)
+    {
+        return a == b;
+    }
+    return a->ty == b->ty && size_of(a) == size_of(b);
+}
+
+// Whether a and b compute the same value from the same operands.
+bool same_expr(Node *a, Node *b)
+{
+    if (!a || !b)
+    {
+        return a == b;
+    }
+    if (a->kind != b->kind || !same_type(a->type, b->type))
+    {
+        return false;
+    }
+    switch (a->kind)
+    {
+    case ND_NUM:
+        return a->val == b->val;
+    case ND_LVAR:
+        return a->offset == b->offset;
+    case ND_GVAR:
+        return same_name(a->gvarname, a->gvarname_len, b->gvarname, b->gvarname_len);
+    case ND_STR_LITERAL:
+        return a->offset == b->offset;
+    }
+    return same_expr(a->lhs, b->lhs) && same_expr(a->rhs, b->rhs);
+}
+
+bool is_scale(Node *node)
+{
+    return node->kind == ND_NUM && (node->val == 1 || node->val == 2 || node->val == 4 || node->val == 8);
+}
+
+// Cost of an address which is used as a memory operand.
+static int addr_cost(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_ADD:
+        if (node->rhs->kind == ND_NUM)
+        {
+            return addr_cost(node->lhs);
+        }
+        if (node->lhs->kind == ND_NUM)
+        {
+            return addr_cost(node->rhs);
+        }
+        Node *index = node->rhs;
+        if (index->kind == ND_MUL && (is_scale(index->lhs) || is_scale(index->rhs)))
+        {
+            index = is_scale(index->rhs) ? index->lhs : index->rhs;
+        }
+        return addr_cost(node->lhs) + expr_cost(index);
+    case ND_SUB:
+        if (node->rhs->kind == ND_NUM)
+        {
+            return addr_cost(node->lhs);
+        }
+        return 1 + addr_cost(node->lhs) + expr_cost(node->rhs);
+    case ND_LVAR:
+        if (node->type->ty == ARRAY)
+        {
+            return 0;
+        }
+        break;
+    case ND_ADDR:
+        return node->lhs->kind == ND_DEREF ? addr_cost(node->lhs->lhs) : 0;
+    }
+    return expr_cost(node);
+}
+
+// Rough number of instructions needed to compute node, not counting pushes.
+// Address arithmetic which codegen folds into a memory operand is free.
+int expr_cost(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_NUM:
+        return 0;
+    case ND_LVAR:
+    case ND_GVAR:
+    case ND_STR_LITERAL:
+    case ND_ADDR:
+        return 1;
+    case ND_DEREF:
+        return 1 + addr_cost(node->lhs);
+    case ND_ADD:
+    case ND_SUB:
+        if (is_pointer(node->type))
+        {
+            return 1 + addr_cost(node);
+        }
+        break;
+    }
+    return 1 + (node->lhs ? expr_cost(node->lhs) : 0) + (node->rhs ? expr_cost(node->rhs) : 0);
+}
+
+typedef struct
+{
+    Locals *vars;
+    bool found;
+} MemoryRead;
+
+static void find_memory_read(Node *node, void *ctx)
+{
+    MemoryRead *r = ctx;
+    bool array = node->type && node->type->ty == ARRAY;
+    if ((node->kind == ND_DEREF || node->kind == ND_GVAR) && !array)
+    {
+        r->found = true;
+    }
+    if (node->kind == ND_LVAR && !array && local_index(r->vars, node) < 0)
+    {
+        r->found = true;
+    }
+}
+
+// Whether node loads from memory which a store through a pointer or a
+// function call may change.
+bool reads_memory(Locals *vars, Node *node)
+{
+    MemoryRead r = {vars, false};
+    visit(node, find_memory_read, &r);
+    return r.found;
+}
+
+typedef struct
+{
+    int offset;
+    bool found;
+} VarRef;
+
+static void find_var(Node *node, void *ctx)
+{
+    VarRef *r = ctx;
+    if (node->kind == ND_LVAR && node->offset == r->offset)
+    {
+        r->found = true;
+    }
+}
+
+bool reads_var(Node *node, int offset)
+{
+    VarRef r = {offset, false};
+    visit(node, find_var, &r);
+    return r.found;
+}
+
+// A fresh local for a value computed by an optimization pass.
+Node *new_temp(Node *fn, Type *type)
+{
+    Node *n = calloc(1, sizeof(Node));
+    n->kind = ND_LVAR;
+    n->offset = fn->stack_size + 8;
+    n->type = type;
+    fn->stack_size = align_to(n->offset, 16);
+    return n;
+}
+
+static Node *copy_list(Node *list)
+{
+    Node head = {};
+    Node *cur = &head;
+    for (Node *n = list; n; n = n->next)
+    {
+        cur = cur->next = copy_tree(n);
+    }
+    return head.next;
+}
+
+// A deep copy of node. next is not copied.
+Node *copy_tree(Node *node)
+{
+    if (!node)
+    {
+        return NULL;
+    }
+    Node *n = calloc(1, sizeof(Node));
+    *n = *node;
+    n->next = NULL;
+    n->lhs = copy_tree(node->lhs);
+    n->rhs = copy_tree(node->rhs);
+    n->cond = copy_tree(node->cond);
+    n->then = copy_tree(node->then);
+    n->els = copy_tree(node->els);
+    n->init = copy_tree(node->init);
+    n->inc = copy_tree(node->inc);
+    n->body = copy_list(node->body);
+    n->args = copy_list(node->args);
+    return n;
+}
+
+// Matches the increment of a for loop, i = i + k, i = k + i or i = i - k
+// with a constant k, and returns i.
+Node *basic_iv(Locals *vars, Node *inc, int *step)
+{
+    if (!inc || inc->kind != ND_ASSIGN || local_index(vars, inc->lhs) < 0 || inc->lhs->type->ty != INT)
+    {
+        return NULL;
+    }
+    Node *iv = inc->lhs;
+    Node *r = inc->rhs;
+    if (r->kind == ND_ADD && r->lhs->kind == ND_LVAR && r->lhs->offset == iv->offset && r->rhs->kind == ND_NUM)
+    {
+        *step = r->rhs->val;
+        return iv;
+    }
+    if (r->kind == ND_ADD && r->rhs->kind == ND_LVAR && r->rhs->offset == iv->offset && r->lhs->kind == ND_NUM)
+    {
+        *step = r->lhs->val;
+        return iv;
+    }
+    if (r->kind == ND_SUB && r->lhs->kind == ND_LVAR && r->lhs->offset == iv->offset && r->rhs->kind == ND_NUM)
+    {
+        *step = -r->rhs->val;
+        return iv;
+    }
+    return NULL;
+}
+
+typedef struct
+{
+    int offset;
+    bool found;
+} Assigned;
+
+static void find_assign(Node *node, void *ctx)
+{
+    Assigned *a = ctx;
+    if (node->kind == ND_ASSIGN && node->lhs->kind == ND_LVAR && node->lhs->offset == a->offset)
+    {
+        a->found = true;
+    }
+}
+
+// Whether node assigns the local at offset.
+bool assigns_var(Node *node, int offset)
+{
+    Assigned a = {offset, false};
+    visit(node, find_assign, &a);
+    return a.found;
+}
+
+// Whether node contains a break which leaves the loop or switch around
+// node, that is, one which is not inside a loop or switch of its own.
+bool has_break(Node *node)
+{
+    if (!node)
+    {
+        return false;
+    }
+    switch (node->kind)
+    {
+    case ND_BREAK:
+        return true;
+    case ND_IF:
+        return has_break(node->then) || has_break(node->els);
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            if (has_break(n))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
+}
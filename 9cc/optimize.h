@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "9cc.h"
+
+// Optimization passes over the AST produced by program().
+
+// Local variables of a function, identified by their frame offset.
+// Scalars whose address is never taken can only be changed by assigning to
+// them directly; the others are marked as escaped. Locals beyond the first
+// 256 are not tracked, as if they had escaped.
+typedef struct
+{
+    int nvars;
+    int offset[256];
+    Type *type[256];
+    bool escaped[256];
+    bool full; // some locals are not tracked
+} Locals;
+
+// Calls fn on node and every node below it, in evaluation order.
+void visit(Node *node, void (*fn)(Node *node, void *ctx), void *ctx);
+bool same_name(char *a, int alen, char *b, int blen);
+Node *find_func(char *name, int len);
+Locals *collect_locals(Node *fn);
+int local_index(Locals *l, Node *node);
+bool has_side_effects(Node *node);
+bool same_expr(Node *a, Node *b);
+bool reads_memory(Locals *vars, Node *node);
+bool reads_var(Node *node, int offset);
+bool is_scale(Node *node);
+int expr_cost(Node *node);
+Node *new_temp(Node *fn, Type *type);
+Node *copy_tree(Node *node);
+Node *basic_iv(Locals *vars, Node *inc, int *step);
+bool assigns_var(Node *node, int offset);
+bool has_break(Node *node);
+
+void replace_node(Node *dst, Node *src);
+void set_num(Node *node, int val);
+bool eval_binary(NodeKind kind, int a, int b, int *val);
+void fold(Node *node);
+bool never_falls_through(Node *node);
+
+void prune_unreachable(void);
+void inline_functions(void);
+void fold_constants(void);
+void evaluate_pure_calls(void);
+void propagate_constants(void);
+void simplify_cfg(void);
+void vectorize_loops(void);
+void unroll_loops(void);
+void hoist_loop_invariants(void);
+void reduce_strength(void);
+void eliminate_common_subexpressions(void);
+void eliminate_dead_stores(void);
+void mark_tail_calls(void);
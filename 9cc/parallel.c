@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "codegen.h"
+#include "passes.h"
+#include "ir.h"
+
+/*
+ * Parallel code generation
+ *
+ * Each function is generated into a list of its own, with labels numbered
+ * per function (see new_label()), and the passes over the assembly run on
+ * that list in the thread which generated it. The lists are then appended
+ * to the program in source order, so the output is the same for any -j.
+ *
+ * The functions are split into contiguous ranges, one per worker. A worker
+ * takes functions from the front of its own range, and when that is empty
+ * steals the last function of another range, so that one large function
+ * does not hold up the rest of its range.
+ */
+
+int jobs = 1;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    int next; // the next function of the range
+    int end;  // one past its last function
+} Range;
+
+static Range *ranges;
+static int nworkers;
+static int nfuncs;
+static bool ir;
+static Inst **lists;
+
+// The next function for worker self, or -1 when all have been taken.
+static int take(int self)
+{
+    Range *r = &ranges[self];
+    pthread_mutex_lock(&r->lock);
+    int i = r->next < r->end ? r->next++ : -1;
+    pthread_mutex_unlock(&r->lock);
+    if (i >= 0)
+    {
+        return i;
+    }
+    // 自分の範囲が空になったら他の範囲の後ろから盗む
+    for (int k = 1; k < nworkers; k++)
+    {
+        Range *v = &ranges[(self + k) % nworkers];
+        pthread_mutex_lock(&v->lock);
+        i = v->next < v->end ? --v->end : -1;
+        pthread_mutex_unlock(&v->lock);
+        if (i >= 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void gen_function(int i)
+{
+    Inst *list = calloc(1, sizeof(Inst));
+    Inst *saved = redirect_code(list);
+    start_labels(i);
+    if (ir)
+    {
+        IrFunc *f = build_ir(text[i]);
+        verify_ir(f);
+        gen_ir(f);
+    }
+    else
+    {
+        gen(text[i]);
+    }
+    redirect_code(saved);
+    run_asm_passes(list);
+    lists[i] = list;
+}
+
+static void *worker(void *arg)
+{
+    int self = (int)(long)arg;
+    for (int i; (i = take(self)) >= 0;)
+    {
+        gen_function(i);
+    }
+    return NULL;
+}
+
+void gen_functions(bool use_ir)
+{
+    nfuncs = 0;
+    while (text[nfuncs])
+    {
+        nfuncs++;
+    }
+    if (nfuncs == 0)
+    {
+        return;
+    }
+    ir = use_ir;
+    lists = calloc(nfuncs, sizeof(Inst *));
+    set_label_stride(nfuncs);
+
+    nworkers = jobs > 0 ? jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+    {
+        nworkers = 1;
+    }
+    if (nworkers > nfuncs)
+    {
+        nworkers = nfuncs;
+    }
+    ranges = calloc(nworkers, sizeof(Range));
+    for (int w = 0; w < nworkers; w++)
+    {
+        pthread_mutex_init(&ranges[w].lock, NULL);
+        ranges[w].next = (long)nfuncs * w / nworkers;
+        ranges[w].end = (long)nfuncs * (w + 1) / nworkers;
+    }
+
+    // 呼び出したスレッドも0番目のワーカーとして働く
+    pthread_t *threads = calloc(nworkers, sizeof(pthread_t));
+    for (int w = 1; w < nworkers; w++)
+    {
+        if (pthread_create(&threads[w], NULL, worker, (void *)(long)w) != 0)
+        {
+            error("スレッドを作れません");
+        }
+    }
+    worker((void *)0L);
+    for (int w = 1; w < nworkers; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+
+    for (int i = 0; i < nfuncs; i++)
+    {
+        append_code(lists[i]);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Parallel code generation: the functions of the program are generated on
+// several threads and their code is joined in source order.
+
+// -j: the number of threads, or 0 for one per processor
+extern int jobs;
+
+void gen_functions(bool use_ir);
@@ -2,6 +2,8 @@
 Scope *scope = &(Scope){};
 LVar *current_lvar;
 GVar *global_var;
+// 囲んでいるループとswitchの数 (breakできるかどうか)
+static int breakable;
 
 Node *new_node(NodeKind kind, Node *lhs, Node *rhs)
 {
@@ -22,6 +24,50 @@ Node *new_node_num(int val)
     return node;
 }
 
+// ポインタ演算では要素のサイズ倍する
+Node *new_add(Node *l, Node *r)
+{
+    add_type(l);
+    add_type(r);
+
+    if (is_pointer(l->type) && is_pointer(r->type))
+    {
+        error("poitner + pointer");
+    }
+    if (is_pointer(l->type))
+    {
+        return new_node(ND_ADD, l, new_node(ND_MUL, r, new_node_num(size_of(l->type->ptr_to))));
+    }
+    if (is_pointer(r->type))
+    {
+        return new_node(ND_ADD, new_node(ND_MUL, l, new_node_num(size_of(r->type->ptr_to))), r);
+    }
+    return new_node(ND_ADD, l, r);
+}
+
+Node *new_sub(Node *l, Node *r)
+{
+    add_type(l);
+    add_type(r);
+
+    if (is_pointer(l->type) && is_pointer(r->type))
+    {
+        // pointer - pointerは要素数を返す
+        Node *n = new_node(ND_SUB, l, r);
+        n->type = new_type(INT);
+        return new_node(ND_DIV, n, new_node_num(size_of(l->type->ptr_to)));
+    }
+    if (is_pointer(l->type))
+    {
+        return new_node(ND_SUB, l, new_node(ND_MUL, r, new_node_num(size_of(l->type->ptr_to))));
+    }
+    if (is_pointer(r->type))
+    {
+        error("int - pointer");
+    }
+    return new_node(ND_SUB, l, r);
+}
+
 bool consume(char *op)
 {
     if (token->kind != TK_RESERVED ||
@@ -140,6 +186,187 @@ Node *expr()
     return assign();
 }
 
+// 文字列リテラルのエスケープを解いてbufに書き、長さを返す。bufがNULLなら長さだけ数える
+static int decode_string(Token *t, char *buf)
+{
+    int n = 0;
+    for (int i = 0; i < t->len; i++, n++)
+    {
+        char c = t->str[i];
+        if (c == '\\' && i + 1 < t->len)
+        {
+            switch (t->str[++i])
+            {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case '0':
+                c = '\0';
+                break;
+            default:
+                c = t->str[i];
+            }
+        }
+        if (buf)
+        {
+            buf[n] = c;
+        }
+    }
+    return n;
+}
+
+static bool is_reserved(Token *t, char *op)
+{
+    return t->kind == TK_RESERVED && t->len == strlen(op) && !memcmp(t->str, op, t->len);
+}
+
+// "int a[] = ..."の要素数を初期化子を先読みして数える
+static int initializer_length(void)
+{
+    Token *t = token;
+    if (!is_reserved(t, "="))
+    {
+        error("配列の要素数がありません");
+    }
+    t = t->next;
+    if (t->kind == TK_STRING_LITERAL)
+    {
+        return decode_string(t, NULL) + 1;
+    }
+    if (!is_reserved(t, "{"))
+    {
+        error("配列の初期化子は{}か文字列リテラルです");
+    }
+    int n = 0;
+    int depth = 0;
+    bool empty = true;
+    for (t = t->next; depth > 0 || !is_reserved(t, "}"); t = t->next)
+    {
+        if (t->kind == TK_EOF)
+        {
+            error("初期化子が閉じていません");
+        }
+        if (is_reserved(t, "(") || is_reserved(t, "["))
+        {
+            depth++;
+        }
+        if (is_reserved(t, ")") || is_reserved(t, "]"))
+        {
+            depth--;
+        }
+        if (depth == 0 && is_reserved(t, ","))
+        {
+            n++;
+            empty = true;
+            continue;
+        }
+        empty = false;
+    }
+    // 最後のカンマの後は要素がなくてもよい
+    n += !empty;
+    if (n == 0)
+    {
+        error("空の初期化子です");
+    }
+    return n;
+}
+
+// 変数名の右側の型情報（"int i[3]"の"[3]"の部分）
+static Type *array_suffix(Type *t)
+{
+    if (!consume("["))
+    {
+        return t;
+    }
+    if (consume("]"))
+    {
+        return array_of(t, initializer_length());
+    }
+    int num = expect_number();
+    expect(']');
+    return array_of(t, num);
+}
+
+// The value of an integer constant expression, as far as the parser builds
+// them: numbers, sizeof and arithmetic on them.
+static bool const_value(Node *node, int *val)
+{
+    int l, r;
+    switch (node->kind)
+    {
+    case ND_NUM:
+        *val = node->val;
+        return true;
+    case ND_ADD:
+    case ND_SUB:
+    case ND_MUL:
+    case ND_DIV:
+        if (!const_value(node->lhs, &l) || !const_value(node->rhs, &r) || (node->kind == ND_DIV && r == 0))
+        {
+            return false;
+        }
+        // intの範囲で折り返す
+        *val = node->kind == ND_ADD   ? (int)((unsigned)l + (unsigned)r)
+               : node->kind == ND_SUB ? (int)((unsigned)l - (unsigned)r)
+               : node->kind == ND_MUL ? (int)((unsigned)l * (unsigned)r)
+                                      : (int)((long)l / r);
+        return true;
+    }
+    return false;
+}
+
+// Parses the initializer after "=" and returns the values of the elements
+// in order, or the single value of a scalar. A string literal initializes a
+// char array with its characters and the terminating NUL if it fits.
+static Node *initializer(Type *t)
+{
+    if (t->ty != ARRAY)
+    {
+        return assign();
+    }
+
+    Node head = {};
+    Node *cur = &head;
+    if (t->ptr_to->ty == CHAR && token->kind == TK_STRING_LITERAL)
+    {
+        char *buf = calloc(token->len + 1, 1);
+        int len = decode_string(token, buf);
+        token = token->next;
+        if (len > t->array_size)
+        {
+            error("初期化子が配列より長いです");
+        }
+        for (int i = 0; i <= len && i < t->array_size; i++)
+        {
+            cur = cur->next = new_node_num(buf[i]);
+        }
+        return head.next;
+    }
+
+    expect('{');
+    int n = 0;
+    while (!consume("}"))
+    {
+        if (n++ == t->array_size)
+        {
+            error("初期化子が配列より長いです");
+        }
+        cur = cur->next = assign();
+        if (!consume(","))
+        {
+            expect('}');
+            break;
+        }
+    }
+    return head.next;
+}
+
 Node *declare_lvar()
 {
     Token *type = consume_type();
@@ -163,16 +390,11 @@ Node *declare_lvar()
         error("unsupported type on token");
     }
 
-    Type *head = calloc(1, sizeof(Type));
-    Type *c = head;
+    Type *t = base;
     while (consume("*"))
     {
-        Type *n = calloc(1, sizeof(Type));
-        n->ty = PTR;
-        c->ptr_to = n;
-        c = n;
+        t = pointer_to(t);
     }
-    c->ptr_to = base;
 
     // 変数名のtoken
     Token *i = consume_ident();
@@ -181,17 +403,7 @@ Node *declare_lvar()
         error("Not indent token\n");
     }
 
-    // 変数名の右側の型情報（"int i[3]"の"[3]"の部分）
-    if (consume("["))
-    {
-        int num = expect_number();
-        Type *a = calloc(1, sizeof(Type));
-        a->ty = ARRAY;
-        a->ptr_to = c;
-        a->array_size = num;
-        head->ptr_to = a;
-        expect(']');
-    }
+    t = array_suffix(t);
 
     // 変数ノードの生成とLVar型を管理用データ構造に登録
     Node *n = calloc(1, sizeof(Node));
@@ -206,31 +418,12 @@ Node *declare_lvar()
     l->next = current_lvar;
     l->name = i->str;
     l->len = i->len;
-    l->type = head->ptr_to;
+    l->type = t;
+    // 型のサイズとアラインメントに合わせて配置する
     int current_offset = current_lvar ? current_lvar->offset : 0;
-    int offset;
-    if (l->type->ty == INT)
-    {
-        offset = 8;
-    }
-    else if (l->type->ty == CHAR)
-    {
-        offset = 8;
-    }
-    else if (l->type->ty == PTR)
-    {
-        offset = 8;
-    }
-    else if (l->type->ty == ARRAY)
-    {
-        offset = l->type->array_size * 8;
-    }
-    else
-    {
-        error("Unsupported type for lvar");
-    }
-    l->offset = current_offset + offset;
+    l->offset = align_to(current_offset + size_of(t), align_of(t));
     n->offset = l->offset;
+    n->type = t;
     current_lvar = l;
     return n;
 }
@@ -269,11 +462,85 @@ Node *declare_func()
     expect(')');
     node->args = head.next;
     node->body = stmt();
+    add_type(node->body);
+    node->stack_size = align_to(current_lvar ? current_lvar->offset : 0, 16);
     destroy_lvar();
     leave_scope();
     return node;
 }
 
+// "int a[3] = {1, f(), 3};" => { a = {1, 0, 3}; a[1] = f(); }
+// The constant elements are copied from a template at once (see ND_INIT),
+// and the others are assigned after the copy.
+static Node *init_local(Node *var)
+{
+    Node *vals = initializer(var->type);
+    if (var->type->ty != ARRAY)
+    {
+        return new_node(ND_ASSIGN, var, vals);
+    }
+
+    Node *init = new_node(ND_INIT, var, NULL);
+    Node head = {};
+    Node *cur = &head;
+    Node rest = {};
+    Node *last = &rest;
+    Node *next;
+    int i = 0;
+    for (Node *v = vals; v; v = next, i++)
+    {
+        next = v->next;
+        v->next = NULL;
+        int c;
+        if (const_value(v, &c))
+        {
+            cur = cur->next = new_node_num(c);
+            continue;
+        }
+        cur = cur->next = new_node_num(0);
+        Node *ref = calloc(1, sizeof(Node));
+        *ref = *var;
+        Node *elem = new_node(ND_DEREF, new_add(ref, new_node_num(i)), NULL);
+        last = last->next = new_node(ND_ASSIGN, elem, v);
+    }
+    init->body = head.next;
+    if (!rest.next)
+    {
+        return init;
+    }
+    init->next = rest.next;
+    Node *block = new_node(ND_BLOCK, NULL, NULL);
+    block->body = init;
+    return block;
+}
+
+// 大域変数の初期値はオブジェクトに置くので定数でなければならない
+static Node *init_global(Type *t)
+{
+    Node head = {};
+    Node *cur = &head;
+    Node *next;
+    for (Node *v = initializer(t); v; v = next)
+    {
+        next = v->next;
+        int c;
+        if (const_value(v, &c))
+        {
+            cur = cur->next = new_node_num(c);
+        }
+        else if (v->kind == ND_STR_LITERAL && t->ty == PTR && t->ptr_to->ty == CHAR)
+        {
+            v->next = NULL;
+            cur = cur->next = v;
+        }
+        else
+        {
+            error("大域変数の初期値は定数でなければなりません");
+        }
+    }
+    return head.next;
+}
+
 Node *declare_gvar()
 {
     Token *type = consume_type();
@@ -292,16 +559,11 @@ Node *declare_gvar()
     {
         base->ty = CHAR;
     }
-    Type *head = calloc(1, sizeof(Type));
-    Type *c = head;
+    Type *t = base;
     while (consume("*"))
     {
-        Type *n = calloc(1, sizeof(Type));
-        n->ty = PTR;
-        c->ptr_to = n;
-        c = n;
+        t = pointer_to(t);
     }
-    c->ptr_to = base;
 
     // 変数名のtoken
     Token *i = consume_ident();
@@ -310,17 +572,7 @@ Node *declare_gvar()
         error("Not indent token\n");
     }
 
-    // 変数名の右側の型情報（"int i[3]"の"[3]"の部分）
-    if (consume("["))
-    {
-        int num = expect_number();
-        Type *a = calloc(1, sizeof(Type));
-        a->ty = ARRAY;
-        a->ptr_to = c;
-        a->array_size = num;
-        head->ptr_to = a;
-        expect(']');
-    }
+    t = array_suffix(t);
 
     Node *n = calloc(1, sizeof(Node));
     n->kind = ND_GVAR_DECL;
@@ -334,12 +586,16 @@ Node *declare_gvar()
     g->next = global_var;
     g->name = i->str;
     g->len = i->len;
-    g->type = head->ptr_to;
+    g->type = t;
     global_var = g;
 
     n->type = g->type;
     n->gvarname = g->name;
     n->gvarname_len = g->len;
+    if (consume("="))
+    {
+        n->body = init_global(t);
+    }
     return n;
 }
 
@@ -381,6 +637,60 @@ bool is_func_decl()
     return true;
 }
 
+// switch (expr) { case 1: ... default: ... }
+// caseの値は整数リテラルだけで、ラベルは{}の直下にしか置けない
+static Node *switch_stmt(void)
+{
+    Node *node = calloc(1, sizeof(Node));
+    node->kind = ND_SWITCH;
+    expect('(');
+    node->cond = expr();
+    expect(')');
+    expect('{');
+
+    breakable++;
+    Node head = {};
+    Node *cur = &head;
+    bool has_default = false;
+    while (!consume("}"))
+    {
+        if (consume_kind(TK_CASE))
+        {
+            int sign = consume("-") ? -1 : 1;
+            Node *c = calloc(1, sizeof(Node));
+            c->kind = ND_CASE;
+            c->val = sign * expect_number();
+            expect(':');
+            for (Node *n = head.next; n; n = n->next)
+            {
+                if (n->kind == ND_CASE && n->val == c->val)
+                {
+                    error("caseの値が重複しています: %d", c->val);
+                }
+            }
+            cur = cur->next = c;
+            continue;
+        }
+        if (consume_kind(TK_DEFAULT))
+        {
+            expect(':');
+            if (has_default)
+            {
+                error("defaultが重複しています");
+            }
+            has_default = true;
+            Node *d = calloc(1, sizeof(Node));
+            d->kind = ND_DEFAULT;
+            cur = cur->next = d;
+            continue;
+        }
+        cur = cur->next = stmt();
+    }
+    breakable--;
+    node->body = head.next;
+    return node;
+}
+
 Node *stmt()
 {
     Node *node;
@@ -405,7 +715,9 @@ Node *stmt()
         expect('(');
         node->cond = expr();
         expect(')');
+        breakable++;
         node->then = stmt();
+        breakable--;
     }
     else if (consume_kind(TK_FOR))
     {
@@ -427,7 +739,27 @@ Node *stmt()
             node->inc = expr();
             expect(')');
         }
+        breakable++;
         node->then = stmt();
+        breakable--;
+    }
+    else if (consume_kind(TK_SWITCH))
+    {
+        node = switch_stmt();
+    }
+    else if (consume_kind(TK_BREAK))
+    {
+        if (breakable == 0)
+        {
+            error("breakはループかswitchの中にしか書けません");
+        }
+        node = calloc(1, sizeof(Node));
+        node->kind = ND_BREAK;
+        expect(';');
+    }
+    else if (token->kind == TK_CASE || token->kind == TK_DEFAULT)
+    {
+        error("caseとdefaultはswitchの{}の直下にしか書けません");
     }
     else if (consume_kind(TK_RETURN))
     {
@@ -460,7 +792,7 @@ Node *stmt()
         Node *l = declare_lvar();
         if (l)
         {
-            node = l;
+            node = consume("=") ? init_local(l) : l;
             expect(';');
         }
         else
@@ -494,13 +826,13 @@ Node *lvar(Token *tok)
         return NULL;
     }
 
-    // 配列添字
-    if (lvar->type->ty == ARRAY && consume("["))
+    // 配列添字 a[i]は*(a + i)として扱う
+    if (is_pointer(lvar->type) && consume("["))
     {
-        int s = expect_number();
         Node *d = calloc(1, sizeof(Node));
         d->kind = ND_DEREF;
-        d->lhs = new_node(ND_ADD, node, new_node_num(s));
+        d->lhs = new_add(node, expr());
+        add_type(d);
         ret = d;
         expect(']');
     }
@@ -534,13 +866,13 @@ Node *gvar(Token *tok)
         return NULL;
     }
 
-    // 配列添字
-    if (gvar->type->ty == ARRAY && consume("["))
+    // 配列添字 a[i]は*(a + i)として扱う
+    if (is_pointer(gvar->type) && consume("["))
     {
-        int s = expect_number();
         Node *d = calloc(1, sizeof(Node));
         d->kind = ND_DEREF;
-        d->lhs = new_node(ND_ADD, node, new_node_num(s));
+        d->lhs = new_add(node, expr());
+        add_type(d);
         ret = d;
         expect(']');
     }
@@ -569,6 +901,24 @@ Node *var(Token *t)
     error("Undefined var");
 }
 
+static int data_cap;
+static int text_cap;
+static int literal_cap;
+
+// Stores n at list[len] and keeps the list NULL-terminated, growing it
+// when it is full.
+static Node **append_node(Node **list, int *cap, int len, Node *n)
+{
+    if (len + 2 > *cap)
+    {
+        *cap *= 2;
+        list = realloc(list, *cap * sizeof(Node *));
+    }
+    list[len] = n;
+    list[len + 1] = NULL;
+    return list;
+}
+
 Node *string_literal(Token *t)
 {
     if (t->kind != TK_STRING_LITERAL)
@@ -576,15 +926,13 @@ Node *string_literal(Token *t)
         error("token is not string kind");
     }
 
-    bool exist = false;
     int i = 0;
     //TODO: to be refactored to map data structure
     for (; data_string_literal[i]; i++)
     {
         Node *d = data_string_literal[i];
-        if (memcmp(d->strliteral, t->str, d->strliteral_len == 0))
+        if (d->strliteral_len == t->len && memcmp(d->strliteral, t->str, t->len) == 0)
         {
-            exist = true;
             break;
         }
     }
@@ -595,11 +943,10 @@ Node *string_literal(Token *t)
     n->strliteral_len = t->len;
     n->offset = i;
 
-    if (!exist)
+    if (!data_string_literal[i])
     {
-        data_string_literal[i] = n;
+        data_string_literal = append_node(data_string_literal, &literal_cap, i, n);
     }
-    data_string_literal[i+1] = NULL;
 
     return n;
 }
@@ -622,21 +969,22 @@ void program()
 {
     int idxData = 0;
     int idxText = 0;
+    data = calloc(data_cap = 16, sizeof(Node *));
+    text = calloc(text_cap = 16, sizeof(Node *));
+    data_string_literal = calloc(literal_cap = 16, sizeof(Node *));
 
     while (!at_eof())
     {
         Node *n = declare();
         if (n->kind == ND_GVAR_DECL)
         {
-            data[idxData++] = n;
+            data = append_node(data, &data_cap, idxData++, n);
         }
         else
         {
-            text[idxText++] = n;
+            text = append_node(text, &text_cap, idxText++, n);
         }
     }
-    data[idxText] = NULL;
-    text[idxText] = NULL;
 }
 
 Node *assign()
@@ -688,35 +1036,9 @@ Node *add()
     for (;;)
     {
         if (consume("+"))
-        {
-            Node *l = node;
-            Node *r = mul();
-
-            // 複雑なパターンは一旦無視
-            //  pointer arithmetic
-            if (l && l->type && l->type->ty == PTR)
-            {
-                if (r && r->type && r->type->ty == PTR)
-                {
-                    error("poitner + pointer");
-                }
-                node = new_node(ND_ADD, l, new_node(ND_MUL, r, new_node_num(4)));
-            }
-            else if (r && r->type && r->type->ty == PTR)
-            {
-                if (l && l->type && l->type->ty == PTR)
-                {
-                    error("poitner + pointer");
-                }
-                node = new_node(ND_ADD, new_node(ND_MUL, l, new_node_num(4)), r);
-            }
-            else
-            {
-                node = new_node(ND_ADD, l, r);
-            }
-        }
+            node = new_add(node, mul());
         else if (consume("-"))
-            node = new_node(ND_SUB, node, mul());
+            node = new_sub(node, mul());
         else
             return node;
     }
@@ -750,12 +1072,8 @@ Node *unary()
         expect('(');
         Node *n = unary();
         expect(')');
-        if (!n->type || n->type->ty == INT)
-        {
-            return new_node_num(4);
-        }
-        // pointer
-        return new_node_num(8);
+        add_type(n);
+        return new_node_num(size_of(n->type));
     }
 
     return primary();
@@ -10,6 +10,8 @@ LVar *find_lvar(Token *tok);
 GVar *find_gvar(Token *tok);
 void enter_scope(void);
 void leave_scope(void);
+Node *new_add(Node *l, Node *r);
+Node *new_sub(Node *l, Node *r);
 Node *expr(void);
 Node *declare_lvar2();
 bool is_lvar_decl(void);
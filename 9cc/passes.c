@@ -0,0 +1,236 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "passes.h"
+#include "optimize.h"
+#include "ir.h"
+
+/*
+ * Pass manager
+ *
+ * Passes are registered by name. A pipeline is a list of names, either the
+ * one for an optimization level or one given with --passes=, and a pass may
+ * appear in it more than once. Passes over the AST run in order after
+ * program(); passes over the assembly run on the code of each function after
+ * it is generated (see parallel.c), in their order in the pipeline.
+ *
+ * The wall time of each run and the size of the program after it (AST nodes
+ * or assembly lines) are recorded for --time-passes. The times and sizes of a
+ * pass over the assembly are summed over the functions.
+ */
+
+static void verify_all_ir(void);
+
+typedef struct
+{
+    char *name;
+    void (*run)(void);            // a pass over the AST
+    void (*run_asm)(Inst *head); // a pass over the assembly
+} Pass;
+
+static Pass registry[] = {
+    {"prune", prune_unreachable},
+    {"inline", inline_functions},
+    {"fold", fold_constants},
+    {"evaluate", evaluate_pure_calls},
+    {"constprop", propagate_constants},
+    {"simplify", simplify_cfg},
+    {"vectorize", vectorize_loops},
+    {"unroll", unroll_loops},
+    {"licm", hoist_loop_invariants},
+    {"strength", reduce_strength},
+    {"cse", eliminate_common_subexpressions},
+    {"dse", eliminate_dead_stores},
+    {"tailcall", mark_tail_calls},
+    {"verify-ir", verify_all_ir},
+    {"peephole", NULL, peephole},
+};
+
+#define NPASSES (int)(sizeof(registry) / sizeof(registry[0]))
+
+static char *pipeline_o1[] = {
+    "prune", "fold", "evaluate", "constprop", "simplify", "cse", "dse", "tailcall", "peephole", NULL,
+};
+
+static char *pipeline_o2[] = {
+    "prune", "inline", "fold", "evaluate", "prune", "constprop", "simplify",
+    "vectorize", "unroll",
+    // 展開した本体の中の定数を畳み込む
+    "constprop", "simplify",
+    "licm", "strength", "cse", "dse", "tailcall", "peephole", NULL,
+};
+
+typedef struct
+{
+    Pass *pass;
+    double ms;
+    int size;
+    bool ran;
+} Run;
+
+static Run pipeline[64];
+static int npipeline;
+static bool selected;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Pass *find_pass(char *name, int len)
+{
+    for (int i = 0; i < NPASSES; i++)
+    {
+        if (strlen(registry[i].name) == len && strncmp(registry[i].name, name, len) == 0)
+        {
+            return &registry[i];
+        }
+    }
+    fprintf(stderr, "passes:");
+    for (int i = 0; i < NPASSES; i++)
+    {
+        fprintf(stderr, " %s", registry[i].name);
+    }
+    fprintf(stderr, "\n");
+    error("不明なパスです: %.*s", len, name);
+    return NULL;
+}
+
+static void add_pass(char *name, int len)
+{
+    if (npipeline == 64)
+    {
+        error("パスが多すぎます");
+    }
+    pipeline[npipeline++] = (Run){find_pass(name, len)};
+}
+
+void select_opt_level(int level)
+{
+    npipeline = 0;
+    selected = true;
+    char **names = level >= 2 ? pipeline_o2 : level == 1 ? pipeline_o1 : NULL;
+    for (int i = 0; names && names[i]; i++)
+    {
+        add_pass(names[i], strlen(names[i]));
+    }
+}
+
+// list is a comma-separated list of pass names.
+void select_passes(char *list)
+{
+    npipeline = 0;
+    selected = true;
+    char *p = list;
+    while (*p)
+    {
+        char *end = strchr(p, ',');
+        int len = end ? end - p : strlen(p);
+        if (len > 0)
+        {
+            add_pass(p, len);
+        }
+        p += len + (end != NULL);
+    }
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void count_node(Node *node, void *ctx)
+{
+    (*(int *)ctx)++;
+}
+
+static int ast_size(void)
+{
+    int n = 0;
+    for (int i = 0; text[i]; i++)
+    {
+        visit(text[i], count_node, &n);
+    }
+    return n;
+}
+
+static int asm_size(Inst *head)
+{
+    int n = 0;
+    for (Inst *i = head->next; i; i = i->next)
+    {
+        n++;
+    }
+    return n;
+}
+
+// Builds the SSA form of every function and checks it.
+static void verify_all_ir(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        verify_ir(build_ir(text[i]));
+    }
+}
+
+void run_ast_passes(bool use_ir)
+{
+    if (!selected)
+    {
+        select_opt_level(2);
+    }
+    for (int i = 0; i < npipeline; i++)
+    {
+        Run *r = &pipeline[i];
+        // SSA形式にはベクトル命令がない
+        if (!r->pass->run || (use_ir && r->pass->run == vectorize_loops))
+        {
+            continue;
+        }
+        double start = now_ms();
+        r->pass->run();
+        r->ms = now_ms() - start;
+        r->size = ast_size();
+        r->ran = true;
+    }
+}
+
+void run_asm_passes(Inst *head)
+{
+    for (int i = 0; i < npipeline; i++)
+    {
+        Run *r = &pipeline[i];
+        if (!r->pass->run_asm)
+        {
+            continue;
+        }
+        double start = now_ms();
+        r->pass->run_asm(head);
+        double ms = now_ms() - start;
+        int size = asm_size(head);
+        // 関数ごとのコードについて複数のスレッドから呼ばれるので足し合わせる
+        pthread_mutex_lock(&stats_lock);
+        r->ms += ms;
+        r->size += size;
+        r->ran = true;
+        pthread_mutex_unlock(&stats_lock);
+    }
+}
+
+void print_pass_stats(void)
+{
+    double total = 0;
+    fprintf(stderr, "%-12s %10s %8s\n", "pass", "time(ms)", "size");
+    for (int i = 0; i < npipeline; i++)
+    {
+        Run *r = &pipeline[i];
+        if (!r->ran)
+        {
+            continue;
+        }
+        fprintf(stderr, "%-12s %10.3f %8d %s\n", r->pass->name, r->ms, r->size, r->pass->run ? "nodes" : "lines");
+        total += r->ms;
+    }
+    fprintf(stderr, "%-12s %10.3f\n", "total", total);
+}
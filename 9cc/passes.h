@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include "codegen.h"
+
+// Pass manager: runs the optimization passes selected by -O or --passes=.
+void select_opt_level(int level);
+void select_passes(char *list);
+void run_ast_passes(bool use_ir);
+void run_asm_passes(Inst *head);
+void print_pass_stats(void);
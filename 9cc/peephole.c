@@ -0,0 +1,768 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "codegen.h"
+
+/*
+ * Peephole optimizer
+ *
+ * gen() is a stack machine, so most of the rewrites here remove a push and
+ * its matching pop and pass the value through a register instead.
+ *
+ * The liveness scan relies on an invariant of the code generator: no value
+ * is kept in a register across a ".L" label or a jump to one. Function
+ * labels, calls and ret are treated conservatively.
+ */
+
+typedef struct
+{
+    char op[16];
+    char arg[2][128];
+    int nargs;
+} Insn;
+
+typedef enum
+{
+    LINE_INSN,
+    LINE_LABEL,
+    LINE_COMMENT,
+    LINE_DIRECTIVE,
+} LineKind;
+
+static const char *regs[][4] = {
+    {"rax", "eax", "ax", "al"},
+    {"rbx", "ebx", "bx", "bl"},
+    {"rcx", "ecx", "cx", "cl"},
+    {"rdx", "edx", "dx", "dl"},
+    {"rsi", "esi", "si", "sil"},
+    {"rdi", "edi", "di", "dil"},
+    {"rbp", "ebp", "bp", "bpl"},
+    {"rsp", "esp", "sp", "spl"},
+    {"r8", "r8d", "r8w", "r8b"},
+    {"r9", "r9d", "r9w", "r9b"},
+    {"r10", "r10d", "r10w", "r10b"},
+    {"r11", "r11d", "r11w", "r11b"},
+    {"r12", "r12d", "r12w", "r12b"},
+    {"r13", "r13d", "r13w", "r13b"},
+    {"r14", "r14d", "r14w", "r14b"},
+    {"r15", "r15d", "r15w", "r15b"},
+};
+
+enum
+{
+    RAX,
+    RBX,
+    RCX,
+    RDX,
+    RSI,
+    RDI,
+    RBP,
+    RSP,
+};
+
+#define NREGS (int)(sizeof(regs) / sizeof(regs[0]))
+
+// Returns the register family of name, or -1. width is set to 0 for the
+// 64-bit name, 1 for the 32-bit name and so on.
+static int reg_family(char *name, int len, int *width)
+{
+    for (int f = 0; f < NREGS; f++)
+    {
+        for (int w = 0; w < 4; w++)
+        {
+            if (strlen(regs[f][w]) == len && strncmp(regs[f][w], name, len) == 0)
+            {
+                if (width)
+                {
+                    *width = w;
+                }
+                return f;
+            }
+        }
+    }
+    return -1;
+}
+
+// Register family of an operand which is a plain register, or -1.
+static int reg_of(char *operand, int *width)
+{
+    return reg_family(operand, strlen(operand), width);
+}
+
+static bool mentions(char *operand, int fam)
+{
+    char *p = operand;
+    while (*p)
+    {
+        if (!isalnum(*p))
+        {
+            p++;
+            continue;
+        }
+        char *q = p;
+        while (isalnum(*q))
+        {
+            q++;
+        }
+        if (reg_family(p, q - p, NULL) == fam)
+        {
+            return true;
+        }
+        p = q;
+    }
+    return false;
+}
+
+static bool is_memory(char *operand)
+{
+    return strchr(operand, '[') != NULL;
+}
+
+static LineKind parse(Inst *i, Insn *insn)
+{
+    char *p = i->text;
+    while (isspace(*p))
+    {
+        p++;
+    }
+    if (*p == '#' || *p == '\0')
+    {
+        return LINE_COMMENT;
+    }
+    if (p[strlen(p) - 1] == ':')
+    {
+        return LINE_LABEL;
+    }
+    if (*p == '.')
+    {
+        return LINE_DIRECTIVE;
+    }
+
+    memset(insn, 0, sizeof(Insn));
+    int n = 0;
+    while (*p && !isspace(*p) && n < (int)sizeof(insn->op) - 1)
+    {
+        insn->op[n++] = *p++;
+    }
+    while (isspace(*p))
+    {
+        p++;
+    }
+    while (*p && insn->nargs < 2)
+    {
+        char *comma = strchr(p, ',');
+        int len = comma ? comma - p : strlen(p);
+        snprintf(insn->arg[insn->nargs++], sizeof(insn->arg[0]), "%.*s", len, p);
+        if (!comma)
+        {
+            break;
+        }
+        p = comma + 1;
+        while (isspace(*p))
+        {
+            p++;
+        }
+    }
+    return LINE_INSN;
+}
+
+// Instructions which write their first operand without reading it.
+static bool is_move(char *op)
+{
+    return !strcmp(op, "mov") || !strcmp(op, "movsx") || !strcmp(op, "movsxd") ||
+           !strcmp(op, "movzx") || !strcmp(op, "movzb") || !strcmp(op, "lea");
+}
+
+static bool is_jump(char *op)
+{
+    return op[0] == 'j';
+}
+
+static bool is_barrier(char *op)
+{
+    return is_jump(op) || !strcmp(op, "call") || !strcmp(op, "ret");
+}
+
+// rep movs copies rcx elements from [rsi] to [rdi] and advances all three.
+static bool is_string_move(Insn *in)
+{
+    return !strcmp(in->op, "rep");
+}
+
+// Instructions which implicitly use rdx:rax.
+static bool is_wide(Insn *in)
+{
+    return !strcmp(in->op, "idiv") || !strcmp(in->op, "div") ||
+           ((!strcmp(in->op, "imul") || !strcmp(in->op, "mul")) && in->nargs == 1);
+}
+
+static bool reads(Insn *in, int fam)
+{
+    if (is_move(in->op))
+    {
+        return mentions(in->arg[1], fam) || (is_memory(in->arg[0]) && mentions(in->arg[0], fam));
+    }
+    if (!strcmp(in->op, "pop"))
+    {
+        return is_memory(in->arg[0]) && mentions(in->arg[0], fam);
+    }
+    if (!strcmp(in->op, "cqo"))
+    {
+        return fam == RAX;
+    }
+    if (is_string_move(in))
+    {
+        return fam == RCX || fam == RSI || fam == RDI;
+    }
+    if (is_wide(in))
+    {
+        return fam == RAX || fam == RDX || mentions(in->arg[0], fam);
+    }
+    for (int k = 0; k < in->nargs; k++)
+    {
+        if (mentions(in->arg[k], fam))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the instruction replaces the whole 64-bit register. Writes to a
+// 32-bit register zero the upper half, so they count as well.
+static bool kills(Insn *in, int fam)
+{
+    int width;
+    if (is_move(in->op) || !strcmp(in->op, "pop"))
+    {
+        return reg_of(in->arg[0], &width) == fam && width <= 1;
+    }
+    if (!strcmp(in->op, "cqo"))
+    {
+        return fam == RDX;
+    }
+    return false;
+}
+
+static bool writes(Insn *in, int fam)
+{
+    if (!strcmp(in->op, "cmp") || !strcmp(in->op, "test") || !strcmp(in->op, "push"))
+    {
+        return false;
+    }
+    if (!strcmp(in->op, "cqo"))
+    {
+        return fam == RDX;
+    }
+    if (is_wide(in))
+    {
+        return fam == RAX || fam == RDX;
+    }
+    if (is_string_move(in))
+    {
+        return fam == RCX || fam == RSI || fam == RDI;
+    }
+    return in->nargs > 0 && reg_of(in->arg[0], NULL) == fam;
+}
+
+static Inst *next_line(Inst *i)
+{
+    Insn in;
+    for (i = i->next; i; i = i->next)
+    {
+        if (parse(i, &in) != LINE_COMMENT)
+        {
+            return i;
+        }
+    }
+    return NULL;
+}
+
+// Whether the value of fam is never read after i.
+static bool is_dead(Inst *i, int fam)
+{
+    if (fam == RSP || fam == RBP)
+    {
+        return false;
+    }
+    Insn in;
+    for (i = i->next; i; i = i->next)
+    {
+        LineKind k = parse(i, &in);
+        if (k == LINE_COMMENT)
+        {
+            continue;
+        }
+        if (k == LINE_LABEL)
+        {
+            return strncmp(i->text, ".L", 2) == 0;
+        }
+        if (k == LINE_DIRECTIVE)
+        {
+            return false;
+        }
+        if (is_jump(in.op))
+        {
+            return strncmp(in.arg[0], ".L", 2) == 0;
+        }
+        if (!strcmp(in.op, "ret"))
+        {
+            return fam != RAX;
+        }
+        if (!strcmp(in.op, "call"))
+        {
+            return false;
+        }
+        if (reads(&in, fam))
+        {
+            return false;
+        }
+        if (kills(&in, fam))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The removed line keeps its next pointer so that a loop over the list can
+// step past it. prev is cleared to mark it as removed.
+static void remove_line(Inst *i)
+{
+    i->prev->next = i->next;
+    if (i->next)
+    {
+        i->next->prev = i->prev;
+    }
+    i->prev = NULL;
+}
+
+static void set_text(Inst *i, char *fmt, char *a, char *b)
+{
+    int len = snprintf(NULL, 0, fmt, a, b);
+    i->text = malloc(len + 1);
+    snprintf(i->text, len + 1, fmt, a, b);
+}
+
+static bool is_imm(char *operand)
+{
+    char *p = operand;
+    if (*p == '-')
+    {
+        p++;
+    }
+    if (!isdigit(*p))
+    {
+        return false;
+    }
+    while (isdigit(*p))
+    {
+        p++;
+    }
+    return *p == '\0';
+}
+
+// push A; ...; pop B  =>  ...; mov B, A
+// The instructions in between must not touch the stack or change A.
+static bool fold_push_pop(Inst *push, Insn *in)
+{
+    char *a = in->arg[0];
+    int fa = reg_of(a, NULL);
+    if (fa < 0 && !is_imm(a))
+    {
+        return false;
+    }
+
+    Insn m;
+    for (Inst *j = next_line(push); j; j = next_line(j))
+    {
+        if (parse(j, &m) != LINE_INSN || is_barrier(m.op))
+        {
+            return false;
+        }
+        if (!strcmp(m.op, "pop"))
+        {
+            if (is_memory(m.arg[0]))
+            {
+                return false;
+            }
+            if (!strcmp(m.arg[0], a))
+            {
+                remove_line(j);
+            }
+            else
+            {
+                set_text(j, "    mov %s, %s", m.arg[0], a);
+            }
+            remove_line(push);
+            return true;
+        }
+        if (!strcmp(m.op, "push") || mentions(j->text, RSP))
+        {
+            return false;
+        }
+        if (fa >= 0 && writes(&m, fa))
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Removes a move whose result is never used.
+static bool remove_dead_move(Inst *i, Insn *in)
+{
+    int fam = reg_of(in->arg[0], NULL);
+    if (!is_move(in->op) || fam < 0)
+    {
+        return false;
+    }
+    if (!strcmp(in->op, "mov") && !strcmp(in->arg[0], in->arg[1]))
+    {
+        remove_line(i);
+        return true;
+    }
+    if (is_dead(i, fam))
+    {
+        remove_line(i);
+        return true;
+    }
+    return false;
+}
+
+// op R1, X; mov R2, R1  =>  op R2, X   (if R1 is dead)
+static bool forward_move(Inst *i, Insn *in)
+{
+    int w1;
+    int f1 = reg_of(in->arg[0], &w1);
+    if (!is_move(in->op) || f1 < 0 || w1 != 0)
+    {
+        return false;
+    }
+    Inst *j = next_line(i);
+    Insn m;
+    if (!j || parse(j, &m) != LINE_INSN || strcmp(m.op, "mov"))
+    {
+        return false;
+    }
+    int w2;
+    int f2 = reg_of(m.arg[0], &w2);
+    if (f2 < 0 || w2 != 0 || f2 == f1 || strcmp(m.arg[1], in->arg[0]) || f2 == RSP || f2 == RBP)
+    {
+        return false;
+    }
+    if (!is_dead(j, f1))
+    {
+        return false;
+    }
+    set_text(i, "    %s %s, ", in->op, m.arg[0]);
+    set_text(i, "%s%s", i->text, in->arg[1]);
+    remove_line(j);
+    return true;
+}
+
+static char *sized_imm(char *operand, char *imm)
+{
+    char *b = malloc(32);
+    long v = strtol(imm, NULL, 10);
+    if (strncmp(operand, "BYTE", 4) == 0)
+    {
+        sprintf(b, "%d", (signed char)v);
+    }
+    else if (strncmp(operand, "WORD", 4) == 0)
+    {
+        sprintf(b, "%d", (short)v);
+    }
+    else
+    {
+        sprintf(b, "%d", (int)v);
+    }
+    return b;
+}
+
+// mov R, imm; op X, R  =>  op X, imm   (if R is dead)
+static bool fold_imm(Inst *i, Insn *in)
+{
+    int fam = reg_of(in->arg[0], NULL);
+    if (strcmp(in->op, "mov") || fam < 0 || !is_imm(in->arg[1]))
+    {
+        return false;
+    }
+    long v = strtol(in->arg[1], NULL, 10);
+    if (v < -2147483648L || v > 2147483647L)
+    {
+        return false;
+    }
+
+    Inst *j = next_line(i);
+    Insn m;
+    if (!j || parse(j, &m) != LINE_INSN || m.nargs != 2 || reg_of(m.arg[1], NULL) != fam || mentions(m.arg[0], fam))
+    {
+        return false;
+    }
+    if (!is_dead(j, fam))
+    {
+        return false;
+    }
+
+    char *op = m.op;
+    if (!strcmp(op, "mov") && is_memory(m.arg[0]))
+    {
+        // 64bitのストアはサイズを明示する
+        char *dst = m.arg[0];
+        if (strstr(dst, "PTR") == NULL)
+        {
+            set_text(j, "    mov QWORD PTR %s, %s", dst, in->arg[1]);
+        }
+        else
+        {
+            set_text(j, "    mov %s, %s", dst, sized_imm(dst, in->arg[1]));
+        }
+        remove_line(i);
+        return true;
+    }
+    if (is_memory(m.arg[0]))
+    {
+        return false;
+    }
+    if (strcmp(op, "add") && strcmp(op, "sub") && strcmp(op, "cmp") && strcmp(op, "imul") &&
+        strcmp(op, "and") && strcmp(op, "or") && strcmp(op, "xor") && strcmp(op, "mov"))
+    {
+        return false;
+    }
+    set_text(j, "    %s %s, ", op, m.arg[0]);
+    set_text(j, "%s%s", j->text, in->arg[1]);
+    remove_line(i);
+    return true;
+}
+
+// lea R, M; op X, [R]  =>  op X, M   (if R is dead or overwritten by op)
+static bool fold_lea(Inst *i, Insn *in)
+{
+    int w;
+    int fam = reg_of(in->arg[0], &w);
+    if (strcmp(in->op, "lea") || fam < 0 || w != 0)
+    {
+        return false;
+    }
+    Inst *j = next_line(i);
+    Insn m;
+    if (!j || parse(j, &m) != LINE_INSN || is_barrier(m.op) || !strcmp(m.op, "push") || !strcmp(m.op, "pop"))
+    {
+        return false;
+    }
+
+    char pat[16];
+    sprintf(pat, "[%s]", in->arg[0]);
+    int k = -1;
+    for (int n = 0; n < m.nargs; n++)
+    {
+        char *p = strstr(m.arg[n], pat);
+        if (p && !strcmp(p, pat))
+        {
+            k = n;
+        }
+    }
+    if (k < 0)
+    {
+        return false;
+    }
+
+    // M を差し込んだ後にRを参照するのは書き込み先としてだけ
+    char operand[256];
+    int prefix = strlen(m.arg[k]) - strlen(pat);
+    snprintf(operand, sizeof(operand), "%.*s%s", prefix, m.arg[k], in->arg[1]);
+    for (int n = 0; n < m.nargs; n++)
+    {
+        if (n != k && mentions(m.arg[n], fam) && !(n == 0 && is_move(m.op) && kills(&m, fam)))
+        {
+            return false;
+        }
+    }
+    if (!(is_move(m.op) && kills(&m, fam)) && !is_dead(j, fam))
+    {
+        return false;
+    }
+
+    if (m.nargs == 1)
+    {
+        set_text(j, "    %s %s", m.op, operand);
+    }
+    else if (k == 0)
+    {
+        set_text(j, "    %s %s, ", m.op, operand);
+        set_text(j, "%s%s", j->text, m.arg[1]);
+    }
+    else
+    {
+        set_text(j, "    %s %s, ", m.op, m.arg[0]);
+        set_text(j, "%s%s", j->text, operand);
+    }
+    remove_line(i);
+    return true;
+}
+
+// Labels never get removed, so they are looked up in a table built once.
+typedef struct
+{
+    Inst **line;
+    int cap;
+} Labels;
+
+static unsigned hash(char *s, int len)
+{
+    unsigned h = 2166136261u;
+    for (int i = 0; i < len; i++)
+    {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void add_label(Labels *t, Inst *i)
+{
+    int len = strlen(i->text) - 1;
+    unsigned h = hash(i->text, len) & (t->cap - 1);
+    while (t->line[h])
+    {
+        h = (h + 1) & (t->cap - 1);
+    }
+    t->line[h] = i;
+}
+
+static Inst *find_label(Labels *t, char *name)
+{
+    int len = strlen(name);
+    unsigned h = hash(name, len) & (t->cap - 1);
+    for (; t->line[h]; h = (h + 1) & (t->cap - 1))
+    {
+        char *text = t->line[h]->text;
+        if (strlen(text) == len + 1 && !strncmp(text, name, len))
+        {
+            return t->line[h];
+        }
+    }
+    return NULL;
+}
+
+static Labels *label_table(Inst *head)
+{
+    int n = 0;
+    Insn in;
+    for (Inst *i = head->next; i; i = i->next)
+    {
+        if (parse(i, &in) == LINE_LABEL)
+        {
+            n++;
+        }
+    }
+    Labels *t = calloc(1, sizeof(Labels));
+    t->cap = 16;
+    while (t->cap < n * 2)
+    {
+        t->cap *= 2;
+    }
+    t->line = calloc(t->cap, sizeof(Inst *));
+    for (Inst *i = head->next; i; i = i->next)
+    {
+        if (parse(i, &in) == LINE_LABEL)
+        {
+            add_label(t, i);
+        }
+    }
+    return t;
+}
+
+// jmp/jcc L1 where L1 is followed by jmp L2  =>  jmp/jcc L2
+static bool thread_jump(Inst *i, Insn *in, Labels *labels)
+{
+    if (!is_jump(in->op) || strncmp(in->arg[0], ".L", 2))
+    {
+        return false;
+    }
+    Inst *target = find_label(labels, in->arg[0]);
+    Insn m;
+    Inst *j = target;
+    while (j && parse(j, &m) == LINE_LABEL)
+    {
+        j = next_line(j);
+    }
+    if (!j || parse(j, &m) != LINE_INSN || strcmp(m.op, "jmp") || !strcmp(m.arg[0], in->arg[0]) ||
+        strncmp(m.arg[0], ".L", 2))
+    {
+        return false;
+    }
+    set_text(i, "    %s %s", in->op, m.arg[0]);
+    return true;
+}
+
+// Removes instructions after jmp or ret up to the next label.
+static bool remove_unreachable(Inst *i, Insn *in)
+{
+    if (strcmp(in->op, "jmp") && strcmp(in->op, "ret"))
+    {
+        return false;
+    }
+    bool changed = false;
+    Insn m;
+    for (Inst *j = next_line(i); j && parse(j, &m) == LINE_INSN; j = next_line(j))
+    {
+        remove_line(j);
+        changed = true;
+    }
+    return changed;
+}
+
+// jmp .L1; .L1:  =>  .L1:
+static bool remove_jump_to_next(Inst *i, Insn *in)
+{
+    if (strcmp(in->op, "jmp"))
+    {
+        return false;
+    }
+    Insn m;
+    for (Inst *j = next_line(i); j && parse(j, &m) == LINE_LABEL; j = next_line(j))
+    {
+        char *p = j->text;
+        if (strlen(p) == strlen(in->arg[0]) + 1 && !strncmp(p, in->arg[0], strlen(in->arg[0])))
+        {
+            remove_line(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void peephole(Inst *head)
+{
+    Labels *labels = label_table(head);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        Inst *next;
+        for (Inst *i = head->next; i; i = next)
+        {
+            next = i->next;
+            Insn in;
+            if (!i->prev || parse(i, &in) != LINE_INSN)
+            {
+                continue;
+            }
+
+            if ((!strcmp(in.op, "push") && fold_push_pop(i, &in)) ||
+                remove_dead_move(i, &in) ||
+                forward_move(i, &in) ||
+                fold_imm(i, &in) ||
+                fold_lea(i, &in) ||
+                remove_jump_to_next(i, &in) ||
+                thread_jump(i, &in, labels) ||
+                remove_unreachable(i, &in))
+            {
+                changed = true;
+            }
+        }
+    }
+}
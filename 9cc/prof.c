@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Runtime of --profile-functions
+ *
+ * Every function of a program compiled with --profile-functions calls
+ * __9cc_prof_enter when it starts and __9cc_prof_leave before it returns,
+ * with a record of its own made by the compiler. Link this file with the
+ * program to get a flat profile on stderr when it exits:
+ *
+ *     self:  cycles spent in the function, without the functions it calls
+ *     total: cycles from the outermost entry to the matching return, so a
+ *            recursive function is not counted twice
+ *
+ * Cycles are read with rdtsc, so they include the time of the hooks.
+ */
+
+typedef struct FuncProfile FuncProfile;
+struct FuncProfile
+{
+    char *name; // set by the compiler, the rest starts at 0
+    FuncProfile *next;
+    long calls;
+    unsigned long self;
+    unsigned long total;
+    long depth;
+    unsigned long entered;
+};
+
+typedef struct
+{
+    FuncProfile *f;
+    unsigned long resumed; // when the function last started running itself
+} Frame;
+
+// next is not NULL once a record is in the list, so the list ends with a
+// record of its own
+static FuncProfile last;
+static FuncProfile *funcs = &last;
+static Frame *frames;
+static int nframes;
+static int cap;
+
+static unsigned long rdtsc(void)
+{
+    unsigned lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (unsigned long)hi << 32 | lo;
+}
+
+static int by_self(const void *a, const void *b)
+{
+    unsigned long x = (*(FuncProfile **)a)->self;
+    unsigned long y = (*(FuncProfile **)b)->self;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_profile(void)
+{
+    // exit()が関数の中で呼ばれたときはまだ戻っていない関数がある
+    unsigned long now = rdtsc();
+    if (nframes > 0)
+    {
+        frames[nframes - 1].f->self += now - frames[nframes - 1].resumed;
+    }
+    int n = 0;
+    unsigned long sum = 0;
+    for (FuncProfile *f = funcs; f != &last; f = f->next)
+    {
+        if (f->depth > 0)
+        {
+            f->total += now - f->entered;
+        }
+        sum += f->self;
+        n++;
+    }
+    FuncProfile **sorted = malloc(n * sizeof(FuncProfile *));
+    n = 0;
+    for (FuncProfile *f = funcs; f != &last; f = f->next)
+    {
+        sorted[n++] = f;
+    }
+    qsort(sorted, n, sizeof(FuncProfile *), by_self);
+
+    fprintf(stderr, "Flat profile (cycles):\n");
+    fprintf(stderr, "%7s %14s %14s %10s %12s %12s  %s\n", "%time", "self", "total", "calls", "self/call", "total/call", "name");
+    for (int i = 0; i < n; i++)
+    {
+        FuncProfile *f = sorted[i];
+        fprintf(stderr, "%7.2f %14lu %14lu %10ld %12lu %12lu  %s\n",
+                sum ? 100.0 * f->self / sum : 0.0, f->self, f->total, f->calls,
+                f->self / f->calls, f->total / f->calls, f->name);
+    }
+    free(sorted);
+}
+
+void __9cc_prof_enter(FuncProfile *f)
+{
+    unsigned long now = rdtsc();
+    if (!f->next)
+    {
+        if (funcs == &last)
+        {
+            atexit(print_profile);
+        }
+        f->next = funcs;
+        funcs = f;
+    }
+    if (nframes > 0)
+    {
+        frames[nframes - 1].f->self += now - frames[nframes - 1].resumed;
+    }
+    if (nframes == cap)
+    {
+        cap = cap ? cap * 2 : 64;
+        frames = realloc(frames, cap * sizeof(Frame));
+    }
+    frames[nframes++] = (Frame){f, now};
+    f->calls++;
+    if (f->depth++ == 0)
+    {
+        f->entered = now;
+    }
+}
+
+void __9cc_prof_leave(FuncProfile *f)
+{
+    unsigned long now = rdtsc();
+    if (nframes == 0 || frames[nframes - 1].f != f)
+    {
+        return;
+    }
+    f->self += now - frames[--nframes].resumed;
+    if (--f->depth == 0)
+    {
+        f->total += now - f->entered;
+    }
+    if (nframes > 0)
+    {
+        frames[nframes - 1].resumed = now;
+    }
+}
@@ -0,0 +1,239 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+#include "codegen.h"
+#include "optimize.h"
+
+/*
+ * Profile-guided optimization
+ *
+ * The branches and calls of the program are numbered as sites in source
+ * order before any pass runs, so the numbers depend only on the source.
+ * Copies of a node made by the passes keep its site and share its counters.
+ * Each site has two counters:
+ *
+ *     if:           then taken, else taken (also when there is no else)
+ *     while, for:   body entered, loop left
+ *     call:         calls
+ *
+ * With --instrument-branches gen() increments the counters, and a function
+ * run from .fini_array when the program exits writes them to a file:
+ *
+ *     9cc-profile <hash of the source> <number of counters>
+ *     <counter> <count>
+ *     ...
+ *
+ * Only the counters which are in the generated code are written. A site
+ * which the passes removed, such as an inlined call, is unknown to the
+ * profile rather than cold, and the passes make the same decision for it
+ * when the profile is used.
+ *
+ * --profile-use= reads such a file back. A profile of a different source
+ * is ignored with a warning, because its sites would not match.
+ */
+
+char *instrument_path;
+
+static unsigned long source_hash;
+static int nsites;
+static long *counts;
+static long hottest;
+// Set by gen_counter(), which may run on several threads (see parallel.c)
+static atomic_bool *emitted;
+
+static void number_site(Node *node, void *ctx)
+{
+    switch (node->kind)
+    {
+    case ND_IF:
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_FUNCALL:
+        node->site = ++nsites;
+        return;
+    }
+}
+
+void number_sites(char *source)
+{
+    // FNV-1a
+    source_hash = 14695981039346656037UL;
+    for (char *p = source; *p; p++)
+    {
+        source_hash = (source_hash ^ (unsigned char)*p) * 1099511628211UL;
+    }
+    for (int i = 0; text[i]; i++)
+    {
+        visit(text[i], number_site, NULL);
+    }
+    emitted = calloc(2 * nsites + 1, sizeof(atomic_bool));
+}
+
+void read_profile(char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        error("cannot open %s", path);
+    }
+    unsigned long hash;
+    int n;
+    if (fscanf(fp, "9cc-profile %lu %d", &hash, &n) != 2 || hash != source_hash || n != 2 * nsites)
+    {
+        fprintf(stderr, "warning: %s is not a profile of this program; ignored\n", path);
+        fclose(fp);
+        return;
+    }
+    counts = calloc(n + 1, sizeof(long));
+    for (int i = 0; i < n; i++)
+    {
+        counts[i] = -1;
+    }
+    int i;
+    long c;
+    while (fscanf(fp, "%d %ld", &i, &c) == 2)
+    {
+        if (0 <= i && i < n)
+        {
+            counts[i] = c;
+            hottest = c > hottest ? c : hottest;
+        }
+    }
+    fclose(fp);
+}
+
+// The count of a counter of the site of node, or -1 if it is not known.
+long profile_count(Node *node, int slot)
+{
+    if (!counts || node->site <= 0 || node->site > nsites)
+    {
+        return -1;
+    }
+    return counts[2 * (node->site - 1) + slot];
+}
+
+// Whether the site runs at least a tenth as often as the hottest one.
+bool is_hot(Node *node)
+{
+    long c = profile_count(node, 0);
+    return c > 0 && c * 10 >= hottest;
+}
+
+// Whether the site never ran.
+bool is_cold(Node *node)
+{
+    return profile_count(node, 0) == 0 && profile_count(node, 1) == 0;
+}
+
+// Code generation for --instrument-branches
+
+void gen_counter(Node *node, int slot)
+{
+    if (instrument_path && node->site)
+    {
+        emitted[2 * (node->site - 1) + slot] = true;
+        emit("    inc QWORD PTR [rip + __9cc_prof_counts + %d]", (2 * (node->site - 1) + slot) * 8);
+    }
+}
+
+// Escapes s for a .string directive.
+static char *quote(char *s)
+{
+    char *buf = calloc(strlen(s) * 4 + 1, 1);
+    char *p = buf;
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+        {
+            *p++ = '\\';
+            *p++ = c;
+        }
+        else if (c < ' ' || c == 0x7f)
+        {
+            // 制御文字は8進数で書く
+            p += sprintf(p, "\\%03o", c);
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+    return buf;
+}
+
+// Emitted after the code. The counters which are not in the code start at
+// -1 and are not written to the profile.
+void emit_profile_dump(void)
+{
+    if (!instrument_path)
+    {
+        return;
+    }
+    emit(".section .data");
+    emit("    .align 8");
+    emit("__9cc_prof_counts:");
+    for (int i = 0; i < 2 * nsites; i++)
+    {
+        emit("    .quad %d", emitted[i] ? 0 : -1);
+    }
+
+    emit(".section .rodata");
+    emit(".Lprof_path:");
+    emit("    .string \"%s\"", quote(instrument_path));
+    emit(".Lprof_mode:");
+    emit("    .string \"w\"");
+    emit(".Lprof_header:");
+    emit("    .string \"9cc-profile %lu %d\\n\"", source_hash, 2 * nsites);
+    emit(".Lprof_line:");
+    emit("    .string \"%%ld %%ld\\n\"");
+
+    // ループの変数は.Lラベルをまたぐのでフレームに置く
+    emit(".section .text");
+    emit("    .type __9cc_prof_dump, @function");
+    emit("__9cc_prof_dump:");
+    emit("    push rbp");
+    emit("    mov rbp, rsp");
+    emit("    sub rsp, 16");
+    emit("    lea rdi, [rip + .Lprof_path]");
+    emit("    lea rsi, [rip + .Lprof_mode]");
+    emit("    call fopen");
+    emit("    mov [rbp - 8], rax");
+    emit("    cmp rax, 0");
+    emit("    je .Lprof_end");
+    emit("    lea rdi, [rip + .Lprof_header]");
+    emit("    mov rsi, [rbp - 8]");
+    emit("    call fputs");
+    emit("    mov QWORD PTR [rbp - 16], 0");
+    emit(".Lprof_loop:");
+    emit("    mov rax, [rbp - 16]");
+    emit("    cmp rax, %d", 2 * nsites);
+    emit("    jge .Lprof_close");
+    emit("    lea rcx, [rip + __9cc_prof_counts]");
+    emit("    mov rcx, [rcx + rax*8]");
+    emit("    cmp rcx, 0");
+    emit("    jl .Lprof_next");
+    emit("    mov rdi, [rbp - 8]");
+    emit("    lea rsi, [rip + .Lprof_line]");
+    emit("    mov rdx, rax");
+    emit("    mov eax, 0");
+    emit("    call fprintf");
+    emit(".Lprof_next:");
+    emit("    add QWORD PTR [rbp - 16], 1");
+    emit("    jmp .Lprof_loop");
+    emit(".Lprof_close:");
+    emit("    mov rdi, [rbp - 8]");
+    emit("    call fclose");
+    emit(".Lprof_end:");
+    emit("    mov rsp, rbp");
+    emit("    pop rbp");
+    emit("    ret");
+    emit("    .size __9cc_prof_dump, .-__9cc_prof_dump");
+
+    // exit()の後に呼ばれる
+    emit(".section .fini_array,\"aw\"");
+    emit("    .align 8");
+    emit("    .quad __9cc_prof_dump");
+}
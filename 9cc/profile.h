@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include "9cc.h"
+
+// Profile-guided optimization: counters on branches and calls.
+
+// The file the instrumented program writes its counters to, or NULL.
+extern char *instrument_path;
+
+void number_sites(char *source);
+void read_profile(char *path);
+long profile_count(Node *node, int slot);
+bool is_hot(Node *node);
+bool is_cold(Node *node);
+
+void gen_counter(Node *node, int slot);
+void emit_profile_dump(void);
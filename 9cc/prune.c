@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Whole-program dead function and global elimination
+ *
+ * Only main is visible outside of the generated object, so every function,
+ * global variable and string literal which cannot be reached from main is
+ * dropped from text[], data[] and data_string_literal[].
+ */
+
+typedef struct
+{
+    bool *func;
+    bool *gvar;
+    bool *literal;
+    Node **worklist;
+    int len;
+} Reach;
+
+static void mark(Node *node, void *ctx)
+{
+    Reach *r = ctx;
+    switch (node->kind)
+    {
+    case ND_FUNCALL:
+        for (int i = 0; text[i]; i++)
+        {
+            if (!r->func[i] && same_name(text[i]->funcname, text[i]->funcname_len, node->funcname, node->funcname_len))
+            {
+                r->func[i] = true;
+                r->worklist[r->len++] = text[i];
+            }
+        }
+        return;
+    case ND_GVAR:
+        for (int i = 0; data[i]; i++)
+        {
+            if (!r->gvar[i] && same_name(data[i]->gvarname, data[i]->gvarname_len, node->gvarname, node->gvarname_len))
+            {
+                r->gvar[i] = true;
+                // 初期値の文字列リテラル
+                visit(data[i], mark, r);
+            }
+        }
+        return;
+    case ND_STR_LITERAL:
+        r->literal[node->offset] = true;
+        return;
+    }
+}
+
+static void renumber_literal(Node *node, void *ctx)
+{
+    int *index = ctx;
+    if (node->kind == ND_STR_LITERAL)
+    {
+        node->offset = index[node->offset];
+    }
+}
+
+static int count(Node **list)
+{
+    int n = 0;
+    while (list[n])
+    {
+        n++;
+    }
+    return n;
+}
+
+void prune_unreachable(void)
+{
+    Node *main = find_func("main", 4);
+    if (!main)
+    {
+        return;
+    }
+
+    Reach *r = calloc(1, sizeof(Reach));
+    r->func = calloc(count(text), sizeof(bool));
+    r->gvar = calloc(count(data), sizeof(bool));
+    r->literal = calloc(count(data_string_literal), sizeof(bool));
+    // 関数は一度だけ積まれるので関数の数で足りる
+    r->worklist = calloc(count(text), sizeof(Node *));
+    for (int i = 0; text[i]; i++)
+    {
+        if (text[i] == main)
+        {
+            r->func[i] = true;
+        }
+    }
+    r->worklist[r->len++] = main;
+    while (r->len > 0)
+    {
+        Node *fn = r->worklist[--r->len];
+        visit(fn->body, mark, r);
+    }
+
+    int n = 0;
+    for (int i = 0; text[i]; i++)
+    {
+        if (r->func[i])
+        {
+            text[n++] = text[i];
+        }
+    }
+    text[n] = NULL;
+
+    n = 0;
+    for (int i = 0; data[i]; i++)
+    {
+        if (r->gvar[i])
+        {
+            data[n++] = data[i];
+        }
+    }
+    data[n] = NULL;
+
+    // 残った文字列リテラルを詰めて.LCの番号を振り直す
+    int *index = calloc(count(data_string_literal), sizeof(int));
+    n = 0;
+    for (int i = 0; data_string_literal[i]; i++)
+    {
+        if (r->literal[i])
+        {
+            index[i] = n;
+            data_string_literal[n++] = data_string_literal[i];
+        }
+    }
+    data_string_literal[n] = NULL;
+    for (int i = 0; text[i]; i++)
+    {
+        visit(text[i]->body, renumber_literal, index);
+    }
+    for (int i = 0; data[i]; i++)
+    {
+        visit(data[i], renumber_literal, index);
+    }
+    for (int i = 0; data_string_literal[i]; i++)
+    {
+        data_string_literal[i]->offset = i;
+    }
+}
@@ -0,0 +1,454 @@
+#include <limits.h>
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Compile-time evaluation of pure functions
+ *
+ * A function is pure when it only uses its int and char parameters and
+ * locals and only calls pure functions: no globals, no pointers, no string
+ * literals and no calls of functions defined elsewhere. The functions which
+ * call only pure ones are found by iterating until nothing changes.
+ *
+ * A call of a pure function whose arguments are constants is run by an
+ * interpreter which follows gen(): arithmetic is done in 64 bits and values
+ * are truncated when they are stored to a variable. The call is replaced by
+ * its result when the run finishes within the step budget and the result
+ * fits in an int. A division by zero, a read of an uninitialized local or a
+ * function which ends without return leaves the call alone.
+ */
+
+#define MAX_STEPS 100000
+#define MAX_DEPTH 1000
+
+static Node **funcs;
+static bool *pure;
+static int nfuncs;
+
+static int func_index(Node *call)
+{
+    for (int i = 0; i < nfuncs; i++)
+    {
+        if (same_name(funcs[i]->funcname, funcs[i]->funcname_len, call->funcname, call->funcname_len))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int count_args(Node *args)
+{
+    int n = 0;
+    for (Node *a = args; a; a = a->next)
+    {
+        n++;
+    }
+    return n;
+}
+
+static void check_pure(Node *node, void *ctx)
+{
+    bool *ok = ctx;
+    switch (node->kind)
+    {
+    case ND_LVAR:
+        if (node->type->ty != INT && node->type->ty != CHAR)
+        {
+            *ok = false;
+        }
+        return;
+    case ND_GVAR:
+    case ND_STR_LITERAL:
+    case ND_DEREF:
+    case ND_ADDR:
+        *ok = false;
+        return;
+    case ND_FUNCALL:
+    {
+        int i = func_index(node);
+        if (i < 0 || !pure[i] || count_args(node->args) != count_args(funcs[i]->args))
+        {
+            *ok = false;
+        }
+        return;
+    }
+    }
+}
+
+static void classify(void)
+{
+    nfuncs = 0;
+    while (text[nfuncs])
+    {
+        nfuncs++;
+    }
+    funcs = text;
+    pure = calloc(nfuncs, sizeof(bool));
+    for (int i = 0; i < nfuncs; i++)
+    {
+        pure[i] = count_args(text[i]->args) <= 6;
+    }
+    // 純粋でない関数を呼ぶ関数を除いていく
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < nfuncs; i++)
+        {
+            if (!pure[i])
+            {
+                continue;
+            }
+            bool ok = true;
+            for (Node *a = funcs[i]->args; a; a = a->next)
+            {
+                visit(a, check_pure, &ok);
+            }
+            visit(funcs[i]->body, check_pure, &ok);
+            if (!ok)
+            {
+                pure[i] = false;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Interpreter
+
+typedef struct
+{
+    int nvars;
+    int offset[256];
+    long value[256];
+} Frame;
+
+typedef enum
+{
+    EXEC_NEXT,
+    EXEC_RETURN,
+    EXEC_BREAK,
+    EXEC_FAIL,
+} Exec;
+
+static long steps;
+static int depth;
+
+static long *find_var(Frame *fr, int offset)
+{
+    for (int i = 0; i < fr->nvars; i++)
+    {
+        if (fr->offset[i] == offset)
+        {
+            return &fr->value[i];
+        }
+    }
+    return NULL;
+}
+
+static bool set_var(Frame *fr, Node *var, long val, long *stored)
+{
+    // 変数への代入は型の大きさで切り詰められる
+    val = var->type->ty == CHAR ? (signed char)val : (int)val;
+    long *p = find_var(fr, var->offset);
+    if (!p)
+    {
+        if (fr->nvars == 256)
+        {
+            return false;
+        }
+        fr->offset[fr->nvars] = var->offset;
+        p = &fr->value[fr->nvars++];
+    }
+    *p = val;
+    if (stored)
+    {
+        *stored = val;
+    }
+    return true;
+}
+
+static Exec exec(Node *node, Frame *fr, long *ret);
+static bool call(Node *node, Frame *fr, long *val);
+
+static bool eval(Node *node, Frame *fr, long *val)
+{
+    if (++steps > MAX_STEPS)
+    {
+        return false;
+    }
+
+    switch (node->kind)
+    {
+    case ND_NUM:
+        *val = node->val;
+        return true;
+    case ND_LVAR:
+    {
+        long *p = find_var(fr, node->offset);
+        if (!p)
+        {
+            return false;
+        }
+        *val = *p;
+        return true;
+    }
+    case ND_ASSIGN:
+    {
+        long v;
+        return node->lhs->kind == ND_LVAR && eval(node->rhs, fr, &v) && set_var(fr, node->lhs, v, val);
+    }
+    case ND_COMMA:
+    {
+        long unused;
+        return exec(node->lhs, fr, &unused) == EXEC_NEXT && eval(node->rhs, fr, val);
+    }
+    case ND_FUNCALL:
+        return call(node, fr, val);
+    }
+
+    long a, b;
+    if (!node->lhs || !node->rhs || !eval(node->lhs, fr, &a) || !eval(node->rhs, fr, &b))
+    {
+        return false;
+    }
+    // 64bitで計算して桁あふれはgen()と同じく折り返す
+    unsigned long ua = a, ub = b;
+    switch (node->kind)
+    {
+    case ND_ADD:
+        *val = (long)(ua + ub);
+        return true;
+    case ND_SUB:
+        *val = (long)(ua - ub);
+        return true;
+    case ND_MUL:
+        *val = (long)(ua * ub);
+        return true;
+    case ND_DIV:
+        if (b == 0 || (a == LONG_MIN && b == -1))
+        {
+            return false;
+        }
+        *val = a / b;
+        return true;
+    case ND_LESS_THAN:
+        *val = a < b;
+        return true;
+    case ND_EQUAL_LESS_THAN:
+        *val = a <= b;
+        return true;
+    case ND_EQ:
+        *val = a == b;
+        return true;
+    case ND_NE:
+        *val = a != b;
+        return true;
+    }
+    return false;
+}
+
+static Exec exec_loop(Node *node, Frame *fr, long *ret)
+{
+    for (;;)
+    {
+        // 条件も式もないループも1周ごとに数える
+        if (++steps > MAX_STEPS)
+        {
+            return EXEC_FAIL;
+        }
+        long c = 1;
+        if (node->cond && !eval(node->cond, fr, &c))
+        {
+            return EXEC_FAIL;
+        }
+        if (!c)
+        {
+            return EXEC_NEXT;
+        }
+        Exec e = exec(node->then, fr, ret);
+        if (e == EXEC_BREAK)
+        {
+            return EXEC_NEXT;
+        }
+        if (e != EXEC_NEXT)
+        {
+            return e;
+        }
+        if (node->inc && (e = exec(node->inc, fr, ret)) != EXEC_NEXT)
+        {
+            return e;
+        }
+    }
+}
+
+// Runs the body of a switch from the matching label.
+static Exec exec_switch(Node *node, Frame *fr, long *ret)
+{
+    long v;
+    if (!eval(node->cond, fr, &v))
+    {
+        return EXEC_FAIL;
+    }
+    Node *start = NULL;
+    for (Node *n = node->body; n; n = n->next)
+    {
+        if (n->kind == ND_CASE && n->val == v)
+        {
+            start = n;
+            break;
+        }
+        if (n->kind == ND_DEFAULT)
+        {
+            start = n;
+        }
+    }
+    for (Node *n = start; n; n = n->next)
+    {
+        Exec e = exec(n, fr, ret);
+        if (e == EXEC_BREAK)
+        {
+            return EXEC_NEXT;
+        }
+        if (e != EXEC_NEXT)
+        {
+            return e;
+        }
+    }
+    return EXEC_NEXT;
+}
+
+static Exec exec(Node *node, Frame *fr, long *ret)
+{
+    if (!node)
+    {
+        return EXEC_NEXT;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            Exec e = exec(n, fr, ret);
+            if (e != EXEC_NEXT)
+            {
+                return e;
+            }
+        }
+        return EXEC_NEXT;
+    case ND_RETURN:
+        return eval(node->lhs, fr, ret) ? EXEC_RETURN : EXEC_FAIL;
+    case ND_IF:
+    {
+        long c;
+        if (!eval(node->cond, fr, &c))
+        {
+            return EXEC_FAIL;
+        }
+        return exec(c ? node->then : node->els, fr, ret);
+    }
+    case ND_WHILE:
+        return exec_loop(node, fr, ret);
+    case ND_FOR:
+    {
+        Exec e = exec(node->init, fr, ret);
+        return e == EXEC_NEXT ? exec_loop(node, fr, ret) : e;
+    }
+    case ND_SWITCH:
+        return exec_switch(node, fr, ret);
+    case ND_BREAK:
+        return EXEC_BREAK;
+    case ND_LVAR:
+    case ND_CASE:
+    case ND_DEFAULT:
+        // 宣言だけの文とswitchのラベル
+        return EXEC_NEXT;
+    }
+    long unused;
+    return eval(node, fr, &unused) ? EXEC_NEXT : EXEC_FAIL;
+}
+
+static bool call(Node *node, Frame *fr, long *val)
+{
+    int i = func_index(node);
+    if (i < 0 || !pure[i] || depth == MAX_DEPTH)
+    {
+        return false;
+    }
+    Node *fn = funcs[i];
+
+    Frame *callee = calloc(1, sizeof(Frame));
+    Node *p = fn->args;
+    for (Node *a = node->args; a; a = a->next, p = p->next)
+    {
+        long v;
+        if (!p || !eval(a, fr, &v) || !set_var(callee, p, v, NULL))
+        {
+            free(callee);
+            return false;
+        }
+    }
+
+    depth++;
+    Exec e = exec(fn->body, callee, val);
+    depth--;
+    free(callee);
+    return e == EXEC_RETURN;
+}
+
+// Replaces calls in node after those in its operands, so that a call whose
+// arguments are calls can be evaluated too.
+static void evaluate(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+    evaluate(node->init);
+    evaluate(node->cond);
+    evaluate(node->lhs);
+    evaluate(node->rhs);
+    evaluate(node->then);
+    evaluate(node->els);
+    evaluate(node->inc);
+    for (Node *n = node->args; n; n = n->next)
+    {
+        evaluate(n);
+    }
+    for (Node *n = node->body; n; n = n->next)
+    {
+        evaluate(n);
+    }
+
+    if (node->kind != ND_FUNCALL)
+    {
+        return;
+    }
+    for (Node *a = node->args; a; a = a->next)
+    {
+        if (a->kind != ND_NUM)
+        {
+            return;
+        }
+    }
+    Frame *caller = calloc(1, sizeof(Frame));
+    long val;
+    steps = 0;
+    depth = 0;
+    if (call(node, caller, &val) && val == (int)val)
+    {
+        set_num(node, val);
+    }
+    free(caller);
+}
+
+void evaluate_pure_calls(void)
+{
+    classify();
+    for (int i = 0; text[i]; i++)
+    {
+        evaluate(text[i]->body);
+    }
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Control-flow simplification
+ *
+ * Removes branches whose condition is a constant, loops which never run,
+ * statements after a return or break and empty blocks and else arms. In the
+ * body of a switch, such statements are only removed up to the next case
+ * label. Jumps to jumps and code after an unconditional jump are handled by
+ * peephole().
+ */
+
+static bool is_empty(Node *node)
+{
+    return !node || (node->kind == ND_BLOCK && !node->body);
+}
+
+static Node *empty_block(void)
+{
+    Node *n = calloc(1, sizeof(Node));
+    n->kind = ND_BLOCK;
+    return n;
+}
+
+// Whether control never reaches the statement after node.
+bool never_falls_through(Node *node)
+{
+    switch (node->kind)
+    {
+    case ND_RETURN:
+    case ND_BREAK:
+        return true;
+    case ND_BLOCK:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            if (never_falls_through(n))
+            {
+                return true;
+            }
+        }
+        return false;
+    case ND_IF:
+        return node->els && never_falls_through(node->then) && never_falls_through(node->els);
+    case ND_WHILE:
+    case ND_FOR:
+        // 無限ループはreturnかbreakでしか抜けられない
+        return (!node->cond || (node->cond->kind == ND_NUM && node->cond->val != 0)) && !has_break(node->then);
+    }
+    return false;
+}
+
+void simplify(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+    {
+        Node head = {};
+        Node *cur = &head;
+        for (Node *n = node->body; n; n = n->next)
+        {
+            simplify(n);
+            if (is_empty(n))
+            {
+                continue;
+            }
+            cur = cur->next = n;
+            // return以降の文には到達しない
+            if (never_falls_through(n))
+            {
+                break;
+            }
+        }
+        cur->next = NULL;
+        node->body = head.next;
+        return;
+    }
+    case ND_IF:
+        simplify(node->then);
+        simplify(node->els);
+        if (is_empty(node->els))
+        {
+            node->els = NULL;
+        }
+        if (node->cond->kind == ND_NUM)
+        {
+            Node *taken = node->cond->val ? node->then : node->els;
+            replace_node(node, taken ? taken : empty_block());
+            return;
+        }
+        if (is_empty(node->then) && !node->els)
+        {
+            // 条件式の副作用だけを残す
+            replace_node(node, node->cond);
+        }
+        return;
+    case ND_SWITCH:
+    {
+        Node head = {};
+        Node *cur = &head;
+        bool reachable = true;
+        for (Node *n = node->body; n; n = n->next)
+        {
+            if (n->kind == ND_CASE || n->kind == ND_DEFAULT)
+            {
+                reachable = true;
+                cur = cur->next = n;
+                continue;
+            }
+            simplify(n);
+            if (!reachable || is_empty(n))
+            {
+                continue;
+            }
+            cur = cur->next = n;
+            reachable = !never_falls_through(n);
+        }
+        cur->next = NULL;
+        node->body = head.next;
+        return;
+    }
+    case ND_WHILE:
+        simplify(node->then);
+        if (node->cond->kind == ND_NUM && node->cond->val == 0)
+        {
+            replace_node(node, empty_block());
+        }
+        return;
+    case ND_FOR:
+        simplify(node->then);
+        if (node->cond && node->cond->kind == ND_NUM && node->cond->val == 0)
+        {
+            replace_node(node, node->init ? node->init : empty_block());
+        }
+        return;
+    }
+}
+
+void simplify_cfg(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        simplify(text[i]->body);
+    }
+}
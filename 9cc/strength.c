@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Strength reduction of induction variables
+ *
+ * In a for loop whose variable i is only changed by an increment of the
+ * form i = i + k or i = i - k with a constant k, every i * c with a
+ * constant c is replaced by a new variable. It is set to i * c after the
+ * init and stepped by k * c together with i, so the multiplication is gone
+ * from the loop.
+ *
+ * Array indexes are scaled by 1, 2, 4 or 8, which codegen does for free in
+ * the memory operand, so those are left alone. The remaining multiplications
+ * and divisions by constants are lowered to shifts, lea and multiply-high by
+ * gen().
+ */
+
+typedef struct
+{
+    Node *iv;  // the induction variable
+    int step;  // k, negated for i = i - k
+    int scale; // c
+    Node *tmp; // holds i * c
+} Derived;
+
+static Node *fn;
+static Locals *vars;
+
+typedef struct
+{
+    Node *iv;
+    int step;
+    Derived derived[16];
+    int nderived;
+} Loop;
+
+// The scale c if node is i * c or c * i, otherwise 0.
+static int scale_of(Node *node, Node *iv)
+{
+    if (node->kind != ND_MUL)
+    {
+        return 0;
+    }
+    Node *v = node->lhs->kind == ND_NUM ? node->rhs : node->lhs;
+    Node *c = node->lhs->kind == ND_NUM ? node->lhs : node->rhs;
+    if (v->kind != ND_LVAR || v->offset != iv->offset || v->type->ty != INT || c->kind != ND_NUM)
+    {
+        return 0;
+    }
+    // 添字のスケールはメモリオペランドで済む
+    if (is_scale(c))
+    {
+        return 0;
+    }
+    return c->val;
+}
+
+static void reduce(Node *node, void *ctx)
+{
+    Loop *l = ctx;
+    int c = scale_of(node, l->iv);
+    if (c == 0)
+    {
+        return;
+    }
+
+    Derived *d = NULL;
+    for (int i = 0; i < l->nderived; i++)
+    {
+        if (l->derived[i].scale == c)
+        {
+            d = &l->derived[i];
+        }
+    }
+    if (!d)
+    {
+        if (l->nderived == 16 || vars->nvars + l->nderived >= 256)
+        {
+            return;
+        }
+        d = &l->derived[l->nderived++];
+        d->iv = l->iv;
+        d->step = l->step;
+        d->scale = c;
+        d->tmp = new_temp(fn, new_type(INT));
+    }
+    replace_node(node, d->tmp);
+}
+
+// 同じノードを木の二か所から参照しないように複製する
+static Node *copy(Node *node)
+{
+    Node *n = calloc(1, sizeof(Node));
+    *n = *node;
+    n->next = NULL;
+    return n;
+}
+
+static Node *assign(Node *lhs, Node *rhs)
+{
+    Node *n = new_node(ND_ASSIGN, lhs, rhs);
+    n->type = lhs->type;
+    return n;
+}
+
+static void reduce_loop(Node *node)
+{
+    vars = collect_locals(fn);
+    Loop l = {};
+    l.iv = basic_iv(vars, node->inc, &l.step);
+    if (!l.iv)
+    {
+        return;
+    }
+    if (assigns_var(node->cond, l.iv->offset) || assigns_var(node->then, l.iv->offset))
+    {
+        return;
+    }
+
+    visit(node->cond, reduce, &l);
+    visit(node->then, reduce, &l);
+    if (l.nderived == 0)
+    {
+        return;
+    }
+
+    // for (init; cond; i = i + k) => { init; t = i * c; for (; cond; { i = i + k; t = t + k * c; }) }
+    Node head = {};
+    Node *cur = &head;
+    if (node->init)
+    {
+        cur = cur->next = node->init;
+    }
+    Node inc_head = {};
+    Node *inc = &inc_head;
+    inc = inc->next = node->inc;
+    for (int i = 0; i < l.nderived; i++)
+    {
+        Derived *d = &l.derived[i];
+        cur = cur->next = assign(copy(d->tmp), new_node(ND_MUL, copy(d->iv), new_node_num(d->scale)));
+        // t は int の変数なので 32 ビットで折り返してよい
+        int step = (int)((unsigned int)d->step * (unsigned int)d->scale);
+        inc = inc->next = assign(copy(d->tmp), new_node(ND_ADD, copy(d->tmp), new_node_num(step)));
+    }
+    inc->next = NULL;
+    Node *inc_block = calloc(1, sizeof(Node));
+    inc_block->kind = ND_BLOCK;
+    inc_block->body = inc_head.next;
+
+    Node *loop = calloc(1, sizeof(Node));
+    *loop = *node;
+    loop->init = NULL;
+    loop->inc = inc_block;
+    loop->next = NULL;
+    cur->next = loop;
+
+    Node *block = calloc(1, sizeof(Node));
+    block->kind = ND_BLOCK;
+    block->body = head.next;
+    replace_node(node, block);
+}
+
+static void walk(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+    case ND_SWITCH:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            walk(n);
+        }
+        return;
+    case ND_IF:
+        walk(node->then);
+        walk(node->els);
+        return;
+    case ND_WHILE:
+        walk(node->then);
+        return;
+    case ND_FOR:
+        walk(node->then);
+        reduce_loop(node);
+        return;
+    }
+}
+
+void reduce_strength(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fn = text[i];
+        walk(fn->body);
+    }
+}
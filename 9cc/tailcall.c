@@ -0,0 +1,78 @@
+#include "optimize.h"
+
+/*
+ * Tail calls
+ *
+ * Marks calls of the form "return f(args);" so that codegen can replace the
+ * call with a jump. A call of the function itself becomes a jump back to the
+ * start of its body after the arguments are stored in the parameters, and a
+ * call of another function reuses the caller's return address.
+ *
+ * The callee may only run after the caller's frame is gone, so no call is
+ * marked in a function whose locals may be referenced through a pointer.
+ */
+
+static Node *fn;
+
+static int count_args(Node *args)
+{
+    int n = 0;
+    for (Node *a = args; a; a = a->next)
+    {
+        n++;
+    }
+    return n;
+}
+
+static void mark(Node *node, void *ctx)
+{
+    if (node->kind != ND_RETURN || node->lhs->kind != ND_FUNCALL)
+    {
+        return;
+    }
+    Node *call = node->lhs;
+    int nargs = count_args(call->args);
+    // 引数はレジスタ渡しのものだけ
+    if (nargs > 6)
+    {
+        return;
+    }
+    if (same_name(call->funcname, call->funcname_len, fn->funcname, fn->funcname_len))
+    {
+        if (nargs != count_args(fn->args))
+        {
+            return;
+        }
+        fn->tail_call = 1;
+    }
+    call->tail_call = 1;
+}
+
+static bool has_escaped_local(Node *fn)
+{
+    Locals *l = collect_locals(fn);
+    if (l->full)
+    {
+        return true;
+    }
+    for (int i = 0; i < l->nvars; i++)
+    {
+        if (l->escaped[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void mark_tail_calls(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fn = text[i];
+        if (!has_escaped_local(fn))
+        {
+            visit(fn->body, mark, NULL);
+        }
+    }
+}
@@ -6,15 +6,20 @@ assert() {
 
     #check if input has .c extension
     if [[ $input == *".c" ]]; then
-        ./9cc --path "$input" > tmp.s
+        src=(--path "$input")
     else
-        ./9cc "$input" > tmp.s
+        src=("$input")
     fi
 
     # ./9cc "$input" > tmp.s
     # cc -o tmp tmp.s
-    cc -c -o tmp.o tmp.s
-    cc -o tmp tmp.o foo.o
+    if [ -n "$OBJ" ]; then
+        ./9cc $OPTS -c -o tmp.o "${src[@]}"
+    else
+        ./9cc $OPTS "${src[@]}" > tmp.s
+        cc -c -o tmp.o tmp.s
+    fi
+    cc -o tmp tmp.o foo.o prof.o
     ./tmp
     actual="$?"
 
@@ -26,6 +31,17 @@ assert() {
     fi
 }
 
+# SSA形式を経由してコンパイルする
+assert_ir() {
+    OPTS=--ir assert "$@"
+}
+
+# 内蔵のアセンブラでオブジェクトファイルを出力する
+# (OBJ=1 ./test.sh ですべてのテストをこちらで実行する)
+assert_obj() {
+    OBJ=1 assert "$@"
+}
+
 assert 0 "int main(){return 0;}"
 assert 42 "int main(){return 42;}"
 assert 21 "int main(){return 5+20-4;}"
@@ -72,11 +88,13 @@ assert 2 "int hoge(){return 2;} int main(){return hoge();}"
 assert 2 "int hoge(int x){return x;} int main(){return hoge(2);}"
 assert 5 "int hoge(int x, int y){return x + y;} int main(){return hoge(2, 3);}"
 assert 1 "int main(){qc_print(10);return 1;}"
+assert 7 "int hoge(int x){return x*2;} int main(){ int a; a = 3; return a + hoge(2); }"
+assert 3 "int main(){ int a; int b; a = 10; b = a - 4 / 2 * 3 + 5; return b - a / 5 * 3; }"
 assert 1 "int fib(int i, int s){ if(i == 0){return 1;}  return fib(i-1,0);} int main(){return fib(1,0);}"
 assert 0 "int rec(int x){if(x == 0){return x;} return rec(x-1);} int main(){return rec(5);}"
 assert 0 "int rec(int x, int y){if(x == 0){return x;} return rec(x - 1, y * 2);} int main(){return rec(1, 2);}"
 assert 8 "int fib(int p, int n, int i){if(i == 0){return n;} return fib(n, p + n, i -1) ;} int main(){return fib(1,1,4);}"
-assert 2 "int main(){int v;int p;v = 2;p = &v; return *p;}"
+assert 2 "int main(){int v;int *p;v = 2;p = &v; return *p;}"
 assert 1 "int main(){int i; i = 1; return i;}"
 assert 3 "int main(){ int x; int *y; y = &x; return 3;}"
 assert 3 "int main(){ int x; int *y; y = &x; *y = 3; return x;}"
@@ -100,9 +118,128 @@ assert 5 "int main(){ int a[2]; a[1] = 3 ; return a[1] + 2; }"
 assert 3 "int i; int main(){ return 3; }"
 assert 3 "int i; int main(){ i = 3; return i; }"
 assert 4 "int i[2]; int main(){ i[1] = 4; return i[1]; }"
+assert 3 "int main(){ int *p; int i; alloc4(&p, 1,2,3,4); i = 2; return *(p + i); }"
+assert 5 "int i[2]; int main(){ int *p; alloc4(&p, 1,2,3,4); i[1] = 1; *(p + i[1]) = 5; return *(p + 1); }"
 assert 4 "int main(){char c; c = 4; return c; }"
 assert 3 "int main(){char x[3]; x[0] = -1; x[1] = 2; int y; y =4; return x[0] + y; }"
 assert 1 "int main(){int a[2]; a[0] = 65; qc_print_str(a); return 1;}"
+assert 8 "int main(){ int a[2]; return sizeof(a); }"
+assert 3 "int main(){ char a[3]; return sizeof(a); }"
+assert 7 "int main(){ int *p; alloc4(&p, 1,2,3,4); return p[2] + *(p + 3); }"
+assert 3 "int main(){ int a[4]; int i; for(i=0; i<4; i=i+1){ a[i] = i; } return a[3]; }"
+assert 2 "int main(){ int a[4]; int *p; int *q; p = a + 1; q = a + 3; return q - p; }"
+assert 44 "int main(){ char c; return c = 300; }"
+assert 6 "int main(){ char s[3]; int x; s[0] = 1; s[1] = 2; s[2] = 3; x = 0; return s[0] + s[1] + s[2] + x; }"
 assert 3 'int main(){char *a; a = "hoge"; qc_print_str(a); return 3; }'
+assert 1 'int main(){char *a; char *b; a = "hoge"; b = "hoge"; return a == b; }'
+assert 0 'int main(){char *a; char *b; a = "hoge"; b = "fuga"; return a == b; }'
+assert 0 "int main(){ return 2147483647 + 1 < 0; }"
+assert 5 "int main(){ int x; x = 7; return x * 1 + 0 - (3 - 1) * (0 + 1); }"
+assert 11 "int main(){ int a; a = 10; if (a > 5) { a = a + 1; } return a; }"
+assert 7 "int main(){ int a; int b; int i; a = 3; b = a; for (i = 0; i < 4; i = i + 1) { b = b + 1; } return b; }"
+assert 4 "int main(){ int a; int *p; a = 1; p = &a; *p = 4; return a; }"
+assert 44 "int main(){ char c; int i; c = 300; i = c; return i; }"
+assert 6 "int f(int x){ int y; y = x; x = 5; return x + y; } int main(){ return f(1); }"
+assert 2 "int f(int x){ if (x) { return 1; } else { return 2; } return 3; } int main(){ return f(0); }"
+assert 5 "int main(){ int a; a = 5; for (;;) { return a; } return 1; }"
+assert 4 "int main(){ int a; a = 0; if (1) a = 4; else a = 2; return a; }"
+assert 1 "int main(){ int a; a = 1; for (a = 1; 0; a = a + 1) { a = 7; } if (a) {} else {} return a; }"
+assert 3 'int g; int h[4]; int unused(){ h[1] = 2; qc_print_str("unused"); return g; } int used(){ return 3; } int main(){ qc_print_str("used"); return used(); }'
+assert 10 "int f(int n){ int a; int b; int s; s = 0; while (n > 0) { a = n; b = a * 2; s = s + a; n = n - 1; } return s; } int main(){ return f(4); }"
+assert 7 "int g; int set(){ g = 5; return 1; } int main(){ int a; a = set(); a = 2; return a + g; }"
+assert 7 "int f(int *p, int x){ int unused; int a[3]; int y; unused = 9; a[0] = x; a[2] = p[0]; y = a[0] + a[2]; return y; } int main(){ int v[1]; v[0] = 3; return f(v, 4); }"
+assert 4 "int main(){ int i; int last; last = 0; for (i = 0; i < 5; i = i + 1) { last = i; } return last; }"
+assert 12 "int g[4]; int main(){ int i; i = 2; g[i] = 6; return g[i] + g[i]; }"
+assert 9 "int main(){ int *p; int x; alloc4(&p, 1, 2, 3, 4); x = *(p + 1) * *(p + 2); *(p + 2) = 5; return x - 6 + *(p + 1) * *(p + 2) - 1; }"
+assert 21 "int main(){ int a; int b; int c; int d; a = 2; b = 3; c = a * b + a; a = 4; d = a * b + a; return c + d - 3; }"
+assert 7 "int g; int inc(){ g = g + 1; return 0; } int main(){ int x; g = 3; x = g * g; inc(); return g * g - x; }"
+assert 13 "int g[4]; int f(int *p, int i){ return p[i] * p[i] + g[i] + g[i]; } int main(){ g[1] = 3; return f(g, 1) - 2; }"
+assert 39 "int f(int n, int m){ int i; int s; s = 0; for (i = 0; i < n * 2; i = i + 1) { s = s + m * m + i; } return s; } int main(){ return f(3, 2); }"
+assert 0 "int f(int *p, int n){ int s; s = 0; while (n > 0) { s = s + *p; n = n - 1; } return s; } int main(){ return f(0, 0); }"
+assert 0 "int f(int a, int b, int n){ int s; s = 0; while (n > 0) { s = s + a / b; n = n - 1; } return s; } int main(){ return f(1, 0, 0); }"
+assert 6 "int g; int f(int *p, int n){ int i; int s; s = 0; for (i = 0; i < n; i = i + 1) { s = s + *p; *p = *p + 1; } return s; } int main(){ g = 1; return f(&g, 3); }"
+assert 54 "int f(int n){ int i; int j; int s; s = 0; for (i = 0; i < n; i = i + 1) { for (j = 0; j < n * 2; j = j + 1) { s = s + i * n; } } return s; } int main(){ return f(3); }"
+assert 20 "int f(int x){ return x / 7 + x / -3 + x / 10; } int main(){ return f(-100) - f(100) + 2; }"
+assert 3 "int f(int x){ return x / 8 + x / 2; } int main(){ return f(-17) + 13; }"
+assert 13 "int f(int x){ return x * 12 + x * -5 + 7 * x; } int main(){ return f(3) - 29; }"
+assert 135 "int main(){ int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { s = s + i * 3; } return s; }"
+assert 87 "int f(int n){ int i; int s; s = 0; for (i = n; i > 0; i = i - 2) { s = s + i * 3 + i * 3 - i * 5; } return s; } int main(){ return f(10) + 57; }"
+assert 42 "int loop(int n){ if (n == 0) return 42; return loop(n - 1); } int main(){ return loop(10000000); }"
+assert 55 "int sum(int n, int acc){ if (n == 0) return acc; return sum(n - 1, acc + n); } int main(){ return sum(10, 0); }"
+assert 1 "int even(int n){ if (n == 0) return 1; return odd(n - 1); } int odd(int n){ if (n == 0) return 0; return even(n - 1); } int main(){ return even(3000000); }"
+assert 5 "int f(int *p, int n){ if (n == 0) return *p; return f(p, n - 1); } int main(){ int x; x = 5; return f(&x, 3); }"
+assert 7 "int hoge(int x, int y){ return x + y; } int main(){ return hoge(3, 4); }"
+assert 12 "int sq(int x){ return x * x; } int add(int a, int b){ return a + b; } int main(){ int i; i = 2; return add(sq(i), sq(i + 1)) - 1; }"
+assert 5 "int g; int bump(){ g = g + 1; return g; } int second(int a, int b){ return b; } int main(){ g = 0; return second(bump(), bump()) + g + 1; }"
+assert 3 "int get(int *p, int i){ return p[i]; } int main(){ int a[3]; a[0] = 1; a[1] = 2; a[2] = 3; return get(a, 2); }"
+assert 2 "int low(char c){ return c; } int main(){ return low(258); }"
+assert 10 "int fact(int n){ if (n == 0) return 1; return n * fact(n - 1); } int twice(int x){ return x + x; } int main(){ return twice(fact(3)) - 2; }"
+assert 6 "int main(){ int s; int b; s = 0; for (b = 0; b < 4; b = b + 1) s = s + b; return s; }"
+assert 22 "int main(){ int s; int b; s = 0; for (b = 10; 0 < b; b = b - 3) s = s + b; return s; }"
+assert 45 "int sum(int n){ int s; int i; s = 0; for (i = 0; i < n; i = i + 1) s = s + i; return s; } int main(){ return sum(10); }"
+assert 7 "int count(int n){ int c; int i; c = 0; for (i = 0; i <= n; i = i + 2) c = c + 1; return c; } int main(){ return count(12); }"
+assert 0 "int sum(int n){ int s; int i; s = 0; for (i = 0; i < n; i = i + 1) s = s + i; return s; } int main(){ return sum(0); }"
+assert 12 "int main(){ int a[50]; int i; for (i = 0; i < 50; i = i + 1) a[i] = i; int s; s = 0; for (i = 49; 0 <= i; i = i - 7) s = s + 1; return s + a[42] - 38; }"
+assert 27 "int main(){ int s; int i; int j; s = 0; for (i = 0; i < 3; i = i + 1) for (j = 0; j < 3; j = j + 1) s = s + i * j + 1 + i; return s; }"
+assert 90 "int main(){ int a[10]; int b[10]; int c[10]; int i; for (i = 0; i < 10; i = i + 1) { b[i] = i; c[i] = i * 2; } for (i = 0; i < 10; i = i + 1) a[i] = b[i] + c[i] - 1; return a[9] + a[0] + a[5] + 51; }"
+assert 42 "int g[7]; int h[7]; int main(){ int i; int n; n = 7; for (i = 0; i < n; i = i + 1) g[i] = 21; for (i = 0; i < n; i = i + 1) h[i] = g[i] + g[i]; return h[6]; }"
+assert 3 "char s[20]; char t[20]; int main(){ int i; for (i = 0; i < 20; i = i + 1) t[i] = i; for (i = 0; i <= 18; i = i + 1) s[i] = t[i] + 250; return s[19] + s[18] - s[17] - s[9] + 5; }"
+assert_ir 42 "int main(){ return 40 + 2; }"
+assert_ir 13 "int f(int n){ int s; int i; s = 0; for (i = 0; i < n; i = i + 1) { if (i == 3) s = s + 2; else s = s + i; } return s; } int main(){ int a[3]; a[1] = 4; return f(5) + a[1]; }"
+assert_ir 55 "int fib(int n){ int a; int b; int t; a = 0; b = 1; while (n) { t = a + b; a = b; b = t; n = n - 1; } return a; } int main(){ return fib(10); }"
+assert_ir 9 "int g; int set(int *p, int v){ *p = v; return v; } int main(){ int x; char c; x = 3; set(&x, 7); c = 258; g = x + c; return g; }"
+assert_ir 2 "test/t1.c"
+OPTS=-O0 assert 55 "int fib(int n){ if (n <= 1) return n; return fib(n - 1) + fib(n - 2); } int main(){ return fib(10); }"
+OPTS=-O1 assert 45 "int main(){ int s; int i; s = 0; for (i = 0; i < 10; i = i + 1) s = s + i; return s; }"
+OPTS="--passes=inline,fold,unroll,verify-ir,peephole" assert 12 "int sq(int x){ return x * x; } int main(){ int s; int i; s = 0; for (i = 0; i < 3; i = i + 1) s = s + sq(i) + 1; return s + 4; }"
+OPTS="-O1 --time-passes" assert 7 "int main(){ int a[8]; int i; for (i = 0; i < 8; i = i + 1) a[i] = i; return a[7]; }"
+assert 55 "int fib(int n){ if (n <= 1) return n; return fib(n - 1) + fib(n - 2); } int main(){ return fib(10); }"
+assert 17 "int fib(int n){ if (n <= 1) return n; return fib(n - 1) + fib(n - 2); } int main(){ return fib(25) - 75008; }"
+assert 6 "int f(int x){ char c; c = x * 64; return c / 32 + 8; } int g(int x){ foo(x, x); return x; } int main(){ return f(3) + g(0); }"
+OPTS=--passes=evaluate,verify-ir assert 3 "int d(int x){ return 6 / x; } int main(){ return d(2) + d(0 + 2) * 0; }"
+assert 3 "int spin(){ for (;;) {} return 0; } int main(){ if (0) return spin(); return 3; }"
+OPTS=-O1 assert 3 "int spin(){ for (;;) { int y; } return 0; } int main(){ if (0) return spin(); return 3; }"
+OPTS=--instrument-branches=tmp.prof assert 50 "int n; int a[100]; int f(){ int s; int i; int m; m = n; s = 0; for (i = 0; i < m; i = i + 1) s = s + a[i] + i; return s; } int main(){ int k; int t; t = 0; n = 2; for (k = 0; k < 50; k = k + 1) t = t + f(); return t; }"
+OPTS=--profile-use=tmp.prof assert 50 "int n; int a[100]; int f(){ int s; int i; int m; m = n; s = 0; for (i = 0; i < m; i = i + 1) s = s + a[i] + i; return s; } int main(){ int k; int t; t = 0; n = 2; for (k = 0; k < 50; k = k + 1) t = t + f(); return t; }"
+OPTS=--instrument-branches=tmp.prof assert 41 "int n; int f(){ int s; int i; s = 0; for (i = 0; i < n; i = i + 1) { if (i < 2) s = s + 1; else s = s + i; } return s; } int main(){ n = 20; return f() - 150; }"
+OPTS=--profile-use=tmp.prof assert 41 "int n; int f(){ int s; int i; s = 0; for (i = 0; i < n; i = i + 1) { if (i < 2) s = s + 1; else s = s + i; } return s; } int main(){ n = 20; return f() - 150; }"
+OPTS=--profile-use=tmp.prof assert 3 "int main(){ return 3; }"
+# 引用符とバックスラッシュを含むパス
+rm -f 'tmp"\.prof'
+OPTS='--instrument-branches=tmp"\.prof' assert 4 "int main(){ int i; for (i = 0; i < 4; i = i + 1) {} return i; }"
+[ -f 'tmp"\.prof' ] || { echo 'tmp"\.prof was not written'; exit 1; }
+OPTS=--profile-functions assert 17 "int fib(int n){ if (n <= 1) return n; return fib(n - 1) + fib(n - 2); } int g; int h(int x){ g = g + x; return g; } int main(){ int i; g = fib(10); for (i = 0; i < 100; i = i + 1) h(i); return fib(g - 5000 + 20); }"
+OPTS="--ir --profile-functions" assert 10 "int g; int sum(int a, int b, int c, int d, int e, int f){ int t; t = a + b + c + d + e + f; return t + g; } int main(){ g = 0; return sum(1, 1, 2, 2, 2, 2); }"
+assert 179 "int g; int d(int x){ g = g + 1; switch (x) { case 1: return 10; case 2: return 20; case 3: return 30; case 5: return 50; case 6: return 60; } return 0; } int main(){ return d(1)+d(2)+d(3)+d(4)+d(5)+d(6)+d(0)+d(7)+d(-1)+g; }"
+assert 71 "int g; int e(int x){ g = g + 1; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50000: return 4; case 3: return 5; case 99: return 6; case -5: return 7; default: return 8; } } int main(){ return e(-100)+e(7)*10+e(1000)+e(50000)+e(3)+e(99)+e(-5)+e(4)+e(100000)+g; }"
+assert 112 "int main(){ int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { switch (i - i / 3 * 3) { case 0: s = s + 1; break; case 1: { int j; j = 0; while (1) { j = j + 1; if (j == 3) break; } s = s + j; } break; default: switch (i) { case 2: s = s + 100; } } if (i == 8) break; } return s; }"
+assert_ir 112 "int main(){ int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { switch (i - i / 3 * 3) { case 0: s = s + 1; break; case 1: { int j; j = 0; while (1) { j = j + 1; if (j == 3) break; } s = s + j; } break; default: switch (i) { case 2: s = s + 100; } } if (i == 8) break; } return s; }"
+assert_ir 71 "int g; int e(int x){ g = g + 1; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50000: return 4; case 3: return 5; case 99: return 6; case -5: return 7; default: return 8; } } int main(){ return e(-100)+e(7)*10+e(1000)+e(50000)+e(3)+e(99)+e(-5)+e(4)+e(100000)+g; }"
+OPTS=-O0 assert 37 "int f(int x){ int r; r = 0; switch (x) { case 0: r = 10; break; case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; break; case 4: r = 14; break; case 5: return 15; default: r = 99; } return r; } int main(){ return f(0)+f(2)-f(3)+f(5)-f(7)+f(-1) ; }"
+OPTS=--passes=evaluate,verify-ir assert 37 "int f(int x){ int r; r = 0; switch (x) { case 0: r = 10; break; case 1: r = 11; break; case 2: r = 12; case 3: r = r + 13; break; case 4: r = 14; break; case 5: return 15; default: r = 99; } return r; } int main(){ return f(0)+f(2)-f(3)+f(5)-f(7)+f(-1) ; }"
+assert 11 'int main(){ int a[5] = {1, 2, 3}; char s[] = "hello"; return a[0] + a[2] + a[4] + s[1] - 100 + sizeof(s); }'
+assert 12 "int f(int x){ return x * 2; } int main(){ int t[40] = {5, f(3), 7, -2 * 3, }; int i; int s; s = 0; for (i = 0; i < 40; i = i + 1) s = s + t[i]; return s + t[39]; }"
+assert 19 'int g = 7; int tab[6] = {1, 1, 2, 3, 5, 8}; char msg[] = "abc"; char *p = "xyz"; int z[3]; int main(){ return g + tab[5] + msg[2] - 99 + p[1] - 121 + z[2] + sizeof(msg); }'
+assert 51 'int main(){ int s; int i; s = 0; for (i = 0; i < 3; i = i + 1) { int a[3] = {1, 2, 3}; a[i] = 10; s = s + a[0] + a[1] + a[2]; } char b[11] = "0123456789"; return s + b[9] - 48 + b[10]; }'
+assert 59 "int main(){ int x = 3; int y = x * 4; char c = 300; return x + y + c; }"
+assert_ir 51 'int main(){ int s; int i; s = 0; for (i = 0; i < 3; i = i + 1) { int a[3] = {1, 2, 3}; a[i] = 10; s = s + a[0] + a[1] + a[2]; } char b[11] = "0123456789"; return s + b[9] - 48 + b[10]; }'
+assert_ir 19 'int g = 7; int tab[6] = {1, 1, 2, 3, 5, 8}; char msg[] = "abc"; char *p = "xyz"; int z[3]; int main(){ return g + tab[5] + msg[2] - 99 + p[1] - 121 + z[2] + sizeof(msg); }'
+OPTS=-j4 assert 71 "int g; int e(int x){ g = g + 1; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50000: return 4; case 3: return 5; case 99: return 6; case -5: return 7; default: return 8; } } int main(){ return e(-100)+e(7)*10+e(1000)+e(50000)+e(3)+e(99)+e(-5)+e(4)+e(100000)+g; }"
+OPTS="-O0 --jobs=3" assert 73 "int a(int x){ if (x) return 1; return 2; } int b(int x){ while (x < 5) x = x + 1; return x; } int c(int x){ int i; int s; s = 0; for (i = 0; i < x; i = i + 1) s = s + i; return s; } int d(int x){ return a(x) + b(x) + c(x); } int main(){ return d(0) + d(10) + a(0) + b(1) + c(3); }"
+OPTS="--ir -j" assert 73 "int a(int x){ if (x) return 1; return 2; } int b(int x){ while (x < 5) x = x + 1; return x; } int c(int x){ int i; int s; s = 0; for (i = 0; i < x; i = i + 1) s = s + i; return s; } int d(int x){ return a(x) + b(x) + c(x); } int main(){ return d(0) + d(10) + a(0) + b(1) + c(3); }"
+assert 24 'int main(){ char s[] = "a\tb\n"; return s[1] + s[3] + sizeof(s); }'
+assert_obj 24 'int main(){ char s[] = "a\tb\n"; return s[1] + s[3] + sizeof(s); }'
+OPTS=-O0 assert_obj 194 "int main(){ int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) { s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; s = s + i; } return s; }"
+assert_obj 71 "int g; int e(int x){ g = g + 1; switch (x) { case -100: return 1; case 7: return 2; case 1000: return 3; case 50000: return 4; case 3: return 5; case 99: return 6; case -5: return 7; default: return 8; } } int main(){ return e(-100)+e(7)*10+e(1000)+e(50000)+e(3)+e(99)+e(-5)+e(4)+e(100000)+g; }"
+OPTS=--profile-functions assert_obj 19 'int g = 7; int tab[6] = {1, 1, 2, 3, 5, 8}; char msg[] = "abc"; char *p = "xyz"; int z[3]; int main(){ return g + tab[5] + msg[2] - 99 + p[1] - 121 + z[2] + sizeof(msg); }'
+OPTS=--passes=peephole assert_obj 3 "int main(){int x; x=3; return x*(1/1);}"
+# 追跡しきれない数の局所変数
+many_locals="int main(){ $(for i in $(seq 300); do printf 'int v%d; ' $i; done) int *p; p = &v299; *p = 40; v1 = 1; v300 = 1; return v1 + v300 + v299; }"
+assert 42 "$many_locals"
+assert_ir 42 "$many_locals"
+# 100を超える関数、大域変数と文字列リテラル
+many_funcs="$(for i in $(seq 150); do printf 'int g%d; char *s%d = "x%d"; int f%d(int x){ return x + %d; } ' $i $i $i $i $i; done) int main(){ g150 = 3; return g150 + s120[1] - 48 + f150(1) - f3(100); }"
+assert 52 "$many_funcs"
+OPTS="-O0 -j4" assert 52 "$many_funcs"
 assert 2 "test/t1.c"
 echo OK
\ No newline at end of file
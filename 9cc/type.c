@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include "9cc.h"
+
+Type *new_type(int ty)
+{
+    Type *t = calloc(1, sizeof(Type));
+    t->ty = ty;
+    return t;
+}
+
+Type *pointer_to(Type *base)
+{
+    Type *t = new_type(PTR);
+    t->ptr_to = base;
+    return t;
+}
+
+Type *array_of(Type *base, int size)
+{
+    Type *t = new_type(ARRAY);
+    t->ptr_to = base;
+    t->array_size = size;
+    return t;
+}
+
+// PTRとARRAYはポインタ演算の対象になる
+int is_pointer(Type *t)
+{
+    return t && (t->ty == PTR || t->ty == ARRAY);
+}
+
+int size_of(Type *t)
+{
+    switch (t->ty)
+    {
+    case CHAR:
+        return 1;
+    case INT:
+        return 4;
+    case PTR:
+        return 8;
+    case ARRAY:
+        return size_of(t->ptr_to) * t->array_size;
+    }
+    error("unknown type size");
+}
+
+int align_of(Type *t)
+{
+    if (t->ty == ARRAY)
+    {
+        return align_of(t->ptr_to);
+    }
+    return size_of(t);
+}
+
+int align_to(int n, int align)
+{
+    return (n + align - 1) / align * align;
+}
+
+// Sets the type of every expression in the tree.
+void add_type(Node *node)
+{
+    if (!node || node->type)
+    {
+        return;
+    }
+
+    add_type(node->lhs);
+    add_type(node->rhs);
+    add_type(node->cond);
+    add_type(node->then);
+    add_type(node->els);
+    add_type(node->init);
+    add_type(node->inc);
+    for (Node *n = node->body; n; n = n->next)
+    {
+        add_type(n);
+    }
+    for (Node *n = node->args; n; n = n->next)
+    {
+        add_type(n);
+    }
+
+    switch (node->kind)
+    {
+    case ND_ADD:
+    case ND_SUB:
+        // ポインタ演算ならポインタ型、配列は先頭要素へのポインタになる
+        if (is_pointer(node->lhs->type))
+        {
+            node->type = pointer_to(node->lhs->type->ptr_to);
+        }
+        else if (is_pointer(node->rhs->type))
+        {
+            node->type = pointer_to(node->rhs->type->ptr_to);
+        }
+        else
+        {
+            node->type = new_type(INT);
+        }
+        return;
+    case ND_MUL:
+    case ND_DIV:
+    case ND_NUM:
+    case ND_LESS_THAN:
+    case ND_EQUAL_LESS_THAN:
+    case ND_EQ:
+    case ND_NE:
+    case ND_FUNCALL:
+        node->type = new_type(INT);
+        return;
+    case ND_ASSIGN:
+        node->type = node->lhs->type;
+        return;
+    case ND_ADDR:
+        if (node->lhs->type->ty == ARRAY)
+        {
+            node->type = pointer_to(node->lhs->type->ptr_to);
+        }
+        else
+        {
+            node->type = pointer_to(node->lhs->type);
+        }
+        return;
+    case ND_DEREF:
+        if (!is_pointer(node->lhs->type))
+        {
+            error("invalid pointer dereference");
+        }
+        node->type = node->lhs->type->ptr_to;
+        return;
+    case ND_STR_LITERAL:
+        node->type = pointer_to(new_type(CHAR));
+        return;
+    case ND_COMMA:
+        node->type = node->rhs->type;
+        return;
+    }
+}
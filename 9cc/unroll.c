@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include "optimize.h"
+#include "profile.h"
+
+/*
+ * Loop unrolling
+ *
+ * Handles for loops of the form
+ *
+ *     for (init; i < n; i = i + k) body    (also <=, and n < i with k < 0)
+ *
+ * where i is a tracked int local which only the increment changes and n is
+ * a constant or a local the loop does not change, and body has no break.
+ *
+ * When init sets i to a constant and n is a constant, the trip count is
+ * known and a small loop is replaced by that many copies of body and the
+ * increment. Otherwise the body is repeated UNROLL times under a condition
+ * which checks the last of those iterations, and a copy of the original
+ * loop runs the remaining iterations:
+ *
+ *     init;
+ *     for (; i + (UNROLL-1)*k < n; i = i + k) { body; i = i + k; ... body; }
+ *     for (; i < n; i = i + k) body
+ *
+ * Arithmetic is done in 64 bits by gen(), so i + (UNROLL-1)*k cannot wrap.
+ *
+ * With a profile, loops which never ran are left alone, and a loop is only
+ * partially unrolled when it ran at least UNROLL iterations on average each
+ * time it was entered. Hot loops may have larger bodies.
+ */
+
+#define UNROLL 4
+#define MAX_TRIPS 16
+#define MAX_UNROLLED_NODES 256
+#define MAX_PARTIAL_NODES 64
+#define MAX_HOT_PARTIAL_NODES 128
+
+static Node *fn;
+static Locals *vars;
+
+static void count_node(Node *node, void *ctx)
+{
+    (*(int *)ctx)++;
+}
+
+static int size_of_tree(Node *node)
+{
+    int n = 0;
+    visit(node, count_node, &n);
+    return n;
+}
+
+typedef struct
+{
+    Node *iv;
+    int step;
+    Node *bound; // n
+    bool inclusive;
+} Counted;
+
+// Matches the loop described above.
+static bool match(Node *node, Counted *c)
+{
+    c->iv = basic_iv(vars, node->inc, &c->step);
+    Node *cond = node->cond;
+    if (!c->iv || c->step == 0 || !cond || (cond->kind != ND_LESS_THAN && cond->kind != ND_EQUAL_LESS_THAN))
+    {
+        return false;
+    }
+    c->inclusive = cond->kind == ND_EQUAL_LESS_THAN;
+    // 増加するならi < n、減少するならn < i
+    Node *iv = c->step > 0 ? cond->lhs : cond->rhs;
+    c->bound = c->step > 0 ? cond->rhs : cond->lhs;
+    if (iv->kind != ND_LVAR || iv->offset != c->iv->offset)
+    {
+        return false;
+    }
+    if (assigns_var(node->cond, c->iv->offset) || assigns_var(node->then, c->iv->offset))
+    {
+        return false;
+    }
+    if (c->bound->kind == ND_NUM)
+    {
+        return true;
+    }
+    return local_index(vars, c->bound) >= 0 && !assigns_var(node->cond, c->bound->offset) &&
+           !assigns_var(node->then, c->bound->offset) && !assigns_var(node->inc, c->bound->offset);
+}
+
+// The number of iterations if it is known, otherwise -1.
+static long trip_count(Node *node, Counted *c)
+{
+    Node *init = node->init;
+    if (!init || init->kind != ND_ASSIGN || init->lhs->kind != ND_LVAR || init->lhs->offset != c->iv->offset ||
+        init->rhs->kind != ND_NUM || c->bound->kind != ND_NUM)
+    {
+        return -1;
+    }
+    long from = init->rhs->val;
+    long to = c->bound->val;
+    long distance = c->step > 0 ? to - from : from - to;
+    long step = labs(c->step);
+    if (c->inclusive)
+    {
+        return distance >= 0 ? distance / step + 1 : 0;
+    }
+    return distance > 0 ? (distance + step - 1) / step : 0;
+}
+
+static Node *new_block(Node *body)
+{
+    Node *n = calloc(1, sizeof(Node));
+    n->kind = ND_BLOCK;
+    n->body = body;
+    return n;
+}
+
+// { init; body; inc; body; inc; ... }
+static void unroll_fully(Node *node, long trips)
+{
+    Node head = {};
+    Node *cur = &head;
+    if (node->init)
+    {
+        cur = cur->next = node->init;
+    }
+    for (long i = 0; i < trips; i++)
+    {
+        cur = cur->next = copy_tree(node->then);
+        cur = cur->next = copy_tree(node->inc);
+    }
+    replace_node(node, new_block(head.next));
+}
+
+// i + (UNROLL-1)*k
+static Node *last_iv(Counted *c)
+{
+    Node *add = new_node(ND_ADD, copy_tree(c->iv), new_node_num((UNROLL - 1) * c->step));
+    add->type = c->iv->type;
+    return add;
+}
+
+static void unroll_partially(Node *node, Counted *c)
+{
+    Node head = {};
+    Node *cur = &head;
+    for (int i = 0; i < UNROLL; i++)
+    {
+        if (i > 0)
+        {
+            cur = cur->next = copy_tree(node->inc);
+        }
+        cur = cur->next = copy_tree(node->then);
+    }
+
+    Node *main = calloc(1, sizeof(Node));
+    main->kind = ND_FOR;
+    // 条件式のiをi + (UNROLL-1)*kにする
+    if (c->step > 0)
+    {
+        main->cond = new_node(node->cond->kind, last_iv(c), copy_tree(c->bound));
+    }
+    else
+    {
+        main->cond = new_node(node->cond->kind, copy_tree(c->bound), last_iv(c));
+    }
+    main->cond->type = node->cond->type;
+    main->inc = copy_tree(node->inc);
+    main->then = new_block(head.next);
+    main->site = node->site;
+
+    Node *rest = calloc(1, sizeof(Node));
+    *rest = *node;
+    rest->init = NULL;
+    rest->next = NULL;
+
+    main->next = rest;
+    if (node->init)
+    {
+        node->init->next = main;
+        replace_node(node, new_block(node->init));
+        return;
+    }
+    replace_node(node, new_block(main));
+}
+
+static void unroll(Node *node);
+
+static void unroll_loop(Node *node)
+{
+    unroll(node->then);
+
+    vars = collect_locals(fn);
+    Counted c;
+    // breakがあると回数が決まらない
+    if (is_cold(node) || has_break(node->then) || !match(node, &c))
+    {
+        return;
+    }
+    int size = size_of_tree(node->then) + size_of_tree(node->inc);
+    long trips = trip_count(node, &c);
+    if (trips >= 0 && trips <= MAX_TRIPS && trips * size <= MAX_UNROLLED_NODES)
+    {
+        unroll_fully(node, trips);
+        return;
+    }
+    // 入るたびの平均の繰り返し回数
+    long body = profile_count(node, 0);
+    long entries = profile_count(node, 1);
+    if (entries > 0 && body < entries * UNROLL)
+    {
+        return;
+    }
+    int max_size = is_hot(node) ? MAX_HOT_PARTIAL_NODES : MAX_PARTIAL_NODES;
+    if (size <= max_size && (trips < 0 || trips >= UNROLL))
+    {
+        unroll_partially(node, &c);
+    }
+}
+
+static void unroll(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+    case ND_SWITCH:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            unroll(n);
+        }
+        return;
+    case ND_IF:
+        unroll(node->then);
+        unroll(node->els);
+        return;
+    case ND_WHILE:
+        unroll(node->then);
+        return;
+    case ND_FOR:
+        if (!node->lanes)
+        {
+            unroll_loop(node);
+        }
+        return;
+    }
+}
+
+void unroll_loops(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        fn = text[i];
+        unroll(fn->body);
+    }
+}
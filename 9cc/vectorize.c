@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include "optimize.h"
+
+/*
+ * Loop vectorization
+ *
+ * Handles for loops of the form
+ *
+ *     for (init; i < n; i = i + 1) a[i] = expr;    (also <=)
+ *
+ * where expr adds and subtracts elements b[i] of arrays and values which the
+ * loop does not change, and all the arrays have the same element type, int
+ * or char. Every access is at index i of an array object, so no iteration
+ * reads what another one writes. The loop becomes
+ *
+ *     init;
+ *     for (; i + (lanes-1) < n; i = i + lanes) a[i] = expr;  // lanes is set
+ *     for (; i < n; i = i + 1) a[i] = expr;
+ *
+ * and gen() emits the first loop with SSE2 instructions which handle 16
+ * bytes at a time: 4 ints or 16 chars. Addition and subtraction wrap the
+ * same way in every lane as in a scalar register truncated by the store, so
+ * char elements give the same result as the scalar loop.
+ */
+
+#define MAX_VECTOR_DEPTH 7 // xmm0-7 hold intermediate values
+#define MAX_SCALARS 8      // and xmm8-15 the invariant ones
+
+static Locals *vars;
+
+typedef struct
+{
+    Node *iv;
+    Type *elem; // the element type of the arrays
+    int nscalars;
+} Access;
+
+// Whether node is x[i] for an array object x whose element type is elem.
+static bool is_element(Node *node, Access *a)
+{
+    if (node->kind != ND_DEREF || node->lhs->kind != ND_ADD)
+    {
+        return false;
+    }
+    Node *base = node->lhs->lhs;
+    Node *index = node->lhs->rhs;
+    if ((base->kind != ND_LVAR && base->kind != ND_GVAR) || base->type->ty != ARRAY)
+    {
+        return false;
+    }
+    Type *elem = base->type->ptr_to;
+    if (elem->ty != INT && elem->ty != CHAR)
+    {
+        return false;
+    }
+    if (a->elem && a->elem->ty != elem->ty)
+    {
+        return false;
+    }
+    a->elem = elem;
+
+    // 添字は i * size (charは畳み込まれて i)
+    if (index->kind == ND_MUL && index->rhs->kind == ND_NUM && index->rhs->val == size_of(elem))
+    {
+        index = index->lhs;
+    }
+    else if (size_of(elem) != 1)
+    {
+        return false;
+    }
+    return index->kind == ND_LVAR && index->offset == a->iv->offset;
+}
+
+// Whether node is a value the loop does not change.
+static bool is_invariant(Node *node, Access *a)
+{
+    if (node->kind == ND_NUM)
+    {
+        return true;
+    }
+    return local_index(vars, node) >= 0 && node->offset != a->iv->offset && node->type->ty != PTR;
+}
+
+static bool is_vector_expr(Node *node, Access *a, int depth)
+{
+    if (depth > MAX_VECTOR_DEPTH)
+    {
+        return false;
+    }
+    if (node->kind == ND_ADD || node->kind == ND_SUB)
+    {
+        return is_vector_expr(node->lhs, a, depth + 1) && is_vector_expr(node->rhs, a, depth + 1);
+    }
+    if (is_element(node, a))
+    {
+        return true;
+    }
+    return is_invariant(node, a) && ++a->nscalars <= MAX_SCALARS;
+}
+
+// The single statement of the loop body, or NULL.
+static Node *single_stmt(Node *node)
+{
+    while (node->kind == ND_BLOCK)
+    {
+        if (!node->body || node->body->next)
+        {
+            return NULL;
+        }
+        node = node->body;
+    }
+    return node;
+}
+
+// The number of iterations if it is known, otherwise -1.
+static long trip_count(Node *node, Node *iv)
+{
+    Node *init = node->init;
+    Node *bound = node->cond->rhs;
+    if (!init || init->kind != ND_ASSIGN || init->lhs->kind != ND_LVAR || init->lhs->offset != iv->offset ||
+        init->rhs->kind != ND_NUM || bound->kind != ND_NUM)
+    {
+        return -1;
+    }
+    long trips = (long)bound->val - init->rhs->val + (node->cond->kind == ND_EQUAL_LESS_THAN);
+    return trips > 0 ? trips : 0;
+}
+
+static Node *new_block(Node *body)
+{
+    Node *n = calloc(1, sizeof(Node));
+    n->kind = ND_BLOCK;
+    n->body = body;
+    return n;
+}
+
+static void vectorize_loop(Node *node)
+{
+    int step;
+    Access a = {};
+    a.iv = basic_iv(vars, node->inc, &step);
+    Node *cond = node->cond;
+    if (!a.iv || step != 1 || !cond || (cond->kind != ND_LESS_THAN && cond->kind != ND_EQUAL_LESS_THAN))
+    {
+        return;
+    }
+    if (cond->lhs->kind != ND_LVAR || cond->lhs->offset != a.iv->offset || !is_invariant(cond->rhs, &a))
+    {
+        return;
+    }
+    Node *stmt = single_stmt(node->then);
+    if (!stmt || stmt->kind != ND_ASSIGN || !is_element(stmt->lhs, &a) || !is_vector_expr(stmt->rhs, &a, 0))
+    {
+        return;
+    }
+    int lanes = 16 / size_of(a.elem);
+    long trips = trip_count(node, a.iv);
+    if (trips >= 0 && trips < lanes)
+    {
+        return;
+    }
+
+    Node *guard_iv = new_node(ND_ADD, copy_tree(a.iv), new_node_num(lanes - 1));
+    guard_iv->type = a.iv->type;
+    Node *vector = calloc(1, sizeof(Node));
+    vector->kind = ND_FOR;
+    vector->cond = new_node(cond->kind, guard_iv, copy_tree(cond->rhs));
+    vector->cond->type = cond->type;
+    vector->then = copy_tree(stmt);
+    vector->inc = new_node(ND_ASSIGN, copy_tree(a.iv),
+                           new_node(ND_ADD, copy_tree(a.iv), new_node_num(lanes)));
+    vector->inc->type = vector->inc->rhs->type = a.iv->type;
+    vector->lanes = lanes;
+    vector->site = node->site;
+
+    // 残りの要素は元のループで処理する
+    Node *rest = calloc(1, sizeof(Node));
+    *rest = *node;
+    rest->init = NULL;
+    rest->next = NULL;
+    vector->next = rest;
+
+    if (node->init)
+    {
+        node->init->next = vector;
+        replace_node(node, new_block(node->init));
+        return;
+    }
+    replace_node(node, new_block(vector));
+}
+
+static void vectorize(Node *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->kind)
+    {
+    case ND_BLOCK:
+    case ND_SWITCH:
+        for (Node *n = node->body; n; n = n->next)
+        {
+            vectorize(n);
+        }
+        return;
+    case ND_IF:
+        vectorize(node->then);
+        vectorize(node->els);
+        return;
+    case ND_WHILE:
+        vectorize(node->then);
+        return;
+    case ND_FOR:
+        vectorize(node->then);
+        vectorize_loop(node);
+        return;
+    }
+}
+
+void vectorize_loops(void)
+{
+    for (int i = 0; text[i]; i++)
+    {
+        vars = collect_locals(text[i]);
+        vectorize(text[i]->body);
+    }
+}